@@ -9,6 +9,9 @@
 #include <webots/receiver.h>
 #include <webots/supervisor.h>
 
+#include "params.h"
+#include "spatial_grid.h"
+
 //---------------------------------------------------------
 /* FLAGS */
 #define PSO_OPTIMIZATION true
@@ -16,9 +19,7 @@
 //----------------------------------------------------------
 /*DEFINITION*/
 
-// #define FLOCK_SIZE 1 // Number of robots in flock for localization world
-#define FLOCK_SIZE 5 //Number of robots in flock for obstacle world
-#define TIME_STEP 64 // [ms] Length of time step
+#define FLOCK_SIZE PARAMS_MAX_FLOCK_SIZE // Capacity of the flock tables, params.flock_size robots are used
 
 #define MAX_SPEED_WEB 6.28 // Maximum speed webots
 #define MAX_SPEED 800	   // Maximum speed
@@ -43,7 +44,7 @@
 #define VMAX 0.5	 // Maximum velocity particle can attain
 #define MININIT 0.0	 // Lower bound on initialization value
 #define MAXINIT 1.0	 // Upper bound on initialization value
-#define ITS 100		 // Number of iterations to run
+// The number of iterations is params.pso_iterations, see params_schema.h
 //#define DATASIZE 2*(NB_SENSOR+2+1)      // Number of elements in particle (2 Neurons with 8 proximity sensors
 // + 2 recursive/lateral conenctions + 1 bias)
 // defined in pso.h
@@ -55,8 +56,7 @@
 #define FIXEDRAD_NB 2
 
 /* Fitness definitions */
-#define FIT_ITS 1800 // Number of fitness steps to run during optimization
-
+// The number of fitness steps is params.fit_its, see params_schema.h
 #define FINALRUNS 10
 #define NEIGHBORHOOD STANDARD
 #define RADIUS 0.8
@@ -76,6 +76,8 @@ float loc[FLOCK_SIZE][3];			 // Location of everybody in the flock
 double initial_loc[FLOCK_SIZE][3];	 // Initial translation of everybody in the flock
 double initial_rot[FLOCK_SIZE][4];	 // Initial rotation of everybody in the flock
 float estimated_pose[FLOCK_SIZE][2]; // Estimated position of each robot by using different localization method
+spatial_grid_t grid;				 // Robots of the flock sorted by position, for the pair terms of the fitness
+int close_robots[FLOCK_SIZE];		 // Result of the grid queries
 int offset;							 // Offset of robots number
 float migrx, migrz;					 // Migration vector
 float orient_migr;					 // Migration orientation
@@ -89,6 +91,7 @@ void reset(void)
 {
 	int i;
 	wb_robot_init();
+	params_init(&params);
 
 	receiver = wb_robot_get_device("receiver");
 	wb_receiver_enable(receiver, 1);
@@ -106,9 +109,9 @@ void reset(void)
 	if (receiver == 0)
 		printf("missing receiver\n");
 
-	char rob[7] = "epuck0";
+	char rob[16] = "epuck0";
 	// Load robot field for flocking
-	for (i = 0; i < FLOCK_SIZE; i++)
+	for (i = 0; i < params.flock_size; i++)
 	{
 		sprintf(rob, "epuck%d", i + offset);
 		robs[i] = wb_supervisor_node_get_from_def(rob);
@@ -134,7 +137,7 @@ void reset(void)
 void get_initial_flocking_center()
 {
 	int i, j;
-	for (i = 0; i < FLOCK_SIZE; i++)
+	for (i = 0; i < params.flock_size; i++)
 	{
 		loc[i][0] = wb_supervisor_field_get_sf_vec3f(robs_trans[i])[0];		  // X
 		loc[i][1] = wb_supervisor_field_get_sf_vec3f(robs_trans[i])[2];		  // Z
@@ -150,8 +153,8 @@ void get_initial_flocking_center()
 		}
 		initial_rot[i][3] = wb_supervisor_field_get_sf_rotation(robs_rotation[i])[3];
 	}
-	prev_flocking_center[0] /= FLOCK_SIZE;
-	prev_flocking_center[1] /= FLOCK_SIZE;
+	prev_flocking_center[0] /= params.flock_size;
+	prev_flocking_center[1] /= params.flock_size;
 }
 /*
  * Compute localization metric
@@ -162,7 +165,7 @@ void compute_localization_fitness(float *fit_loc)
 	*fit_loc = 0;
 	int i;
 	// When calculated error between the estimated pose and the pose get from webot world, covert y axis
-	for (i = 0; i < FLOCK_SIZE; i++)
+	for (i = 0; i < params.flock_size; i++)
 	{
 		*fit_loc += sqrt((powf(loc[i][0] - estimated_pose[i][0], 2) + powf(-loc[i][1] - estimated_pose[i][1], 2)));
 	}
@@ -184,23 +187,32 @@ void compute_flocking_fitness(float *fit_flocking)
 	float fit_flocking_center_dist = 0.0;
 	float flocking_center[] = {0.0, 0.0};
 	float dist_diff;
-	float N_pairs = FLOCK_SIZE * (FLOCK_SIZE + 1) / 2;
+	float radius = params.fitness_radius > 0.0f ? params.fitness_radius : INFINITY;
+	float N_pairs = params.flock_size * (params.flock_size + 1) / 2;
 	float speed_max = MAX_SPEED_WEB * MAX_SPEED * WHEEL_RADIUS / 1000;
-	float Dmax = speed_max * TIME_STEP;
+	float Dmax = speed_max * params.time_step;
 	int i;
 	int j;
-	for (i = 0; i < FLOCK_SIZE; i++)
+	int k, n;
+	for (i = 0; i < params.flock_size; i++)
 	{
 		flocking_center[0] += loc[i][0];
 		flocking_center[1] += loc[i][1];
 	}
-	flocking_center[0] /= FLOCK_SIZE;
-	flocking_center[1] /= FLOCK_SIZE;
+	flocking_center[0] /= params.flock_size;
+	flocking_center[1] /= params.flock_size;
 
-	for (i = 0; i < FLOCK_SIZE; i++)
+	// Only the pairs within params.fitness_radius are scored, each robot queries the grid instead of
+	// the whole flock. Without a radius the grid is a single cell and every pair is scored.
+	spatial_grid_build(&grid, &loc[0][0], 3, params.flock_size, params.fitness_radius);
+	for (i = 0; i < params.flock_size; i++)
 	{
-		for (j = i + 1; j < FLOCK_SIZE; j++)
+		n = spatial_grid_radius(&grid, loc[i][0], loc[i][1], radius, close_robots, FLOCK_SIZE);
+		for (k = 0; k < n; k++)
 		{
+			j = close_robots[k];
+			if (j <= i)
+				continue;
 			// Distance measure for each pair of robots
 			dist_diff = fabs(sqrtf(powf(loc[i][0] - loc[j][0], 2) + powf(loc[i][1] - loc[j][1], 2)));
 			fit_inter_dist += fmin(dist_diff / TARGET_FLOCKING_DISTANCE, 1 / powf(1 - TARGET_FLOCKING_DISTANCE + dist_diff, 2));
@@ -213,7 +225,7 @@ void compute_flocking_fitness(float *fit_flocking)
 	}
 
 	fit_inter_dist /= N_pairs;
-	fit_flocking_center_dist /= FLOCK_SIZE;
+	fit_flocking_center_dist /= params.flock_size;
 	fit_dist = 1 / (1 + fit_flocking_center_dist) * fit_inter_dist;
 	fit_heading /= N_pairs;
 	fit_heading = 1 - fit_heading;
@@ -235,7 +247,7 @@ void calc_fitness(double weights[ROBOTS][DATASIZE], double fit[ROBOTS], int its,
 	double sum_fitness = 0.0;
 	/* Reset robots to initial position*/
 	double zero_velocity[6] = {0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
-	for (i = 0; i < FLOCK_SIZE; i++)
+	for (i = 0; i < params.flock_size; i++)
 	{
 		wb_supervisor_field_set_sf_vec3f(wb_supervisor_node_get_field(robs[i], "translation"), initial_loc[i]);
 		wb_supervisor_field_set_sf_rotation(wb_supervisor_node_get_field(robs[i], "rotation"), initial_rot[i]);
@@ -264,8 +276,8 @@ void calc_fitness(double weights[ROBOTS][DATASIZE], double fit[ROBOTS], int its,
 
 	for (t = 0; t < its; t++)
 	{
-		wb_robot_step(TIME_STEP);
-		for (i = 0; i < FLOCK_SIZE; i++)
+		wb_robot_step(params.time_step);
+		for (i = 0; i < params.flock_size; i++)
 		{
 			loc[i][0] = wb_supervisor_field_get_sf_vec3f(robs_trans[i])[0];		  // X
 			loc[i][1] = wb_supervisor_field_get_sf_vec3f(robs_trans[i])[2];		  // Z
@@ -292,7 +304,7 @@ Fitness function for PSO optimazation
 void fitness(double weights[ROBOTS][DATASIZE], double fit[ROBOTS], int neighbors[SWARMSIZE][SWARMSIZE])
 {
 
-	calc_fitness(weights, fit, FIT_ITS, ROBOTS);
+	calc_fitness(weights, fit, params.fit_its, ROBOTS);
 
 #if NEIGHBORHOOD == RAND_NB
 	nRandom(neighbors, 2 * NB);
@@ -361,7 +373,7 @@ int main(int argc, char *args[])
 
 	for (i = 0; i < 10; i++)
 	{
-		flocking_weights = pso(SWARMSIZE, NB, LWEIGHT, NBWEIGHT, VMAX, MININIT, MAXINIT, ITS, DATASIZE, ROBOTS);
+		flocking_weights = pso(SWARMSIZE, NB, LWEIGHT, NBWEIGHT, VMAX, MININIT, MAXINIT, params.pso_iterations, DATASIZE, ROBOTS);
 		fit = 0.0;
 		for (i = 0; i < MAX_ROB; i++)
 		{
@@ -371,7 +383,7 @@ int main(int argc, char *args[])
 
 		// Run FINALRUN tests and calculate average
 
-		calc_fitness(w, f, FIT_ITS, MAX_ROB);
+		calc_fitness(w, f, params.fit_its, MAX_ROB);
 
 		fit /= f[0];
 		// Check for new best fitness
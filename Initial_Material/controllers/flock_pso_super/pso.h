@@ -9,7 +9,7 @@
 
 #define FONT "Arial"
 
-#define DATASIZE 3
+#define DATASIZE 4 // rule1 weight, rule2 weight, rule2 threshold, k nearest of the topological mode
 //#define SWARMSIZE 10
 #define SWARMSIZE 6
 
@@ -0,0 +1,27 @@
+#ifndef SPATIAL_GRID_H
+#define SPATIAL_GRID_H
+
+#include <stdbool.h>
+
+#define SPATIAL_GRID_CAPACITY 8192 // Points of the largest flock
+#define SPATIAL_GRID_SIDE 128      // Most cells along a side, the cells grow to keep a spread flock within
+
+// Uniform grid over the bounding box of a set of 2D points. The points are sorted by cell,
+// column after column, so the cells of a column within a query are one contiguous run.
+typedef struct
+{
+    float cell_size;
+    float origin[2]; // Lower corner of cell (0, 0)
+    int columns, rows;
+    int count;
+    int cell_start[SPATIAL_GRID_SIDE * SPATIAL_GRID_SIDE + 1]; // Points of cell c are [cell_start[c], cell_start[c + 1])
+    int cell_fill[SPATIAL_GRID_SIDE * SPATIAL_GRID_SIDE];      // Scratch of spatial_grid_build
+    float x[SPATIAL_GRID_CAPACITY], y[SPATIAL_GRID_CAPACITY];
+    int index[SPATIAL_GRID_CAPACITY]; // Index of the point in the caller's array
+} spatial_grid_t;
+
+bool spatial_grid_build(spatial_grid_t *grid, const float *xy, int stride, int count, float cell_size);
+int spatial_grid_radius(const spatial_grid_t *grid, float x, float y, float radius, int *found, int max_found);
+int spatial_grid_nearest(const spatial_grid_t *grid, float x, float y, int k, int exclude, int *found, float *dist2);
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef ACC_BIAS_H
+#define ACC_BIAS_H
+
+#include <stdbool.h>
+
+#include "odometry.h"
+
+// Streaming estimate of the accelerometer bias. Samples are taken whenever the encoders show no
+// acceleration, robot still or driving straight at constant speed, so it refines while moving.
+typedef struct
+{
+    double T;          // Time step in second
+    double prev_speed; // Speed of the robot at the previous step, from the encoders
+    int steady_steps;  // Consecutive steps without acceleration
+    long count;        // Samples in the estimate
+    double mean[3];    // Bias of each axis
+    double m2[3];      // Sum of squared deviations from the mean (Welford)
+} acc_bias_t;
+
+void acc_bias_reset(acc_bias_t *bias, int time_step);
+bool acc_bias_update(acc_bias_t *bias, const double acc[3], double Aleft_enc, double Aright_enc, const odo_calibration_t *calibration);
+bool acc_bias_ready(const acc_bias_t *bias);
+bool acc_bias_load(acc_bias_t *bias, const char *file_name);
+bool acc_bias_save(const acc_bias_t *bias, const char *file_name);
+
+#endif
@@ -22,6 +22,9 @@
 #include <webots/receiver.h>
 
 #include "localization.h"
+#include "params.h"
+#include "neighbour_table.h"
+#include "ping_packet.h"
 //------------------------------------------------------------
 /* Definition */
 #define NB_SENSORS 8  // Number of distance sensors
@@ -31,13 +34,12 @@
 /*Webots 2018b*/
 #define MAX_SPEED_WEB 6.28 // Maximum speed webots
 /*Webots 2018b*/
-#define FLOCK_SIZE 5 // Size of flock
-#define TIME_STEP 64 // [ms] Length of time step
+#define FLOCK_SIZE PARAMS_MAX_FLOCK_SIZE // Capacity of the flock tables, params.flock_size robots are used
 
 #define AXLE_LENGTH 0.052		// Distance between wheels of robot (meters)
 #define SPEED_UNIT_RADS 0.00628 // Conversion factor from speed unit to radian per second
 #define WHEEL_RADIUS 0.0205		// Wheel radius (meters)
-#define DELTA_T 0.064			// Timestep (seconds)
+#define DELTA_T (params.time_step / 1000.0) // Timestep (seconds)
 
 #define MIGRATORY_URGE 1 // Tells the robots if they should just go forward or move towards a specific migratory direction
 
@@ -62,16 +64,13 @@ WbDeviceTag emitter_radio;	   // Handle for the emitter node
 
 int e_puck_matrix[16] = {17, 29, 34, 10, 8, -38, -56, -76, -72, -58, -36, 8, 10, 36, 28, 18}; // for obstacle avoidance
 
-int robot_id_u, robot_id; // Unique and normalized (between 0 and FLOCK_SIZE-1) robot ID
+int robot_id_u, robot_id; // Unique and normalized (between 0 and params.flock_size-1) robot ID
 
-float relative_pos[FLOCK_SIZE][3];		// relative X, Z, Theta of all robots
-float prev_relative_pos[FLOCK_SIZE][3]; // Previous relative  X, Z, Theta values
 float my_position[3];					// X, Z, Theta of the current robot
 float prev_my_position[3];				// X, Z, Theta of the current robot in the previous time step
+float my_velocity[2];					// X, Z speed of the current robot over the last time step
 float speed[FLOCK_SIZE][2];				// Speeds calculated with Reynold's rules
-float relative_speed[FLOCK_SIZE][2];	// Speeds calculated with Reynold's rules
 int initialized[FLOCK_SIZE];			// != 0 if initial positions have been received
-float migr[2] = {3, 0};					// Migration vector
 char *robot_name;
 float initial_position[3];
 int msl, msr; // Wheel speeds
@@ -79,13 +78,11 @@ float theta_robots[FLOCK_SIZE];
 
 float estimate_pose[3];
 
-// Define the threshold and the weighting
-float rule1_weight = 0.06;
-float rule2_thres = 0.06;
-float rule2_weight = 0.001;
-float rule3_weight = 0.1;
-float migration_weight = 0.005;
-int loop_num = 1000;
+neighbour_table_t neighbours; // Flockmates heard on the infrared ping, by robot id
+int ping_sequence;			  // Pings sent so far
+
+// The thresholds and weightings of the rules, the migration vector, the time step and the
+// localization method are read from the experiment parameters, see params_schema.h
 
 /*
  * Reset the robot's devices and get its ID
@@ -93,6 +90,7 @@ int loop_num = 1000;
 static void reset()
 {
 	wb_robot_init();
+	params_init(&params);
 	receiver_infrared = wb_robot_get_device("receiver_infrared");
 	emitter_infrared = wb_robot_get_device("emitter_infrared");
 
@@ -112,40 +110,35 @@ static void reset()
 	robot_name = (char *)wb_robot_get_name();
 
 	for (i = 0; i < NB_SENSORS; i++)
-		wb_distance_sensor_enable(ds[i], 64);
+		wb_distance_sensor_enable(ds[i], params.time_step);
 
-	wb_receiver_enable(receiver_infrared, 1);
+	// Every device is read once per control step, sampling it faster only costs simulation time
+	wb_receiver_enable(receiver_infrared, params.time_step);
 
 	//Reading the robot's name. Pay attention to name specification when adding robots to the simulation!
 	sscanf(robot_name, "epuck%d", &robot_id_u); // read robot id from the robot's name
-	robot_id = robot_id_u % FLOCK_SIZE;			// normalize between 0 and FLOCK_SIZE-1
+	robot_id = robot_id_u % params.flock_size;	// normalize between 0 and params.flock_size-1
 
-	for (i = 0; i < FLOCK_SIZE; i++)
+	for (i = 0; i < params.flock_size; i++)
 	{
 		initialized[i] = 0; // Set initialization to 0 (= not yet initialized)
 	}
+	neighbour_table_reset(&neighbours);
 
-	// hard-code the initial state of robot [0]: x [1]: y [2]:theta
-	initial_position[1] = -2.9;
+	// initial state of robot [0]: x [1]: y [2]:theta, from the start pose of the localization
+	initial_position[0] = -params.origin_y[robot_id];
+	initial_position[1] = params.origin_x;
 	initial_position[2] = -1.57;
-	if (robot_id == 0)
-		initial_position[0] = 0.0;
-	if (robot_id == 1)
-		initial_position[0] = 0.1;
-	if (robot_id == 2)
-		initial_position[0] = -0.1;
-	if (robot_id == 3)
-		initial_position[0] = 0.2;
-	if (robot_id == 4)
-		initial_position[0] = -0.2;
 
 	for (i = 0; i < 3; i++)
 	{
 		my_position[i] = initial_position[i];
 	}
+	my_velocity[0] = 0;
+	my_velocity[1] = 0;
+	ping_sequence = 0;
 	msl = 0;
 	msr = 0;
-	wb_receiver_disable(receiver_infrared);
 	printf("Reset: robot %d\n", robot_id_u);
 }
 
@@ -226,29 +219,47 @@ void compute_wheel_speeds(int *msl, int *msr)
  */
 void reynolds_rules()
 {
-	int i, j, k;					 // Loop counters
+	int i, j;						   // Loop counters
+	int nearest[NEIGHBOUR_TABLE_SIZE]; // Items of the neighbour table used by the rules
+	int count;						   // Number of neighbours used
 	float rel_avg_loc[2] = {0, 0};	 // Flock average positions
 	float rel_avg_speed[2] = {0, 0}; // Flock average speeds
 	float cohesion[2] = {0, 0};
 	float dispersion[2] = {0, 0};
 	float consistency[2] = {0, 0};
 
-	/* Compute averages over the whole flock */
-	for (i = 0; i < FLOCK_SIZE; i++)
+	/* Metric mode: every live neighbour, a robot out of range no longer counts.
+	   Topological mode: only the k nearest of them, whatever the density of the flock */
+	count = neighbour_table_nearest(&neighbours, params.topological_k > 0 ? params.topological_k : neighbours.count, nearest);
+
+	/* Compute averages over the selected neighbours */
+	/* Rule 2 - Dispersion/Separation: keep far enough from flockmates, in the same pass */
+	for (i = 0; i < count; i++)
 	{
-		if (i == robot_id)
-			continue;
+		const neighbour_t *neighbour = &neighbours.items[nearest[i]];
+		const float *relative_pos = neighbour->relative_pos;
 		for (j = 0; j < 2; j++)
 		{
-			rel_avg_speed[j] += relative_speed[i][j];
-			rel_avg_loc[j] += relative_pos[i][j];
+			rel_avg_speed[j] += neighbour->relative_speed[j];
+			rel_avg_loc[j] += relative_pos[j];
+		}
+		//printf("relative position of robot [%d] is: [1]%f, [2]%f \n", neighbour->id, relative_pos[0], relative_pos[1]);
+		// If neighbor i is too close (Euclidean distance)
+		if (pow(relative_pos[0], 2) + pow(relative_pos[1], 2) < params.rule2_thres)
+		{
+			for (j = 0; j < 2; j++)
+			{
+				dispersion[j] -= 1 / relative_pos[j]; // Relative distance to i
+			}
 		}
-		//printf("relative position of robot [%d] is: [1]%f, [2]%f \n", i, relative_pos[i][0], relative_pos[i][1]);
 	}
-	for (j = 0; j < 2; j++)
+	if (count > 0)
 	{
-		rel_avg_speed[j] /= FLOCK_SIZE - 1;
-		rel_avg_loc[j] /= FLOCK_SIZE - 1;
+		for (j = 0; j < 2; j++)
+		{
+			rel_avg_speed[j] /= count;
+			rel_avg_loc[j] /= count;
+		}
 	}
 
 	/* Rule 1 - Aggregation/Cohesion: move towards the center of mass */
@@ -258,27 +269,10 @@ void reynolds_rules()
 		cohesion[j] = rel_avg_loc[j];
 	}
 
-	/* Rule 2 - Dispersion/Separation: keep far enough from flockmates */
-	for (k = 0; k < FLOCK_SIZE; k++)
-	{
-		if (k != robot_id)
-		{ // Loop on flockmates only
-			// If neighbor k is too close (Euclidean distance)
-			if (pow(relative_pos[k][0], 2) + pow(relative_pos[k][1], 2) < rule2_thres)
-			{
-				for (j = 0; j < 2; j++)
-				{
-					dispersion[j] -= 1 / relative_pos[k][j]; // Relative distance to k
-				}
-			}
-		}
-	}
-
 	/* Rule 3 - Consistency/Alignment: match the speeds of flockmates */
 	for (j = 0; j < 2; j++)
 	{
-		//consistency[j] = rel_avg_speed[j];
-		consistency[j] = 0;
+		consistency[j] = rel_avg_speed[j];
 	}
 
 	//aggregation of all behaviors with relative influence determined by weights
@@ -288,9 +282,9 @@ void reynolds_rules()
 		// {
 		// 	printf("cohesion is %f %f, dispersion is %f %f\n", cohesion[0], cohesion[1], dispersion[0], dispersion[1]);
 		// }
-		speed[robot_id][j] = cohesion[j] * rule1_weight;
-		speed[robot_id][j] += dispersion[j] * rule2_weight;
-		// speed[robot_id][j] += consistency[j] * rule3_weight;
+		speed[robot_id][j] = cohesion[j] * params.rule1_weight;
+		speed[robot_id][j] += dispersion[j] * params.rule2_weight;
+		speed[robot_id][j] += consistency[j] * params.rule3_weight;
 	}
 	speed[robot_id][1] *= -1; //y axis of webots is inverted
 
@@ -302,11 +296,11 @@ void reynolds_rules()
 	}
 	else
 	{
-		speed[robot_id][0] += (migr[0] - my_position[0]) * migration_weight;
+		speed[robot_id][0] += (params.migr[0] - my_position[0]) * params.migration_weight;
 		//y axis of webots is inverted
-		speed[robot_id][1] -= (migr[1] - my_position[1]) * migration_weight;
+		speed[robot_id][1] -= (params.migr[1] - my_position[1]) * params.migration_weight;
 		// if (robot_id == 0)
-		// 	printf("migration is %f, %f\n", migr[0] - my_position[0], migr[1] - my_position[1]);
+		// 	printf("migration is %f, %f\n", params.migr[0] - my_position[0], params.migr[1] - my_position[1]);
 		// if (robot_id == 0)
 		// 	printf("my position is %f, %f, %f\n", my_position[0], my_position[1], my_position[2]);
 	}
@@ -314,19 +308,23 @@ void reynolds_rules()
 
 /*
  *  each robot sends a ping message, so the other robots can measure relative range and bearing to the sender.
- *  the message contains the robot's name
+ *  the message is a ping_packet_t with the robot's id, its estimated pose and velocity
  *  the range and bearing will be measured directly out of message RSSI and direction
+ *  with cooperative localization the message also carries the covariance of the estimated position
 */
 void send_ping(void)
 {
-	char out[10];
-	strcpy(out, robot_name); // in the ping message we send the name of the robot.
-	wb_emitter_send(emitter_infrared, out, strlen(out) + 1);
+	ping_packet_t packet;
+	float cov[3];
+	bool has_cov = params.cooperative_localization && localization_get_position_cov(cov);
+	ping_packet_encode(&packet, params.flock_id, robot_id_u, ping_sequence++, my_position, my_velocity, has_cov ? cov : NULL);
+	wb_emitter_send(emitter_infrared, &packet, sizeof(packet));
 }
 
 /*
  * processing all the received ping messages, and calculate range and bearing to the other robots
  * the range and bearing are measured directly out of message RSSI and direction
+ * the flockmates not heard for params.neighbour_timeout are then dropped from the neighbour table
 */
 void process_received_ping_messages(void)
 {
@@ -334,11 +332,14 @@ void process_received_ping_messages(void)
 	double message_rssi; // Received Signal Strength indicator
 	double theta;
 	double range;
-	char *inbuffer; // Buffer for the receiver node
-	int other_robot_id;
+	const ping_packet_t *packet; // The ping, read in place from the receiver buffer
+	float relative_pos[2];
+	float neighbour_pose[3], neighbour_cov[3];
+	neighbour_t *neighbour;
+	double time_now_s = wb_robot_get_time();
 	while (wb_receiver_get_queue_length(receiver_infrared) > 0)
 	{
-		inbuffer = (char *)wb_receiver_get_data(receiver_infrared);
+		packet = ping_packet_cast(wb_receiver_get_data(receiver_infrared), wb_receiver_get_data_size(receiver_infrared), params.flock_id);
 		message_direction = wb_receiver_get_emitter_direction(receiver_infrared);
 		message_rssi = wb_receiver_get_signal_strength(receiver_infrared);
 		double y = message_direction[2];
@@ -348,33 +349,26 @@ void process_received_ping_messages(void)
 		theta = theta + my_position[2]; // find the relative theta;
 		range = sqrt((1 / message_rssi));
 
-		other_robot_id = (int)(inbuffer[5] - '0'); // since the name of the sender is in the received message. Note: this does not work for robots having id bigger than 9!
-		//printf("robot_id is: %d, other_robot_id is: %d", robot_id, other_robot_id);
 		//printf("message_direction is: [0]%f, [1]%f, [2]%f\n", message_direction[0], message_direction[1], message_direction[2]);
-		// Get position update
-
-		// if (robot_id == 0)
-		// {
-		// 	printf("Robot id is: %d, range is: %f\n", other_robot_id, range);
-		// }
-		prev_relative_pos[other_robot_id][0] = relative_pos[other_robot_id][0];
-		prev_relative_pos[other_robot_id][1] = relative_pos[other_robot_id][1];
-
-		relative_pos[other_robot_id][0] = range * cos(theta);		 // relative x pos
-		relative_pos[other_robot_id][1] = -1.0 * range * sin(theta); // relative y pos
-
-		// if (robot_id == 2)
-		// {
-		// printf("relative_pos of robot %d is %f, %f\n", other_robot_id, relative_pos[other_robot_id][0], relative_pos[other_robot_id][0]);
-		// }
+		if (packet != NULL && packet->robot_id != robot_id_u)
+		{
+			// Get position update
+			relative_pos[0] = range * cos(theta);		 // relative x pos
+			relative_pos[1] = -1.0 * range * sin(theta); // relative y pos
+			neighbour = neighbour_table_observe(&neighbours, packet->robot_id, time_now_s, relative_pos, params.tracker_alpha, params.tracker_beta);
 
-		//printf("Robot %s, from robot %d, x: %g, y: %g, theta %g, my theta %g\n",robot_name,other_robot_id,relative_pos[other_robot_id][0],relative_pos[other_robot_id][1],-atan2(y,x)*180.0/3.141592,my_position[2]*180.0/3.141592);
+			//printf("Robot %s, from robot %d, x: %g, y: %g, theta %g, my theta %g\n",robot_name,packet->robot_id,relative_pos[0],relative_pos[1],-atan2(y,x)*180.0/3.141592,my_position[2]*180.0/3.141592);
 
-		relative_speed[other_robot_id][0] = relative_speed[other_robot_id][0] * 0.0 + 1.0 * (1 / DELTA_T) * (relative_pos[other_robot_id][0] - prev_relative_pos[other_robot_id][0]);
-		relative_speed[other_robot_id][1] = relative_speed[other_robot_id][1] * 0.0 + 1.0 * (1 / DELTA_T) * (relative_pos[other_robot_id][1] - prev_relative_pos[other_robot_id][1]);
+			// The neighbour position minus the relative position measures our own position
+			if (params.cooperative_localization && neighbour != NULL && ping_packet_get_pose(packet, neighbour_pose) && ping_packet_get_cov(packet, neighbour_cov))
+				localization_fuse_neighbour(neighbour_pose, neighbour_cov, relative_pos);
+		}
 
 		wb_receiver_next_packet(receiver_infrared);
 	}
+	neighbour_table_expire(&neighbours, time_now_s, params.neighbour_timeout);
+	// The neighbours not heard this step move on at their tracked speed
+	neighbour_table_predict(&neighbours, time_now_s);
 }
 
 // the main function
@@ -389,12 +383,11 @@ int main()
 	int max_sens;				 // Store highest sensor value
 
 	reset(); // Resetting the robot
-	localization_init(TIME_STEP);
+	localization_init(params.time_step);
+	localization_schedule_devices(1 << params.localization_method); // Only the devices this estimator reads are sampled
 
 	for (;;)
 	{
-		wb_receiver_enable(receiver_infrared, 1);
-
 		// if (wb_robot_get_time() < TIME_INIT_ACC)
 		// {
 		// controller_get_acc();
@@ -406,13 +399,14 @@ int main()
 		// }
 
 		/* Braitenberg */
-		for (t = 0; t < loop_num; t++)
+		for (t = 0; t < params.loop_num; t++)
 		{
 			// Continue one step
-			wb_robot_step(TIME_STEP);
+			wb_robot_step(params.time_step);
 			controller_get_pose();
 			controller_get_acc();
 			controller_get_encoder();
+			controller_compute_mean_acc(); // Online accelerometer bias, no startup stall
 
 			bmsl = 0;
 			bmsr = 0;
@@ -429,6 +423,7 @@ int main()
 				bmsr += e_puck_matrix[i] * distances[i];
 				bmsl += e_puck_matrix[i + NB_SENSORS] * distances[i];
 			}
+			controller_set_proximity(distances); // Map matching of the particle filter (localization method 5)
 
 			// Adapt Braitenberg values (empirical tests)
 			bmsl /= MIN_SENS;
@@ -444,7 +439,7 @@ int main()
 			prev_my_position[1] = my_position[1];
 
 			//localization by using different localization method
-			estimate_self_position(my_position, 3);
+			estimate_self_position(my_position, params.localization_method);
 			my_position[2] = my_position[2] - 1.57;
 			//my_position[1] = -my_position[1];
 			if (my_position[2] > 2 * M_PI)
@@ -461,8 +456,10 @@ int main()
 
 			process_received_ping_messages();
 
-			speed[robot_id][0] = (1 / DELTA_T) * (my_position[0] - prev_my_position[0]);
-			speed[robot_id][1] = (1 / DELTA_T) * (my_position[1] - prev_my_position[1]);
+			my_velocity[0] = (1 / DELTA_T) * (my_position[0] - prev_my_position[0]);
+			my_velocity[1] = (1 / DELTA_T) * (my_position[1] - prev_my_position[1]);
+			speed[robot_id][0] = my_velocity[0];
+			speed[robot_id][1] = my_velocity[1];
 
 			// Reynold's rules with all previous info (updates the speed[][] table)
 			reynolds_rules();
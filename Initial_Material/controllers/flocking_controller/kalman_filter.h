@@ -1,3 +1,6 @@
+#ifndef KALMAN_FILTER_H
+#define KALMAN_FILTER_H
+
 #include "odometry.h"
 #include <stdbool.h>
 
@@ -11,6 +14,47 @@ typedef struct
     double omega;
 } state_t;
 
-void kalman_filter_reset(int time_stamp, pose_t *pose_origin, int robot_id);
-void kalman_filter_compute_pose(pose_t *state_kalman, pose_t *gps_pose, bool gps_updated, const double Aleft_enc, const double Aright_enc);
-void kalman_filter_cleanup();
\ No newline at end of file
+// Opaque filter context, one per tracked robot
+typedef struct kalman_filter kalman_filter_t;
+
+// One step of the EKF: prediction X_pred, Cov_pred with the Jacobian F = [1, 0, f02; 0, 1, f12; 0, 0, 1],
+// then the filtered X, Cov after the gps update if any
+typedef struct
+{
+    float X_pred[3];
+    float Cov_pred[9];
+    float f02;
+    float f12;
+    float X[3];
+    float Cov[9];
+} kalman_filter_ekf_step_t;
+
+// Evolving part of a filter, saved before a step to roll back and re-apply a delayed measurement
+typedef struct
+{
+    state_t estimate_state;
+    float Cov[36];
+    float ekf_X[3];
+    float ekf_Cov[9];
+    bool steady;
+    int steps_since_gps;
+    int gps_period;
+    int converged_fixes;
+    float K_gps[2][6];
+    float Cov_gps[36];
+} kalman_filter_state_t;
+
+kalman_filter_t *kalman_filter_create();
+void kalman_filter_destroy(kalman_filter_t *kf);
+void kalman_filter_reset(kalman_filter_t *kf, int time_stamp, pose_t *pose_origin, int robot_id);
+void kalman_filter_compute_pose(kalman_filter_t *kf, pose_t *state_kalman, pose_t *gps_pose, bool gps_updated, const double Aleft_enc, const double Aright_enc);
+void kalman_filter_ekf_compute_pose(kalman_filter_t *kf, pose_t *state_kalman, pose_t *gps_pose, bool gps_updated, const double Aleft_enc, const double Aright_enc);
+void kalman_filter_ekf_record(const kalman_filter_t *kf, kalman_filter_ekf_step_t *step);
+bool kalman_filter_fuse_position(kalman_filter_t *kf, pose_t *state_kalman, const pose_t *position, const float r[3]);
+bool kalman_filter_ekf_fuse_position(kalman_filter_t *kf, pose_t *state_kalman, const pose_t *position, const float r[3]);
+void kalman_filter_get_position_cov(const kalman_filter_t *kf, float cov[3]);
+void kalman_filter_ekf_get_position_cov(const kalman_filter_t *kf, float cov[3]);
+void kalman_filter_save(const kalman_filter_t *kf, kalman_filter_state_t *state);
+void kalman_filter_restore(kalman_filter_t *kf, const kalman_filter_state_t *state);
+
+#endif
@@ -20,6 +20,7 @@
 #include "light_matrix.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <math.h>
 
 #define MAT_LEGAL_CHECKING
 
@@ -30,53 +31,95 @@
 /*                          Private Function                            */
 /************************************************************************/
 
-void swap(int *a, int *b)
+/* Scratch matrix: fixed-capacity storage when it fits, heap otherwise */
+static Mat *scratch_create(MatFixed *fixed, Mat *heap, int row, int col)
 {
-	int m;
-	m = *a;
-	*a = *b;
-	*b = m;
+	if (row <= MAT_MAX_DIM && col <= MAT_MAX_DIM)
+		return MatInitFixed(fixed, row, col);
+	return MatCreate(heap, row, col);
 }
 
-void perm(int list[], int k, int m, int *p, Mat *mat, float *det)
+static void scratch_delete(MatFixed *fixed, Mat *mat)
 {
-	int i;
+	if (mat != NULL && mat != &fixed->mat)
+		MatDelete(mat);
+}
 
-	if (k > m)
-	{
-		float res = mat->element[0][list[0]];
+/* in-place LU factorization with partial pivoting, returns the sign of the permutation or 0 if singular */
+static int lu_factor(Mat *lu, int *perm)
+{
+	int n = lu->row;
+	int i, j, k, p;
+	int sign = 1;
+	float max, temp, *rk, *ri;
+
+	for (i = 0; i < n; i++)
+		perm[i] = i;
 
-		for (i = 1; i < mat->row; i++)
+	for (k = 0; k < n; k++)
+	{
+		// pick the largest pivot in column k
+		p = k;
+		max = fabsf(lu->data[k * n + k]);
+		for (i = k + 1; i < n; i++)
 		{
-			res *= mat->element[i][list[i]];
+			temp = fabsf(lu->data[i * n + k]);
+			if (temp > max)
+			{
+				max = temp;
+				p = i;
+			}
 		}
+		if (equal(max, 0.0f))
+			return 0;
 
-		if (*p % 2)
+		if (p != k)
 		{
-			//odd is negative
-			*det -= res;
+			for (j = 0; j < n; j++)
+			{
+				temp = lu->data[k * n + j];
+				lu->data[k * n + j] = lu->data[p * n + j];
+				lu->data[p * n + j] = temp;
+			}
+			i = perm[k];
+			perm[k] = perm[p];
+			perm[p] = i;
+			sign = -sign;
 		}
-		else
+
+		rk = lu->data + k * n;
+		for (i = k + 1; i < n; i++)
 		{
-			//even is positive
-			*det += res;
+			ri = lu->data + i * n;
+			ri[k] /= rk[k];
+			for (j = k + 1; j < n; j++)
+				ri[j] -= ri[k] * rk[j];
 		}
 	}
-	else
+
+	return sign;
+}
+
+/* forward/back substitution of the column col of b into x */
+static void lu_substitute(Mat *x, const Mat *lu, const int *perm, const Mat *b, int col)
+{
+	int n = lu->row;
+	int i, j;
+	float sum;
+
+	for (i = 0; i < n; i++)
+	{
+		sum = b->data[perm[i] * b->col + col];
+		for (j = 0; j < i; j++)
+			sum -= lu->data[i * n + j] * x->data[j * x->col + col];
+		x->data[i * x->col + col] = sum;
+	}
+	for (i = n - 1; i >= 0; i--)
 	{
-		// if the element is 0, we don't need to calculate the value for this permutation
-		if (!equal(mat->element[k][list[k]], 0.0f))
-			perm(list, k + 1, m, p, mat, det);
-		for (i = k + 1; i <= m; i++)
-		{
-			if (equal(mat->element[k][list[i]], 0.0f))
-				continue;
-			swap(&list[k], &list[i]);
-			*p += 1;
-			perm(list, k + 1, m, p, mat, det);
-			swap(&list[k], &list[i]);
-			*p -= 1;
-		}
+		sum = x->data[i * x->col + col];
+		for (j = i + 1; j < n; j++)
+			sum -= lu->data[i * n + j] * x->data[j * x->col + col];
+		x->data[i * x->col + col] = sum / lu->data[i * n + i];
 	}
 }
 
@@ -87,26 +130,19 @@ void perm(int list[], int k, int m, int *p, Mat *mat, float *det)
 Mat *MatCreate(Mat *mat, int row, int col)
 {
 	int i;
+	char *block;
 
-	mat->element = (float **)malloc(row * sizeof(float *));
-	if (mat->element == NULL)
+	// row pointers and elements share a single allocation
+	block = (char *)malloc(row * sizeof(float *) + row * col * sizeof(float));
+	if (block == NULL)
 	{
 		printf("mat create fail!\n");
 		return NULL;
 	}
+	mat->element = (float **)block;
+	mat->data = (float *)(block + row * sizeof(float *));
 	for (i = 0; i < row; i++)
-	{
-		mat->element[i] = (float *)malloc(col * sizeof(float));
-		if (mat->element[i] == NULL)
-		{
-			int j;
-			printf("mat create fail!\n");
-			for (j = 0; j < i; j++)
-				free(mat->element[j]);
-			free(mat->element);
-			return NULL;
-		}
-	}
+		mat->element[i] = mat->data + i * col;
 
 	mat->row = row;
 	mat->col = col;
@@ -114,25 +150,41 @@ Mat *MatCreate(Mat *mat, int row, int col)
 	return mat;
 }
 
-void MatDelete(Mat *mat)
+Mat *MatInitFixed(MatFixed *fixed, int row, int col)
 {
 	int i;
 
-	for (i = 0; i < mat->row; i++)
-		free(mat->element[i]);
+#ifdef MAT_LEGAL_CHECKING
+	if (row > MAT_MAX_DIM || col > MAT_MAX_DIM)
+	{
+		printf("err check, %dx%d exceeds the capacity of MatFixed\n", row, col);
+		return NULL;
+	}
+#endif
+
+	fixed->mat.element = fixed->rows;
+	fixed->mat.data = fixed->data;
+	for (i = 0; i < row; i++)
+		fixed->rows[i] = fixed->data + i * col;
+
+	fixed->mat.row = row;
+	fixed->mat.col = col;
+
+	return &fixed->mat;
+}
+
+void MatDelete(Mat *mat)
+{
 	free(mat->element);
 }
 
 Mat *MatSetVal(Mat *mat, float *val)
 {
-	int row, col;
+	int i;
 
-	for (row = 0; row < mat->row; row++)
+	for (i = 0; i < mat->row * mat->col; i++)
 	{
-		for (col = 0; col < mat->col; col++)
-		{
-			mat->element[row][col] = val[col + row * mat->col];
-		}
+		mat->data[i] = val[i];
 	}
 
 	return mat;
@@ -162,14 +214,11 @@ void MatDump(const Mat *mat)
 
 Mat *MatZeros(Mat *mat)
 {
-	int row, col;
+	int i;
 
-	for (row = 0; row < mat->row; row++)
+	for (i = 0; i < mat->row * mat->col; i++)
 	{
-		for (col = 0; col < mat->col; col++)
-		{
-			mat->element[row][col] = 0.0f;
-		}
+		mat->data[i] = 0.0f;
 	}
 
 	return mat;
@@ -188,135 +237,174 @@ Mat *MatEye(Mat *mat)
 	return mat;
 }
 
-/* dst = src1 * expd */
-Mat MatExpd(const Mat *src, const double *expd)
+/* dst = src * expd, dst may be src itself */
+Mat *MatExpdInto(Mat *dst, const Mat *src, const double *expd)
 {
-	int row, col;
-	static Mat dst;
-	MatCreate(&dst, src->row, src->col);
-	for (row = 0; row < src->row; row++)
+	int i;
+#ifdef MAT_LEGAL_CHECKING
+	if (!(dst->row == src->row && dst->col == src->col))
 	{
-		for (col = 0; col < src->col; col++)
-		{
-			dst.element[row][col] = src->element[row][col] * (*expd);
-		}
+		printf("err check, unmatch matrix for MatExpdInto\n");
+		MatDump(dst);
+		MatDump(src);
+		return NULL;
+	}
+#endif
+	for (i = 0; i < src->row * src->col; i++)
+	{
+		dst->data[i] = src->data[i] * (*expd);
 	}
 	return dst;
 }
 
-/* dst = src1 + src2 */
-Mat MatAdd(const Mat *src1, const Mat *src2)
+/* dst = src1 + src2, dst may be src1 or src2 */
+Mat *MatAddInto(Mat *dst, const Mat *src1, const Mat *src2)
 {
-	int row, col;
-	static Mat dst;
+	int i;
 #ifdef MAT_LEGAL_CHECKING
-	if (!(src1->row == src2->row && src1->col == src2->col))
+	if (!(src1->row == src2->row && src1->col == src2->col && dst->row == src1->row && dst->col == src1->col))
 	{
 		printf("err check, unmatch matrix for MatAdd\n");
 		MatDump(src1);
 		MatDump(src2);
-		return dst;
+		return NULL;
 	}
 #endif
-	MatCreate(&dst, src1->row, src1->col);
-	for (row = 0; row < src1->row; row++)
+	for (i = 0; i < src1->row * src1->col; i++)
 	{
-		for (col = 0; col < src1->col; col++)
-		{
-			dst.element[row][col] = src1->element[row][col] + src2->element[row][col];
-		}
+		dst->data[i] = src1->data[i] + src2->data[i];
 	}
 
 	return dst;
 }
 
-/* dst = src1 - src2 */
-Mat MatSub(Mat *src1, Mat *src2)
+/* dst = src1 - src2, dst may be src1 or src2 */
+Mat *MatSubInto(Mat *dst, const Mat *src1, const Mat *src2)
 {
-	int row, col;
-	static Mat dst;
+	int i;
 
 #ifdef MAT_LEGAL_CHECKING
-	if (!(src1->row == src2->row && src1->col == src2->col))
+	if (!(src1->row == src2->row && src1->col == src2->col && dst->row == src1->row && dst->col == src1->col))
 	{
 		printf("err check, unmatch matrix for MatSub\n");
 		MatDump(src1);
 		MatDump(src2);
-		return dst;
+		return NULL;
 	}
 #endif
-	MatCreate(&dst, src1->row, src1->col);
+	for (i = 0; i < src1->row * src1->col; i++)
+	{
+		dst->data[i] = src1->data[i] - src2->data[i];
+	}
 
-	for (row = 0; row < src1->row; row++)
+	return dst;
+}
+
+/* dst = src1 * src2, dst must not be src1 or src2 */
+Mat *MatMulInto(Mat *dst, const Mat *src1, const Mat *src2)
+{
+	int row, col;
+	int i;
+	float temp;
+	const float *src1_row;
+
+#ifdef MAT_LEGAL_CHECKING
+	if (src1->col != src2->row || dst->row != src1->row || dst->col != src2->col)
+	{
+		printf("err check, unmatch matrix for MatMul\n");
+		MatDump(src1);
+		MatDump(src2);
+		return NULL;
+	}
+#endif
+	for (row = 0; row < dst->row; row++)
 	{
-		for (col = 0; col < src1->col; col++)
+		src1_row = src1->data + row * src1->col;
+		for (col = 0; col < dst->col; col++)
 		{
-			dst.element[row][col] = src1->element[row][col] - src2->element[row][col];
+			temp = 0.0f;
+			for (i = 0; i < src1->col; i++)
+			{
+				temp += src1_row[i] * src2->data[i * src2->col + col];
+			}
+			dst->data[row * dst->col + col] = temp;
 		}
 	}
 
 	return dst;
 }
 
-/* dst = src1 * src2 */
-Mat MatMul(const Mat *src1, const Mat *src2)
+/* dst = src1 * src2', dst must not be src1 or src2 */
+Mat *MatTransMulInto(Mat *dst, const Mat *src1, const Mat *src2)
 {
 	int row, col;
 	int i;
 	float temp;
-	static Mat dst;
+	const float *src1_row, *src2_row;
 
 #ifdef MAT_LEGAL_CHECKING
-	if (src1->col != src2->row)
+	if (src1->col != src2->col || dst->row != src1->row || dst->col != src2->row)
 	{
-		printf("err check, unmatch matrix for MatMul\n");
+		printf("err check, unmatch matrix for MatTransMul\n");
 		MatDump(src1);
 		MatDump(src2);
-		return dst;
+		return NULL;
 	}
 #endif
-	MatCreate(&dst, src1->row, src2->col);
-	for (row = 0; row < dst.row; row++)
+	// both operands are walked along their rows, no transpose is formed
+	for (row = 0; row < dst->row; row++)
 	{
-		for (col = 0; col < dst.col; col++)
+		src1_row = src1->data + row * src1->col;
+		for (col = 0; col < dst->col; col++)
 		{
+			src2_row = src2->data + col * src2->col;
 			temp = 0.0f;
 			for (i = 0; i < src1->col; i++)
 			{
-				temp += src1->element[row][i] * src2->element[i][col];
+				temp += src1_row[i] * src2_row[i];
 			}
-			dst.element[row][col] = temp;
+			dst->data[row * dst->col + col] = temp;
 		}
 	}
 
 	return dst;
 }
 
-/* dst = src' */
-Mat MatTrans(const Mat *src)
+/* dst = src', dst must not be src */
+Mat *MatTransInto(Mat *dst, const Mat *src)
 {
 	int row, col;
-	static Mat dst;
-	MatCreate(&dst, src->col, src->row);
 
-	for (row = 0; row < dst.row; row++)
+#ifdef MAT_LEGAL_CHECKING
+	if (dst->row != src->col || dst->col != src->row)
+	{
+		printf("err check, unmatch matrix for MatTrans\n");
+		MatDump(dst);
+		MatDump(src);
+		return NULL;
+	}
+#endif
+	for (row = 0; row < dst->row; row++)
 	{
-		for (col = 0; col < dst.col; col++)
+		for (col = 0; col < dst->col; col++)
 		{
-			dst.element[row][col] = src->element[col][row];
+			dst->data[row * dst->col + col] = src->data[col * src->col + row];
 		}
 	}
 
 	return dst;
 }
 
-// return det(mat)
-float MatDet(Mat *mat)
+// return det(mat), computed from the LU factorization
+float MatDet(const Mat *mat)
 {
-	float det = 0.0f;
-	int plarity = 0;
-	int *list;
-	int i;
+	MatFixed lu_fixed;
+	Mat lu_heap;
+	Mat *lu;
+	int perm_fixed[MAT_MAX_DIM];
+	int *perm = perm_fixed;
+	float det;
+	int i, sign;
 
 #ifdef MAT_LEGAL_CHECKING
 	if (mat->row != mat->col)
@@ -327,41 +415,51 @@ float MatDet(Mat *mat)
 	}
 #endif
 
-	list = (int *)malloc(sizeof(int) * mat->col);
-	if (list == NULL)
+	lu = scratch_create(&lu_fixed, &lu_heap, mat->row, mat->col);
+	if (mat->row > MAT_MAX_DIM)
+		perm = (int *)malloc(sizeof(int) * mat->row);
+	if (lu == NULL || perm == NULL)
 	{
 		printf("malloc list fail\n");
+		scratch_delete(&lu_fixed, lu);
 		return -1.0;
 	}
-	for (i = 0; i < mat->col; i++)
-		list[i] = i;
 
-	perm(list, 0, mat->row - 1, &plarity, mat, &det);
-	free(list);
+	MatCopy(mat, lu);
+	sign = lu_factor(lu, perm);
+	det = (float)sign;
+	for (i = 0; sign != 0 && i < mat->row; i++)
+		det *= lu->data[i * mat->col + i];
+
+	if (perm != perm_fixed)
+		free(perm);
+	scratch_delete(&lu_fixed, lu);
 
 	return det;
 }
 
-// dst = adj(src)
-Mat MatAdj(const Mat *src)
+// dst = adj(src), dst must not be src
+Mat *MatAdjInto(Mat *dst, const Mat *src)
 {
-	Mat smat;
+	MatFixed smat_fixed;
+	Mat smat_heap;
+	Mat *smat;
 	int row, col;
 	int i, j, r, c;
 	float det;
-	static Mat dst;
 
 #ifdef MAT_LEGAL_CHECKING
-	if (src->row != src->col)
+	if (src->row != src->col || dst->row != src->row || dst->col != src->col)
 	{
 		printf("err check, not a square matrix for MatAdj\n");
 		MatDump(src);
-		return dst;
+		return NULL;
 	}
 #endif
 
-	MatCreate(&smat, src->row - 1, src->col - 1);
-	MatCreate(&dst, src->row, src->col);
+	smat = scratch_create(&smat_fixed, &smat_heap, src->row - 1, src->col - 1);
+	if (smat == NULL)
+		return NULL;
 
 	for (row = 0; row < src->row; row++)
 	{
@@ -377,19 +475,164 @@ Mat MatAdj(const Mat *src)
 				{
 					if (j == col)
 						continue;
-					smat.element[r][c] = src->element[i][j];
+					smat->element[r][c] = src->element[i][j];
 					c++;
 				}
 				r++;
 			}
-			det = MatDet(&smat);
+			det = MatDet(smat);
 			if ((row + col) % 2)
 				det = -det;
-			dst.element[col][row] = det;
+			dst->element[col][row] = det;
+		}
+	}
+
+	scratch_delete(&smat_fixed, smat);
+
+	return dst;
+}
+
+// dst = src^(-1), computed by LU substitution of the identity. dst may be src itself
+Mat *MatInvInto(Mat *dst, const Mat *src)
+{
+	MatFixed lu_fixed;
+	Mat lu_heap;
+	Mat *lu;
+	int perm_fixed[MAT_MAX_DIM];
+	int *perm = perm_fixed;
+	Mat *res = NULL;
+
+#ifdef MAT_LEGAL_CHECKING
+	if (src->row != src->col || dst->row != src->row || dst->col != src->col)
+	{
+		printf("err check, not a square matrix for MatInv\n");
+		MatDump(src);
+		return NULL;
+	}
+#endif
+	lu = scratch_create(&lu_fixed, &lu_heap, src->row, src->col);
+	if (src->row > MAT_MAX_DIM)
+		perm = (int *)malloc(sizeof(int) * src->row);
+
+	if (lu != NULL && perm != NULL)
+	{
+		if (MatLUDecomp(lu, perm, src) == NULL)
+		{
+			printf("err, determinate is 0 for MatInv\n");
 		}
+		else
+		{
+			MatEye(dst);
+			res = MatLUSolve(dst, lu, perm, dst);
+		}
+	}
+
+	if (perm != perm_fixed)
+		free(perm);
+	scratch_delete(&lu_fixed, lu);
+
+	return res;
+}
+
+/*
+ * Allocating variants: each call returns a freshly created matrix that the
+ * caller owns and must release with MatDelete. On a dimension mismatch the
+ * returned matrix has no storage (element == NULL).
+ */
+
+/* dst = src1 * expd */
+Mat MatExpd(const Mat *src, const double *expd)
+{
+	Mat dst = {0, 0, NULL, NULL};
+	if (MatCreate(&dst, src->row, src->col) != NULL)
+		MatExpdInto(&dst, src, expd);
+	return dst;
+}
+
+/* dst = src1 + src2 */
+Mat MatAdd(const Mat *src1, const Mat *src2)
+{
+	Mat dst = {0, 0, NULL, NULL};
+#ifdef MAT_LEGAL_CHECKING
+	if (!(src1->row == src2->row && src1->col == src2->col))
+	{
+		printf("err check, unmatch matrix for MatAdd\n");
+		MatDump(src1);
+		MatDump(src2);
+		return dst;
 	}
+#endif
+	if (MatCreate(&dst, src1->row, src1->col) != NULL)
+		MatAddInto(&dst, src1, src2);
+
+	return dst;
+}
 
-	MatDelete(&smat);
+/* dst = src1 - src2 */
+Mat MatSub(const Mat *src1, const Mat *src2)
+{
+	Mat dst = {0, 0, NULL, NULL};
+
+#ifdef MAT_LEGAL_CHECKING
+	if (!(src1->row == src2->row && src1->col == src2->col))
+	{
+		printf("err check, unmatch matrix for MatSub\n");
+		MatDump(src1);
+		MatDump(src2);
+		return dst;
+	}
+#endif
+	if (MatCreate(&dst, src1->row, src1->col) != NULL)
+		MatSubInto(&dst, src1, src2);
+
+	return dst;
+}
+
+/* dst = src1 * src2 */
+Mat MatMul(const Mat *src1, const Mat *src2)
+{
+	Mat dst = {0, 0, NULL, NULL};
+
+#ifdef MAT_LEGAL_CHECKING
+	if (src1->col != src2->row)
+	{
+		printf("err check, unmatch matrix for MatMul\n");
+		MatDump(src1);
+		MatDump(src2);
+		return dst;
+	}
+#endif
+	if (MatCreate(&dst, src1->row, src2->col) != NULL)
+		MatMulInto(&dst, src1, src2);
+
+	return dst;
+}
+
+/* dst = src' */
+Mat MatTrans(const Mat *src)
+{
+	Mat dst = {0, 0, NULL, NULL};
+	if (MatCreate(&dst, src->col, src->row) != NULL)
+		MatTransInto(&dst, src);
+
+	return dst;
+}
+
+// dst = adj(src)
+Mat MatAdj(const Mat *src)
+{
+	Mat dst = {0, 0, NULL, NULL};
+
+#ifdef MAT_LEGAL_CHECKING
+	if (src->row != src->col)
+	{
+		printf("err check, not a square matrix for MatAdj\n");
+		MatDump(src);
+		return dst;
+	}
+#endif
+	if (MatCreate(&dst, src->row, src->col) != NULL)
+		MatAdjInto(&dst, src);
 
 	return dst;
 }
@@ -397,10 +640,7 @@ Mat MatAdj(const Mat *src)
 // dst = src^(-1)
 Mat MatInv(const Mat *src)
 {
-	Mat adj_mat;
-	float det;
-	int row, col;
-	static Mat dst;
+	Mat dst = {0, 0, NULL, NULL};
 #ifdef MAT_LEGAL_CHECKING
 	if (src->row != src->col)
 	{
@@ -409,31 +649,206 @@ Mat MatInv(const Mat *src)
 		return dst;
 	}
 #endif
-	MatCreate(&dst, src->row, src->col);
-	MatCreate(&adj_mat, src->row, src->col);
-	adj_mat = MatAdj(src);
-	det = MatDet(src);
+	if (MatCreate(&dst, src->row, src->col) != NULL)
+		MatInvInto(&dst, src);
 
-	if (equal(det, 0.0f))
+	return dst;
+}
+
+/*
+ * LU factorization with partial pivoting: P * src = L * U.
+ * lu receives L (unit diagonal, below) and U (on and above the diagonal),
+ * perm the row permutation (src->row entries). lu may be src itself.
+ * Returns NULL if src is singular.
+ */
+Mat *MatLUDecomp(Mat *lu, int *perm, const Mat *src)
+{
+#ifdef MAT_LEGAL_CHECKING
+	if (src->row != src->col || lu->row != src->row || lu->col != src->col)
 	{
-		printf("err, determinate is 0 for MatInv\n");
-		return dst;
+		printf("err check, unmatch matrix for MatLUDecomp\n");
+		MatDump(src);
+		MatDump(lu);
+		return NULL;
 	}
+#endif
+	if (lu != src)
+		MatCopy(src, lu);
 
-	for (row = 0; row < src->row; row++)
+	if (lu_factor(lu, perm) == 0)
+		return NULL;
+
+	return lu;
+}
+
+/* x = A^(-1) * b from the factors of MatLUDecomp. x may be b itself */
+Mat *MatLUSolve(Mat *x, const Mat *lu, const int *perm, const Mat *b)
+{
+	MatFixed tmp_fixed;
+	Mat tmp_heap;
+	Mat *tmp;
+	int col;
+
+#ifdef MAT_LEGAL_CHECKING
+	if (lu->row != b->row || x->row != b->row || x->col != b->col)
 	{
-		for (col = 0; col < src->col; col++)
-			dst.element[row][col] = adj_mat.element[row][col] / det;
+		printf("err check, unmatch matrix for MatLUSolve\n");
+		MatDump(lu);
+		MatDump(b);
+		return NULL;
+	}
+#endif
+	// the permutation reads b out of order, so solve into a scratch when x aliases b
+	tmp = x;
+	if (x == b)
+	{
+		tmp = scratch_create(&tmp_fixed, &tmp_heap, b->row, b->col);
+		if (tmp == NULL)
+			return NULL;
 	}
 
-	MatDelete(&adj_mat);
+	for (col = 0; col < b->col; col++)
+		lu_substitute(tmp, lu, perm, b, col);
 
-	return dst;
+	if (tmp != x)
+	{
+		MatCopy(tmp, x);
+		scratch_delete(&tmp_fixed, tmp);
+	}
+
+	return x;
 }
 
-void MatCopy(Mat *src, Mat *dst)
+/*
+ * Cholesky factorization of a symmetric positive definite matrix: src = L * L'.
+ * Only the lower triangle of src is read. l may be src itself.
+ * Returns NULL if src is not positive definite.
+ */
+Mat *MatCholesky(Mat *l, const Mat *src)
 {
-	int row, col;
+	int n = src->row;
+	int i, j, k;
+	float sum;
+
+#ifdef MAT_LEGAL_CHECKING
+	if (src->row != src->col || l->row != src->row || l->col != src->col)
+	{
+		printf("err check, unmatch matrix for MatCholesky\n");
+		MatDump(src);
+		MatDump(l);
+		return NULL;
+	}
+#endif
+
+	for (j = 0; j < n; j++)
+	{
+		sum = src->data[j * n + j];
+		for (k = 0; k < j; k++)
+			sum -= l->data[j * n + k] * l->data[j * n + k];
+		if (sum <= 0.0f)
+		{
+			printf("err, matrix is not positive definite for MatCholesky\n");
+			return NULL;
+		}
+		l->data[j * n + j] = sqrtf(sum);
+
+		for (i = j + 1; i < n; i++)
+		{
+			sum = src->data[i * n + j];
+			for (k = 0; k < j; k++)
+				sum -= l->data[i * n + k] * l->data[j * n + k];
+			l->data[i * n + j] = sum / l->data[j * n + j];
+		}
+		// clear the upper triangle so that l holds exactly L
+		for (i = 0; i < j; i++)
+			l->data[i * n + j] = 0.0f;
+	}
+
+	return l;
+}
+
+/* x = A^(-1) * b from the factor of MatCholesky. x may be b itself */
+Mat *MatCholSolve(Mat *x, const Mat *l, const Mat *b)
+{
+	int n = l->row;
+	int i, j, col;
+	float sum;
+
+#ifdef MAT_LEGAL_CHECKING
+	if (l->row != b->row || x->row != b->row || x->col != b->col)
+	{
+		printf("err check, unmatch matrix for MatCholSolve\n");
+		MatDump(l);
+		MatDump(b);
+		return NULL;
+	}
+#endif
+
+	for (col = 0; col < b->col; col++)
+	{
+		// L * y = b
+		for (i = 0; i < n; i++)
+		{
+			sum = b->data[i * b->col + col];
+			for (j = 0; j < i; j++)
+				sum -= l->data[i * n + j] * x->data[j * x->col + col];
+			x->data[i * x->col + col] = sum / l->data[i * n + i];
+		}
+		// L' * x = y
+		for (i = n - 1; i >= 0; i--)
+		{
+			sum = x->data[i * x->col + col];
+			for (j = i + 1; j < n; j++)
+				sum -= l->data[j * n + i] * x->data[j * x->col + col];
+			x->data[i * x->col + col] = sum / l->data[i * n + i];
+		}
+	}
+
+	return x;
+}
+
+/* x = a^(-1) * b without forming the inverse. x may be b itself */
+Mat *MatSolve(Mat *x, const Mat *a, const Mat *b)
+{
+	MatFixed lu_fixed;
+	Mat lu_heap;
+	Mat *lu;
+	int perm_fixed[MAT_MAX_DIM];
+	int *perm = perm_fixed;
+	Mat *res = NULL;
+
+#ifdef MAT_LEGAL_CHECKING
+	if (a->row != a->col || a->row != b->row || x->row != b->row || x->col != b->col)
+	{
+		printf("err check, unmatch matrix for MatSolve\n");
+		MatDump(a);
+		MatDump(b);
+		return NULL;
+	}
+#endif
+
+	lu = scratch_create(&lu_fixed, &lu_heap, a->row, a->col);
+	if (a->row > MAT_MAX_DIM)
+		perm = (int *)malloc(sizeof(int) * a->row);
+
+	if (lu != NULL && perm != NULL)
+	{
+		if (MatLUDecomp(lu, perm, a) != NULL)
+			res = MatLUSolve(x, lu, perm, b);
+		else
+			printf("err, determinate is 0 for MatSolve\n");
+	}
+
+	if (perm != perm_fixed)
+		free(perm);
+	scratch_delete(&lu_fixed, lu);
+
+	return res;
+}
+
+void MatCopy(const Mat *src, Mat *dst)
+{
+	int i;
 
 #ifdef MAT_LEGAL_CHECKING
 	if (src->row != dst->row || src->col != dst->col)
@@ -445,9 +860,6 @@ void MatCopy(Mat *src, Mat *dst)
 	}
 #endif
 
-	for (row = 0; row < src->row; row++)
-	{
-		for (col = 0; col < src->col; col++)
-			dst->element[row][col] = src->element[row][col];
-	}
+	for (i = 0; i < src->row * src->col; i++)
+		dst->data[i] = src->data[i];
 }
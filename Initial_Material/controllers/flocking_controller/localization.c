@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <string.h>
+#include <math.h>
 
 #include <webots/robot.h>
 #include <webots/motor.h>
@@ -8,6 +9,7 @@
 #include <webots/position_sensor.h>
 
 #include "localization.h"
+#include "params.h"
 #include <webots/emitter.h>
 
 /* FLAGS_ENABLE_DIFFERENT LOCALIZATION_METHOD*/
@@ -17,8 +19,20 @@
 #define USE_KALMAN_FILTER false
 //----------------------------------------------------------
 /*DEFINITION*/
-#define TIME_INIT_ACC 5 // Time in second
-#define FLOCK_SIZE 5
+#define ACC_CALIBRATION true                     // Start from the accelerometer bias of the last run, save it once estimated
+#define ACC_CALIBRATION_FILE "acc_calibration_%s.txt" // Per robot name
+#define ODO_CALIBRATION_FILE "odo_calibration_%s.txt" // Wheel radii and axle length from tools/odo_calibration, per robot name
+#define GPS_LATENCY 0.0     // Age of a gps fix when it is read, in second
+#define LOC_HISTORY_SIZE 32 // Steps kept to re-apply delayed measurements (2 s at 64 ms)
+#define LOC_NEIGHBOUR_FIXES 16 // Neighbour fixes kept per step, the later ones of the step are dropped
+#define COOP_RANGE_NOISE 0.0004 // Variance of the range measured from a ping (m^2)
+#define COOP_BEARING_NOISE 0.01 // Variance of the bearing measured from a ping (rad^2)
+#define PF_PARTICLE_COUNT 2000  // Particles of the Monte Carlo localization (method 5)
+#define LOC_METHOD_COUNT 6
+// Devices read by the localization methods, see localization_schedule_devices
+#define DEVICE_GPS (1 << 0)
+#define DEVICE_ACC (1 << 1)
+#define DEVICE_ENCODERS (1 << 2)
 //-----------------------------------------------------------
 /* VARIABLES */
 WbDeviceTag dev_gps;
@@ -28,18 +42,62 @@ WbDeviceTag dev_right_encoder;
 
 static measurement_t _meas;
 // We have the following formulation of pose variable:  X= [pos_x, pos_y, heading]^T;
-static pose_t _estimated_pose, _gps_pose, _odo_acc_encoder, _odo_enc, _kalman_pose;
+static pose_t _estimated_pose, _gps_pose, _odo_acc_encoder, _odo_enc, _kalman_pose, _ekf_pose, _pf_pose;
 // We have the following formulation of state variable:  X= [pos_x, pos_y, vel_x, vel_y]^T;
 static pose_t _pose_origin = {-2.9, 0.0, 0.0};
+// Per-robot estimator contexts
+static odometry_t *_odometry;
+static kalman_filter_t *_kalman;
+static particle_filter_t *_particle_filter; // Created by the first method 5 step, its likelihood field takes 1 MB
 double last_gps_time = 0.0f;
 int time_step;
+static acc_bias_t _acc_bias;
+static bool _acc_bias_loaded;
 char *robot_name;
-int robot_id_u, robot_id; // Unique and normalized (between 0 and FLOCK_SIZE-1) robot ID
-static bool gps_updated;
+int robot_id_u, robot_id; // Unique and normalized (between 0 and params.flock_size-1) robot ID
+
+// Timestamped measurements between the sensor readers and the estimators
+static meas_queue_t _queue;
+
+// One estimator step, with the filter state before it, so a late gps fix can be fused at its time
+typedef struct
+{
+  double time;
+  double Aleft_enc;
+  double Aright_enc;
+  bool gps_updated;
+  pose_t gps_pose;
+  int neighbour_count; // Own positions measured from neighbours after the step
+  pose_t neighbour_position[LOC_NEIGHBOUR_FIXES];
+  float neighbour_cov[LOC_NEIGHBOUR_FIXES][3];
+  kalman_filter_state_t before;
+} loc_step_t;
+
+static loc_step_t _history[LOC_HISTORY_SIZE];
+static int _history_head, _history_count;
+static bool _pending_gps; // A fix newer than the last step, fused by the next one
+static pose_t _pending_gps_pose;
+static int _localization_method = -1; // Method of the last estimate_self_position
+
+// Devices of each method, the proximity sensors of method 5 are sampled by the controller
+static const int _method_devices[LOC_METHOD_COUNT] = {
+  DEVICE_GPS,                   // 0: gps only
+  DEVICE_ACC | DEVICE_ENCODERS, // 1: acc + encoder (for heading) odometry
+  DEVICE_ENCODERS,              // 2: encoder odometry
+  DEVICE_GPS | DEVICE_ENCODERS, // 3: kalman filter
+  DEVICE_GPS | DEVICE_ENCODERS, // 4: extended kalman filter
+  DEVICE_GPS | DEVICE_ENCODERS, // 5: particle filter
+};
+static int _scheduled_methods; // Bit m is set when the devices of method m are enabled
+static int _enabled_devices;
+static bool _encoders_stale; // Enabled during the run, the first reading only sets the previous values
 
 //-----------------------------------------------------------
-void localization_init(int time_step)
+void localization_init(int ts)
 {
+  char file_name[64];
+
+  time_step = ts;
   init_localization_devices(time_step);
 
   memset(&_meas, 0, sizeof(measurement_t));
@@ -52,50 +110,105 @@ void localization_init(int time_step)
 
   memset(&_odo_acc_encoder, 0, sizeof(pose_t));
 
-  odo_reset(time_step, &_pose_origin);
+  meas_queue_reset(&_queue);
+  _history_head = 0;
+  _history_count = 0;
+  _pending_gps = false;
 
-  kalman_filter_reset(time_step, &_pose_origin, robot_id);
+  if (_odometry == NULL)
+    _odometry = odo_create();
+  snprintf(file_name, sizeof(file_name), ODO_CALIBRATION_FILE, robot_name);
+  odo_load_calibration(_odometry, file_name);
+  odo_reset(_odometry, time_step, &_pose_origin);
+
+  if (_kalman == NULL)
+    _kalman = kalman_filter_create();
+  kalman_filter_reset(_kalman, time_step, &_pose_origin, robot_id);
+
+  acc_bias_reset(&_acc_bias, time_step);
+  _acc_bias_loaded = false;
+  if (ACC_CALIBRATION)
+  {
+    snprintf(file_name, sizeof(file_name), ACC_CALIBRATION_FILE, robot_name);
+    _acc_bias_loaded = acc_bias_load(&_acc_bias, file_name);
+    memcpy(_meas.acc_mean, _acc_bias.mean, sizeof(_meas.acc_mean));
+  }
+
+  if (_particle_filter != NULL)
+    particle_filter_reset(_particle_filter, &_pose_origin);
 }
 void init_localization_devices(int ts)
 {
+  // The devices are enabled by localization_schedule_devices, for the methods in use only
   dev_gps = wb_robot_get_device("gps");
-  wb_gps_enable(dev_gps, 1000);
-
   dev_acc = wb_robot_get_device("accelerometer");
-  wb_accelerometer_enable(dev_acc, ts);
-
   dev_left_encoder = wb_robot_get_device("left wheel sensor");
   dev_right_encoder = wb_robot_get_device("right wheel sensor");
-  wb_position_sensor_enable(dev_left_encoder, ts);
-  wb_position_sensor_enable(dev_right_encoder, ts);
 
   robot_name = (char *)wb_robot_get_name();
   sscanf(robot_name, "epuck%d", &robot_id_u); // read robot id from the robot's name
-  robot_id = robot_id_u % FLOCK_SIZE;         // normalize between 0 and FLOCK_SIZE-1
-  gps_updated = false;
-  if (FLOCK_SIZE == 5)
+  robot_id = robot_id_u % params.flock_size;  // normalize between 0 and params.flock_size-1
+  // covert y axis, set y equal to -y of what get from webot world
+  _pose_origin.x = params.origin_x;
+  _pose_origin.y = params.origin_y[robot_id];
+  //printf("robot_id is %d pose_origin is: %f, %f, %f\n", robot_id, _pose_origin.x, _pose_origin.y, _pose_origin.heading);
+}
+
+/**
+ * @brief      Enable the devices read by the given localization methods and disable the others
+ *
+ *             The gps is sampled every params.gps_period, the accelerometer and the encoders every time
+ *             step. The readers of a disabled device do nothing, so the controller can call all of
+ *             them every step. estimate_self_position schedules the devices of a method on its
+ *             first call, declaring the methods after localization_init also gets the first step.
+ *
+ * @param[in]  method_mask  Bit m is set to run method m
+ */
+void localization_schedule_devices(int method_mask)
+{
+  int devices = 0;
+  int changed;
+  int m;
+
+  for (m = 0; m < LOC_METHOD_COUNT; m++)
+  {
+    if (method_mask & (1 << m))
+      devices |= _method_devices[m];
+  }
+  changed = devices ^ _enabled_devices;
+
+  if (changed & DEVICE_GPS)
   {
-    // covert y axis, set y equal to -y of what get from webot world
-    switch (robot_id)
+    if (devices & DEVICE_GPS)
+      wb_gps_enable(dev_gps, (int)(params.gps_period * 1000));
+    else
+      wb_gps_disable(dev_gps);
+  }
+  if (changed & DEVICE_ACC)
+  {
+    if (devices & DEVICE_ACC)
+      wb_accelerometer_enable(dev_acc, time_step);
+    else
+      wb_accelerometer_disable(dev_acc);
+  }
+  if (changed & DEVICE_ENCODERS)
+  {
+    if (devices & DEVICE_ENCODERS)
     {
-    case 0:
-      _pose_origin.y = 0.0;
-      break;
-    case 1:
-      _pose_origin.y = -0.1;
-      break;
-    case 2:
-      _pose_origin.y = 0.1;
-      break;
-    case 3:
-      _pose_origin.y = -0.2;
-      break;
-    case 4:
-      _pose_origin.y = 0.2;
-      break;
+      wb_position_sensor_enable(dev_left_encoder, time_step);
+      wb_position_sensor_enable(dev_right_encoder, time_step);
+      // The wheels may have turned since the last reading
+      _encoders_stale = wb_robot_get_time() > 0.0;
+    }
+    else
+    {
+      wb_position_sensor_disable(dev_left_encoder);
+      wb_position_sensor_disable(dev_right_encoder);
     }
   }
-  //printf("robot_id is %d pose_origin is: %f, %f, %f\n", robot_id, _pose_origin.x, _pose_origin.y, _pose_origin.heading);
+
+  _scheduled_methods = method_mask;
+  _enabled_devices = devices;
 }
 
 void controller_get_gps()
@@ -112,6 +225,9 @@ void controller_get_gps()
 
 void controller_get_encoder()
 {
+  if (!(_enabled_devices & DEVICE_ENCODERS))
+    return;
+
   // Store previous value of the left encoder
   _meas.prev_left_enc = _meas.left_enc;
 
@@ -122,11 +238,36 @@ void controller_get_encoder()
 
   _meas.right_enc = wb_position_sensor_get_value(dev_right_encoder);
 
+  if (_encoders_stale)
+  {
+    _meas.prev_left_enc = _meas.left_enc;
+    _meas.prev_right_enc = _meas.right_enc;
+    _encoders_stale = false;
+    return;
+  }
+
+  meas_t meas = {wb_robot_get_time(), MEAS_ENCODER, {_meas.left_enc - _meas.prev_left_enc, _meas.right_enc - _meas.prev_right_enc, 0.0}};
+  meas_queue_push(&_queue, &meas);
+
   //printf("ROBOT enc : %g %g\n", _meas.left_enc, _meas.right_enc);
 }
 
+/**
+ * @brief      Store the proximity sensor values read by the controller, used by the next step of method 5
+ *
+ * @param[in]  distances  The raw values of ps0 to ps7
+ */
+void controller_set_proximity(const int *distances)
+{
+  memcpy(_meas.proximity, distances, sizeof(_meas.proximity));
+  _meas.proximity_updated = true;
+}
+
 void controller_get_acc()
 {
+  if (!(_enabled_devices & DEVICE_ACC))
+    return;
+
   const double *acc_values = wb_accelerometer_get_values(dev_acc);
 
   memcpy(_meas.acc, acc_values, sizeof(_meas.acc));
@@ -138,7 +279,9 @@ void controller_get_pose()
 {
   // Call the function to get the gps measurements
   double time_now_s = wb_robot_get_time();
-  if (time_now_s - last_gps_time > 1.0f)
+  if (!(_enabled_devices & DEVICE_GPS))
+    return;
+  if (time_now_s - last_gps_time > params.gps_period)
   {
     last_gps_time = time_now_s;
     controller_get_gps();
@@ -150,14 +293,11 @@ void controller_get_pose()
 
     _gps_pose.heading = controller_get_heading() + _pose_origin.heading;
 
-    gps_updated = true;
+    meas_t meas = {time_now_s - GPS_LATENCY, MEAS_GPS, {_gps_pose.x, _gps_pose.y, _gps_pose.heading}};
+    meas_queue_push(&_queue, &meas);
 
     //printf("ROBOT pose : %g %g %g\n", _gps_pose.x, _gps_pose.y, RAD2DEG(_gps_pose.heading));
   }
-  else
-  {
-    gps_updated = false;
-  }
 }
 
 double controller_get_heading()
@@ -173,29 +313,175 @@ double controller_get_heading()
 
   return heading;
 }
+/**
+ * @brief      Refine the accelerometer bias with the measurements of this step
+ *
+ *             Call after controller_get_acc and controller_get_encoder. The bias is estimated
+ *             online whenever the encoders show no acceleration, the robot does not need to
+ *             wait still at startup.
+ */
 void controller_compute_mean_acc()
 {
-  static int count = 0;
+  char file_name[64];
+  bool was_ready = acc_bias_ready(&_acc_bias);
+  odo_calibration_t calibration;
 
-  count++;
+  if (!(_enabled_devices & DEVICE_ACC))
+    return;
 
-  if (count > 20) // Remove the effects of strong acceleration at the begining
-  {
-    for (int i = 0; i < 3; i++)
-      _meas.acc_mean[i] = (_meas.acc_mean[i] * (count - 21) + _meas.acc[i]) / (double)(count - 20);
-  }
+  // The encoder accelerations with the constants the odometry uses, calibrated or not
+  odo_get_calibration(_odometry, &calibration);
+  acc_bias_update(&_acc_bias, _meas.acc, _meas.left_enc - _meas.prev_left_enc, _meas.right_enc - _meas.prev_right_enc, &calibration);
+  memcpy(_meas.acc_mean, _acc_bias.mean, sizeof(_meas.acc_mean));
 
-  if (count == (int)(TIME_INIT_ACC / (double)time_step * 1000))
+  if (!was_ready && acc_bias_ready(&_acc_bias))
   {
     printf("Accelerometer initialization Done ! \n");
     printf("acc_mean is: [0]%f, [1]%f \n", _meas.acc_mean[0], _meas.acc_mean[1]);
+    if (ACC_CALIBRATION && !_acc_bias_loaded)
+    {
+      snprintf(file_name, sizeof(file_name), ACC_CALIBRATION_FILE, robot_name);
+      acc_bias_save(&_acc_bias, file_name);
+    }
   }
 
   //printf("ROBOT acc mean : %g %g %g\n", _meas.acc_mean[0], _meas.acc_mean[1], _meas.acc_mean[2]);
 }
 
+/**
+ * @brief      Run one estimator step of the given method
+ *
+ * @param      step                 The step, its filter state before the step is saved
+ * @param[in]  localization_method  The localization method
+ */
+static void localization_step(loc_step_t *step, int localization_method)
+{
+  if (localization_method == 1)
+    odo_compute_acc_encoders(_odometry, &_odo_acc_encoder, _meas.acc, _meas.acc_mean, step->Aleft_enc, step->Aright_enc);
+  if (localization_method == 2)
+    odo_compute_encoders(_odometry, &_odo_enc, step->Aleft_enc, step->Aright_enc);
+  if (localization_method == 3)
+  {
+    kalman_filter_save(_kalman, &step->before);
+    kalman_filter_compute_pose(_kalman, &_kalman_pose, &step->gps_pose, step->gps_updated, step->Aleft_enc, step->Aright_enc);
+  }
+  if (localization_method == 4)
+  {
+    kalman_filter_save(_kalman, &step->before);
+    kalman_filter_ekf_compute_pose(_kalman, &_ekf_pose, &step->gps_pose, step->gps_updated, step->Aleft_enc, step->Aright_enc);
+  }
+  if (localization_method == 5)
+  {
+    if (_particle_filter == NULL)
+    {
+      _particle_filter = particle_filter_create(PF_PARTICLE_COUNT);
+      if (_particle_filter == NULL)
+        return;
+      particle_filter_reset(_particle_filter, &_pose_origin);
+    }
+    particle_filter_compute_pose(_particle_filter, &_pf_pose, &step->gps_pose, step->gps_updated, _meas.proximity_updated ? _meas.proximity : NULL, step->Aleft_enc, step->Aright_enc);
+    _meas.proximity_updated = false;
+  }
+  for (int i = 0; i < step->neighbour_count; i++)
+  {
+    if (localization_method == 3)
+      kalman_filter_fuse_position(_kalman, &_kalman_pose, &step->neighbour_position[i], step->neighbour_cov[i]);
+    if (localization_method == 4)
+      kalman_filter_ekf_fuse_position(_kalman, &_ekf_pose, &step->neighbour_position[i], step->neighbour_cov[i]);
+  }
+}
+
+/**
+ * @brief      Fuse a gps fix taken before the last step
+ *
+ *             The fix belongs to the oldest step taken at or after its time. The filter is
+ *             rolled back to the state before that step and the steps are run again.
+ *
+ * @param[in]  meas                 The gps measurement
+ * @param[in]  localization_method  The localization method
+ */
+static void localization_fuse_delayed_gps(const meas_t *meas, int localization_method)
+{
+  int k, i;
+
+  for (k = 0; k < _history_count; k++)
+  {
+    if (_history[(_history_head + k) % LOC_HISTORY_SIZE].time >= meas->time)
+      break;
+  }
+  if (k == 0 && _history_count == LOC_HISTORY_SIZE)
+  {
+    printf("gps fix older than the localization history, dropped!\n");
+    return;
+  }
+
+  loc_step_t *step = &_history[(_history_head + k) % LOC_HISTORY_SIZE];
+  step->gps_updated = true;
+  step->gps_pose.x = meas->value[0];
+  step->gps_pose.y = meas->value[1];
+  step->gps_pose.heading = meas->value[2];
+
+  // The particles are not saved with each step, the late fix weights the current ones
+  if (localization_method == 5)
+  {
+    if (_particle_filter != NULL)
+      particle_filter_fuse_gps(_particle_filter, &_pf_pose, &step->gps_pose);
+    return;
+  }
+
+  // Only the Kalman filters use the gps, the odometry does not need to be replayed
+  if (localization_method != 3 && localization_method != 4)
+    return;
+  kalman_filter_restore(_kalman, &step->before);
+  for (i = k; i < _history_count; i++)
+    localization_step(&_history[(_history_head + i) % LOC_HISTORY_SIZE], localization_method);
+}
+
 void estimate_self_position(float *estimate_pose, int localization_method)
 {
+  meas_t meas;
+  loc_step_t *step;
+
+  _localization_method = localization_method;
+  if (!(_scheduled_methods & (1 << localization_method)))
+    localization_schedule_devices(_scheduled_methods | (1 << localization_method));
+  // Consume the measurements in time order, each encoder reading is one estimator step
+  while (meas_queue_pop(&_queue, wb_robot_get_time(), &meas))
+  {
+    if (meas.type == MEAS_GPS)
+    {
+      if (_history_count > 0 && meas.time <= _history[(_history_head + _history_count - 1) % LOC_HISTORY_SIZE].time)
+      {
+        localization_fuse_delayed_gps(&meas, localization_method);
+      }
+      else
+      {
+        _pending_gps = true;
+        _pending_gps_pose.x = meas.value[0];
+        _pending_gps_pose.y = meas.value[1];
+        _pending_gps_pose.heading = meas.value[2];
+      }
+    }
+    if (meas.type == MEAS_ENCODER)
+    {
+      if (_history_count == LOC_HISTORY_SIZE)
+      {
+        _history_head = (_history_head + 1) % LOC_HISTORY_SIZE;
+        _history_count--;
+      }
+      step = &_history[(_history_head + _history_count) % LOC_HISTORY_SIZE];
+      _history_count++;
+      step->time = meas.time;
+      step->Aleft_enc = meas.value[0];
+      step->Aright_enc = meas.value[1];
+      step->gps_updated = _pending_gps;
+      step->gps_pose = _pending_gps_pose;
+      step->neighbour_count = 0;
+      _pending_gps = false;
+      localization_step(step, localization_method);
+    }
+  }
+
   if (localization_method == 0)
   {
     estimate_pose[0] = _gps_pose.x;
@@ -204,25 +490,117 @@ void estimate_self_position(float *estimate_pose, int localization_method)
   }
   if (localization_method == 1)
   {
-    odo_compute_acc_encoders(&_odo_acc_encoder, _meas.acc, _meas.acc_mean, _meas.left_enc - _meas.prev_left_enc, _meas.right_enc - _meas.prev_right_enc);
     estimate_pose[0] = _odo_acc_encoder.x;
     estimate_pose[1] = _odo_acc_encoder.y;
     estimate_pose[2] = _odo_acc_encoder.heading;
   }
   if (localization_method == 2)
   {
-    odo_compute_encoders(&_odo_enc, _meas.left_enc - _meas.prev_left_enc, _meas.right_enc - _meas.prev_right_enc);
     estimate_pose[0] = _odo_enc.x;
     estimate_pose[1] = _odo_enc.y;
     estimate_pose[2] = _odo_enc.heading;
   }
   if (localization_method == 3)
   {
-    kalman_filter_compute_pose(&_kalman_pose, &_gps_pose, gps_updated, _meas.left_enc - _meas.prev_left_enc, _meas.right_enc - _meas.prev_right_enc);
     estimate_pose[0] = _kalman_pose.x;
     estimate_pose[1] = _kalman_pose.y;
     estimate_pose[2] = _kalman_pose.heading;
   }
+  if (localization_method == 4)
+  {
+    estimate_pose[0] = _ekf_pose.x;
+    estimate_pose[1] = _ekf_pose.y;
+    estimate_pose[2] = _ekf_pose.heading;
+  }
+  if (localization_method == 5)
+  {
+    estimate_pose[0] = _pf_pose.x;
+    estimate_pose[1] = _pf_pose.y;
+    estimate_pose[2] = _pf_pose.heading;
+  }
+}
+
+/**
+ * @brief      Fuse the range and bearing to a neighbour as a measurement of the own position
+ *
+ *             Cooperative localization: the neighbour broadcasts its estimated position and
+ *             covariance, so own position = neighbour position - relative position. The
+ *             measurement covariance is the neighbour covariance plus the range noise along
+ *             the line of sight and the bearing noise across it. The measurement is taken
+ *             after the last estimator step and is re-applied if that step is replayed.
+ *             Only the Kalman filters (methods 3 and 4) use it, at most LOC_NEIGHBOUR_FIXES
+ *             fixes per step.
+ *
+ *             The fix is fused as independent of the own estimate, which it is not once the
+ *             robots have exchanged fixes: the neighbour estimate already holds part of ours.
+ *             The same information then counts again at every exchange and the covariance
+ *             shrinks faster than the error, so the filter grows overconfident and the gate
+ *             ends up rejecting good fixes. Hence params.cooperative_localization is off by
+ *             default; a correct fusion would need covariance intersection or cross-covariance
+ *             tracking.
+ *
+ * @param[in]  neighbour_position  The position estimated by the neighbour {x, y}
+ * @param[in]  neighbour_cov       The covariance of that position {xx, xy, yy}
+ * @param[in]  relative_position   The position of the neighbour relative to this robot {x, y}
+ */
+void localization_fuse_neighbour(const float neighbour_position[2], const float neighbour_cov[3], const float relative_position[2])
+{
+  loc_step_t *step;
+  float range, c, s, tangential;
+  int n;
+
+  if ((_localization_method != 3 && _localization_method != 4) || _history_count == 0)
+    return;
+  step = &_history[(_history_head + _history_count - 1) % LOC_HISTORY_SIZE];
+  if (step->neighbour_count == LOC_NEIGHBOUR_FIXES)
+    return;
+
+  range = sqrtf(relative_position[0] * relative_position[0] + relative_position[1] * relative_position[1]);
+  if (range <= 0.0f)
+    return;
+  c = relative_position[0] / range;
+  s = relative_position[1] / range;
+  tangential = range * range * COOP_BEARING_NOISE;
+
+  n = step->neighbour_count++;
+  step->neighbour_position[n].x = neighbour_position[0] - relative_position[0];
+  step->neighbour_position[n].y = neighbour_position[1] - relative_position[1];
+  step->neighbour_position[n].heading = 0.0;
+  step->neighbour_cov[n][0] = neighbour_cov[0] + c * c * COOP_RANGE_NOISE + s * s * tangential;
+  step->neighbour_cov[n][1] = neighbour_cov[1] + c * s * (COOP_RANGE_NOISE - tangential);
+  step->neighbour_cov[n][2] = neighbour_cov[2] + s * s * COOP_RANGE_NOISE + c * c * tangential;
+
+  if (_localization_method == 3)
+    kalman_filter_fuse_position(_kalman, &_kalman_pose, &step->neighbour_position[n], step->neighbour_cov[n]);
+  if (_localization_method == 4)
+    kalman_filter_ekf_fuse_position(_kalman, &_ekf_pose, &step->neighbour_position[n], step->neighbour_cov[n]);
+}
+
+/**
+ * @brief      Covariance of the position estimated by the encoder odometry or the Kalman filters
+ *
+ * @param      cov   The covariance {xx, xy, yy}
+ *
+ * @return     false if the last method has no covariance (methods 0, 1 and 5)
+ */
+bool localization_get_position_cov(float cov[3])
+{
+  double odo_cov[3][3];
+
+  if (_localization_method == 2)
+  {
+    odo_get_covariance(_odometry, odo_cov);
+    cov[0] = odo_cov[0][0];
+    cov[1] = odo_cov[0][1];
+    cov[2] = odo_cov[1][1];
+  }
+  else if (_localization_method == 3)
+    kalman_filter_get_position_cov(_kalman, cov);
+  else if (_localization_method == 4)
+    kalman_filter_ekf_get_position_cov(_kalman, cov);
+  else
+    return false;
+  return true;
 }
 
 //----------------------------------------------------------
@@ -260,17 +638,17 @@ void estimate_self_position(float *estimate_pose, int localization_method)
 //       }
 //       if (USE_ACCELEROMETER_ENCODER)
 //       {
-//         odo_compute_acc_encoders(&_odo_acc_encoder, _meas.acc, _meas.acc_mean, _meas.left_enc - _meas.prev_left_enc, _meas.right_enc - _meas.prev_right_enc);
+//         odo_compute_acc_encoders(_odometry, &_odo_acc_encoder, _meas.acc, _meas.acc_mean, _meas.left_enc - _meas.prev_left_enc, _meas.right_enc - _meas.prev_right_enc);
 //         memcpy(&_estimated_pose, &_odo_acc_encoder, sizeof(pose_t));
 //       }
 //       if (USE_ENCODER_ONLY)
 //       {
-//         odo_compute_encoders(&_odo_enc, _meas.left_enc - _meas.prev_left_enc, _meas.right_enc - _meas.prev_right_enc);
+//         odo_compute_encoders(_odometry, &_odo_enc, _meas.left_enc - _meas.prev_left_enc, _meas.right_enc - _meas.prev_right_enc);
 //         memcpy(&_estimated_pose, &_odo_enc, sizeof(pose_t));
 //       }
 //       if (USE_KALMAN_FILTER)
 //       {
-//         kalman_filter_compute_pose(&_kalman_pose, &_gps_pose, gps_updated, _meas.left_enc - _meas.prev_left_enc, _meas.right_enc - _meas.prev_right_enc);
+//         kalman_filter_compute_pose(_kalman, &_kalman_pose, &_gps_pose, gps_updated, _meas.left_enc - _meas.prev_left_enc, _meas.right_enc - _meas.prev_right_enc);
 //         memcpy(&_estimated_pose, &_kalman_pose, sizeof(pose_t));
 //       }
 //       // Use one of the two trajectories.
@@ -286,7 +664,8 @@ void estimate_self_position(float *estimate_pose, int localization_method)
 //     }
 //   }
 
-//   kalman_filter_cleanup();
+//   kalman_filter_destroy(_kalman);
+//   odo_destroy(_odometry);
 
 //   wb_robot_cleanup();
 
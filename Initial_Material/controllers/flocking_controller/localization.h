@@ -1,5 +1,8 @@
 #include "odometry.h"
 #include "kalman_filter.h"
+#include "measurement_queue.h"
+#include "particle_filter.h"
+#include "acc_bias.h"
 
 typedef struct
 {
@@ -11,12 +14,18 @@ typedef struct
     double left_enc;
     double prev_right_enc;
     double right_enc;
+    int proximity[PF_NB_SENSORS];
+    bool proximity_updated;
 } measurement_t;
 void localization_init(int ts);
 void init_localization_devices(int ts);
+void localization_schedule_devices(int method_mask);
 void controller_get_pose();
 void controller_get_acc();
 void controller_get_encoder();
+void controller_set_proximity(const int *distances);
 double controller_get_heading();
 void controller_compute_mean_acc();
-void estimate_self_position(float *estimate_pose, int localization_method);
\ No newline at end of file
+void estimate_self_position(float *estimate_pose, int localization_method);
+void localization_fuse_neighbour(const float neighbour_position[2], const float neighbour_cov[3], const float relative_position[2]);
+bool localization_get_position_cov(float cov[3]);
\ No newline at end of file
@@ -0,0 +1,71 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "measurement_queue.h"
+
+/**
+ * @brief      Empty the queue
+ *
+ * @param      queue  The queue
+ */
+void meas_queue_reset(meas_queue_t *queue)
+{
+    queue->head = 0;
+    queue->count = 0;
+}
+
+/**
+ * @brief      Insert a measurement, keeping the queue sorted by time
+ *
+ *             Measurements usually arrive in order and are appended in O(1). A late one
+ *             is moved back past the newer entries. Measurements with the same time
+ *             keep their push order.
+ *
+ * @param      queue  The queue
+ * @param[in]  meas   The measurement
+ *
+ * @return     false if the queue is full and the measurement was dropped
+ */
+bool meas_queue_push(meas_queue_t *queue, const meas_t *meas)
+{
+    int slot, prev;
+
+    if (queue->count == MEAS_QUEUE_SIZE)
+    {
+        printf("measurement queue full, measurement dropped!\n");
+        return false;
+    }
+
+    slot = (queue->head + queue->count) % MEAS_QUEUE_SIZE;
+    while (slot != queue->head)
+    {
+        prev = (slot + MEAS_QUEUE_SIZE - 1) % MEAS_QUEUE_SIZE;
+        if (queue->items[prev].time <= meas->time)
+            break;
+        queue->items[slot] = queue->items[prev];
+        slot = prev;
+    }
+    queue->items[slot] = *meas;
+    queue->count++;
+    return true;
+}
+
+/**
+ * @brief      Remove the oldest measurement taken at or before time
+ *
+ * @param      queue  The queue
+ * @param[in]  time   The current time in seconds
+ * @param      meas   The measurement
+ *
+ * @return     false if no measurement is due
+ */
+bool meas_queue_pop(meas_queue_t *queue, double time, meas_t *meas)
+{
+    if (queue->count == 0 || queue->items[queue->head].time > time)
+        return false;
+
+    *meas = queue->items[queue->head];
+    queue->head = (queue->head + 1) % MEAS_QUEUE_SIZE;
+    queue->count--;
+    return true;
+}
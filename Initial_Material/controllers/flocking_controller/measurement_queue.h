@@ -0,0 +1,33 @@
+#ifndef MEASUREMENT_QUEUE_H
+#define MEASUREMENT_QUEUE_H
+
+#include <stdbool.h>
+
+#define MEAS_QUEUE_SIZE 32 // Measurements waiting to be consumed by the estimators
+
+typedef enum
+{
+    MEAS_ENCODER, // value = {delta left encoder, delta right encoder}
+    MEAS_GPS      // value = {x, y, heading}
+} meas_type_t;
+
+typedef struct
+{
+    double time; // Time the measurement was taken, in seconds
+    meas_type_t type;
+    double value[3];
+} meas_t;
+
+// Ring buffer kept sorted by measurement time
+typedef struct
+{
+    meas_t items[MEAS_QUEUE_SIZE];
+    int head;
+    int count;
+} meas_queue_t;
+
+void meas_queue_reset(meas_queue_t *queue);
+bool meas_queue_push(meas_queue_t *queue, const meas_t *meas);
+bool meas_queue_pop(meas_queue_t *queue, double time, meas_t *meas);
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef NEIGHBOUR_TABLE_H
+#define NEIGHBOUR_TABLE_H
+
+#include <stdbool.h>
+
+#define NEIGHBOUR_TABLE_SIZE 512  // Neighbours tracked at once, robots of the largest flock
+#define NEIGHBOUR_INDEX_SIZE 1024 // Slots of the id index, a power of two at least twice NEIGHBOUR_TABLE_SIZE
+
+// A flockmate heard on the infrared ping
+typedef struct
+{
+    int id;                  // Unique robot id, the number in its name
+    double last_seen;        // Time of its last ping, in seconds
+    double time;             // Time of the tracked state, in seconds
+    float relative_pos[2];   // Tracked relative X, Z
+    float relative_speed[2]; // Tracked relative speed X, Z
+} neighbour_t;
+
+// The live neighbours are kept densely in items[0, count), the index maps an id to its item
+typedef struct
+{
+    neighbour_t items[NEIGHBOUR_TABLE_SIZE];
+    short index[NEIGHBOUR_INDEX_SIZE]; // Open addressing on the id, item + 1, 0 for a free slot
+    int count;
+    float dist2[NEIGHBOUR_TABLE_SIZE]; // Scratch of neighbour_table_nearest
+} neighbour_table_t;
+
+void neighbour_table_reset(neighbour_table_t *table);
+neighbour_t *neighbour_table_find(neighbour_table_t *table, int id);
+neighbour_t *neighbour_table_observe(neighbour_table_t *table, int id, double time, const float relative_pos[2], float alpha, float beta);
+void neighbour_table_predict(neighbour_table_t *table, double time);
+int neighbour_table_expire(neighbour_table_t *table, double time, double timeout);
+int neighbour_table_nearest(neighbour_table_t *table, int k, int *nearest);
+
+#endif
@@ -2,117 +2,311 @@
 #include <string.h>
 #include <math.h>
 #include <stdbool.h>
+#include <stdlib.h>
 
 #include "odometry.h"
 
 //-----------------------------------------------------------------------------------//
 /*CONSTANTES*/
-#define WHEEL_AXIS 0.057	// Distance between the two wheels in meter
-#define WHEEL_RADIUS 0.0200 // Radius of the wheel in meter
+#define WHEEL_AXIS 0.057	// Distance between the two wheels in meter, default of odo_calibration_t
+#define WHEEL_RADIUS 0.0200 // Radius of the wheel in meter, default of odo_calibration_t
+
+/*INTEGRATION*/
+#define ODO_EXACT_ARC true		// Move along the circular arc of the step instead of the Euler step with the initial heading
 
 /*VERBOSE_FLAGS*/
 #define VERBOSE_ODO_ENC true // Print odometry values computed with wheel encoders
 #define VERBOSE_ODO_ACC true // Print odometry values computed with accelerometer
 //-----------------------------------------------------------------------------------//
-/*GLOBAL*/
-static double _T;
+/*CONTEXT*/
+struct odometry
+{
+	double T;
 
-static pose_t _odo_pose_acc, _odo_speed_acc, _odo_pose_enc;
+	pose_t pose_acc, speed_acc, pose_enc;
+	double cov_enc[3][3]; // Covariance of pose_enc, [x, y, heading]
+	odo_calibration_t calibration;
+};
 //-----------------------------------------------------------------------------------//
 
 /**
  * @brief      Compute the odometry using the acceleration
  *
+ * @param      ctx       The odometry context
  * @param      odo       The odometry
  * @param[in]  acc       The acceleration
  * @param[in]  acc_mean  The acc mean
  */
-void odo_compute_acc_encoders(pose_t *odo, const double acc[3], const double acc_mean[3], double Aleft_enc, double Aright_enc)
+void odo_compute_acc_encoders(odometry_t *ctx, pose_t *odo, const double acc[3], const double acc_mean[3], double Aleft_enc, double Aright_enc)
 {
 	// Compute the acceleration in body frame + remove biais (Assume 1-D motion)
 	double acc_bx = acc[1] - acc_mean[1];
 	double acc_by = -(acc[0] - acc_mean[0]);
 	// Compute the acceleration in world frame
-	double acc_wx = acc_bx * cos(_odo_pose_acc.heading) - acc_by * sin(_odo_pose_acc.heading);
-	double acc_wy = acc_bx * sin(_odo_pose_acc.heading) + acc_by * cos(_odo_pose_acc.heading);
+	double acc_wx = acc_bx * cos(ctx->pose_acc.heading) - acc_by * sin(ctx->pose_acc.heading);
+	double acc_wy = acc_bx * sin(ctx->pose_acc.heading) + acc_by * cos(ctx->pose_acc.heading);
 
-	Aleft_enc *= WHEEL_RADIUS;
+	Aleft_enc *= ctx->calibration.wheel_radius_left;
 
-	Aright_enc *= WHEEL_RADIUS;
+	Aright_enc *= ctx->calibration.wheel_radius_right;
 
-	double omega = (Aright_enc - Aleft_enc) / (WHEEL_AXIS * _T);
+	double omega = (Aright_enc - Aleft_enc) / (ctx->calibration.wheel_axis * ctx->T);
 
-	_odo_speed_acc.x = _odo_speed_acc.x + acc_wx * _T;
+	ctx->speed_acc.x = ctx->speed_acc.x + acc_wx * ctx->T;
 
-	_odo_pose_acc.x = _odo_pose_acc.x + _odo_speed_acc.x * _T;
+	ctx->pose_acc.x = ctx->pose_acc.x + ctx->speed_acc.x * ctx->T;
 
-	_odo_speed_acc.y = _odo_speed_acc.y + acc_wy * _T;
+	ctx->speed_acc.y = ctx->speed_acc.y + acc_wy * ctx->T;
 
-	_odo_pose_acc.y = _odo_pose_acc.y + _odo_speed_acc.y * _T;
+	ctx->pose_acc.y = ctx->pose_acc.y + ctx->speed_acc.y * ctx->T;
 
-	_odo_pose_acc.heading = _odo_pose_acc.heading + omega * _T;
+	ctx->pose_acc.heading = ctx->pose_acc.heading + omega * ctx->T;
 
-	memcpy(odo, &_odo_pose_acc, sizeof(pose_t));
+	memcpy(odo, &ctx->pose_acc, sizeof(pose_t));
 	//printf("ODO with acceleration : %g %g %g\n", -2.9 + odo->x, odo->y, odo->heading);
 }
 
+/**
+ * @brief      Cov = F * Cov * F' + G * N * G' for one step of odo_compute_encoders
+ *
+ *             F = [1, 0, f02; 0, 1, f12; 0, 0, 1] is the Jacobian of the step with respect to
+ *             the pose and G (3x2) the Jacobian with respect to the wheel displacements, whose
+ *             noise N = diag(n_left, n_right) is independent. Computed in place on the stack.
+ *
+ * @param      cov      The covariance (3x3, symmetric), updated in place
+ * @param[in]  f02      The derivative of x with respect to the heading
+ * @param[in]  f12      The derivative of y with respect to the heading
+ * @param[in]  G        The derivatives of [x, y, heading] with respect to [left, right] displacements
+ * @param[in]  n_left   The variance of the left wheel displacement
+ * @param[in]  n_right  The variance of the right wheel displacement
+ */
+static void odo_propagate_cov(double cov[3][3], double f02, double f12, const double G[3][2], double n_left, double n_right)
+{
+	double FP[3][3];
+	double value;
+	int i, j;
+
+	// F * Cov, F only adds heading row multiples to the x and y rows
+	for (j = 0; j < 3; j++)
+	{
+		FP[0][j] = cov[0][j] + f02 * cov[2][j];
+		FP[1][j] = cov[1][j] + f12 * cov[2][j];
+		FP[2][j] = cov[2][j];
+	}
+	// (F * Cov) * F' + G * N * G', symmetric so only the upper triangle is computed
+	for (i = 0; i < 3; i++)
+	{
+		for (j = i; j < 3; j++)
+		{
+			value = FP[i][j] + G[i][0] * n_left * G[j][0] + G[i][1] * n_right * G[j][1];
+			if (j == 0)
+				value += f02 * FP[i][2];
+			if (j == 1)
+				value += f12 * FP[i][2];
+			cov[i][j] = value;
+			cov[j][i] = value;
+		}
+	}
+}
+
 /**
  * @brief      Compute the odometry using the encoders
  *
+ *             With ODO_EXACT_ARC the robot moves along the circular arc given by the two wheel
+ *             displacements: the chord d * sin(r / 2) / (r / 2) along the heading at mid step,
+ *             exact for constant wheel speeds and equal to the straight step when r = 0.
+ *             Otherwise the distance is travelled along the heading before the step (Euler).
+ *             The covariance of the pose is propagated with a wheel slip noise of variance
+ *             ODO_WHEEL_NOISE * |displacement| per wheel, see odo_get_covariance.
+ *
+ * @param      ctx         The odometry context
  * @param      odo         The odometry
  * @param[in]  Aleft_enc   The delta left encoder
  * @param[in]  Aright_enc  The delta right encoder
  */
-void odo_compute_encoders(pose_t *odo, double Aleft_enc, double Aright_enc)
+void odo_compute_encoders(odometry_t *ctx, pose_t *odo, double Aleft_enc, double Aright_enc)
 {
 
+	double wheel_axis = ctx->calibration.wheel_axis;
+
 	// Rad to meter
-	Aleft_enc *= WHEEL_RADIUS;
+	Aleft_enc *= ctx->calibration.wheel_radius_left;
+
+	Aright_enc *= ctx->calibration.wheel_radius_right;
+
+	// Travelled distance and rotation of the step
+	double distance = (Aright_enc + Aleft_enc) / 2.0;
 
-	Aright_enc *= WHEEL_RADIUS;
+	double half_rotation = (Aright_enc - Aleft_enc) / (2.0 * wheel_axis);
 
-	// Compute forward speed and angular speed
-	double omega = (Aright_enc - Aleft_enc) / (WHEEL_AXIS * _T);
+	// Chord = distance * k along the heading a, and the derivatives of k and a with respect to half_rotation
+	double k = 1.0, dk = 0.0, a = ctx->pose_enc.heading, da = 0.0;
 
-	double speed = (Aright_enc + Aleft_enc) / (2.0 * _T);
+	if (ODO_EXACT_ARC)
+	{
+		a += half_rotation;
+		da = 1.0;
+		if (fabs(half_rotation) > 1e-4)
+		{
+			k = sin(half_rotation) / half_rotation;
+			dk = (cos(half_rotation) - k) / half_rotation;
+		}
+		else
+		{
+			// Series of sin(h) / h, avoids the cancellation at small rotations
+			k = 1.0 - half_rotation * half_rotation / 6.0;
+			dk = -half_rotation / 3.0;
+		}
+	}
+	double chord = distance * k;
 
-	// Apply rotation (Body to World)
+	double cos_a = cos(a);
 
-	double a = _odo_pose_enc.heading;
+	double sin_a = sin(a);
 
-	double speed_wx = speed * cos(a);
+	// Jacobians of the step with respect to the pose (F) and to [left, right] displacements (G),
+	// d(distance) / d(left, right) = 1/2 and d(half_rotation) / d(left, right) = -+1 / (2 * wheel_axis)
+	double dchord_dh = distance * dk, h_l = -1.0 / (2.0 * wheel_axis);
+	double G[3][2] = {
+		{(k / 2.0 + dchord_dh * h_l) * cos_a - chord * sin_a * da * h_l, (k / 2.0 - dchord_dh * h_l) * cos_a + chord * sin_a * da * h_l},
+		{(k / 2.0 + dchord_dh * h_l) * sin_a + chord * cos_a * da * h_l, (k / 2.0 - dchord_dh * h_l) * sin_a - chord * cos_a * da * h_l},
+		{-1.0 / wheel_axis, 1.0 / wheel_axis}};
 
-	double speed_wy = speed * sin(a);
+	odo_propagate_cov(ctx->cov_enc, -chord * sin_a, chord * cos_a, G, ODO_WHEEL_NOISE * fabs(Aleft_enc), ODO_WHEEL_NOISE * fabs(Aright_enc));
 
-	// Integration : Euler method
-	_odo_pose_enc.x += speed_wx * _T;
+	ctx->pose_enc.x += chord * cos_a;
 
-	_odo_pose_enc.y += speed_wy * _T;
+	ctx->pose_enc.y += chord * sin_a;
 
-	_odo_pose_enc.heading += omega * _T;
+	ctx->pose_enc.heading += 2.0 * half_rotation;
 
-	memcpy(odo, &_odo_pose_enc, sizeof(pose_t));
+	memcpy(odo, &ctx->pose_enc, sizeof(pose_t));
 
 	//printf("ODO with wheel encoders : %g %g %g\n", -2.9 + odo->x, odo->y, odo->heading);
-	//printf("ODO with encorder : speed_x: %g, speed_y: %g\n", speed_wx, speed_wy);
-	//printf("Aleft_enc is: %g, Aright_enc is: %g, speed is: %g\n", Aleft_enc, Aright_enc, speed);
+	//printf("Aleft_enc is: %g, Aright_enc is: %g, chord is: %g\n", Aleft_enc, Aright_enc, chord);
+}
+
+/**
+ * @brief      Get the covariance of the encoder odometry, zero at the origin given to odo_reset
+ *
+ * @param[in]  ctx   The odometry context
+ * @param      cov   The covariance of [x, y, heading]
+ */
+void odo_get_covariance(const odometry_t *ctx, double cov[3][3])
+{
+	memcpy(cov, ctx->cov_enc, sizeof(ctx->cov_enc));
+}
+
+/**
+ * @brief      Set the kinematic constants of the robot, the defaults are WHEEL_RADIUS and WHEEL_AXIS
+ *
+ * @param      ctx          The odometry context
+ * @param[in]  calibration  The wheel radii and axle length, in meter
+ */
+void odo_set_calibration(odometry_t *ctx, const odo_calibration_t *calibration)
+{
+	memcpy(&ctx->calibration, calibration, sizeof(odo_calibration_t));
+}
+
+/**
+ * @brief      Get the kinematic constants in use
+ *
+ * @param[in]  ctx          The odometry context
+ * @param      calibration  The wheel radii and axle length, in meter
+ */
+void odo_get_calibration(const odometry_t *ctx, odo_calibration_t *calibration)
+{
+	memcpy(calibration, &ctx->calibration, sizeof(odo_calibration_t));
+}
+
+/**
+ * @brief      Load the kinematic constants written by tools/odo_calibration
+ *
+ *             The file holds "key = value" lines, '#' starts a comment. Missing keys keep
+ *             their current value.
+ *
+ * @param      ctx        The odometry context
+ * @param[in]  file_name  The parameter file
+ *
+ * @return     false if the file cannot be read or a value is not positive
+ */
+bool odo_load_calibration(odometry_t *ctx, const char *file_name)
+{
+	FILE *file = fopen(file_name, "r");
+	odo_calibration_t calibration = ctx->calibration;
+	char line[128], key[64];
+	double value;
+
+	if (file == NULL)
+		return false;
+	while (fgets(line, sizeof(line), file) != NULL)
+	{
+		if (line[0] == '#' || sscanf(line, " %63[a-z_] = %lf", key, &value) != 2)
+			continue;
+		if (value <= 0.0)
+		{
+			printf("%s: %s must be positive, calibration ignored\n", file_name, key);
+			fclose(file);
+			return false;
+		}
+		if (strcmp(key, "wheel_radius_left") == 0)
+			calibration.wheel_radius_left = value;
+		else if (strcmp(key, "wheel_radius_right") == 0)
+			calibration.wheel_radius_right = value;
+		else if (strcmp(key, "wheel_axis") == 0)
+			calibration.wheel_axis = value;
+	}
+	fclose(file);
+
+	odo_set_calibration(ctx, &calibration);
+	return true;
 }
 
 /**
  * @brief      Reset the odometry to zeros
  *
+ * @param      ctx        The odometry context
  * @param[in]  time_step  The time step used in the simulation in miliseconds
  */
-void odo_reset(int time_step, pose_t *pose_origin)
+void odo_reset(odometry_t *ctx, int time_step, pose_t *pose_origin)
 {
 
-	memset(&_odo_pose_acc, 0, sizeof(pose_t));
-	memcpy(&_odo_pose_acc, pose_origin, sizeof(pose_t));
+	memset(&ctx->pose_acc, 0, sizeof(pose_t));
+	memcpy(&ctx->pose_acc, pose_origin, sizeof(pose_t));
 
-	memset(&_odo_speed_acc, 0, sizeof(pose_t));
+	memset(&ctx->speed_acc, 0, sizeof(pose_t));
 
-	memset(&_odo_pose_enc, 0, sizeof(pose_t));
-	memcpy(&_odo_pose_enc, pose_origin, sizeof(pose_t));
+	memset(&ctx->pose_enc, 0, sizeof(pose_t));
+	memcpy(&ctx->pose_enc, pose_origin, sizeof(pose_t));
 
-	_T = time_step / 1000.0;
-}
\ No newline at end of file
+	memset(ctx->cov_enc, 0, sizeof(ctx->cov_enc));
+
+	ctx->T = time_step / 1000.0;
+}
+
+/**
+ * @brief      Create an odometry context with the default calibration, to be initialized with odo_reset
+ */
+odometry_t *odo_create()
+{
+	odometry_t *ctx = (odometry_t *)calloc(1, sizeof(odometry_t));
+
+	if (ctx == NULL)
+	{
+		printf("odometry create fail!\n");
+		return NULL;
+	}
+	ctx->calibration.wheel_radius_left = WHEEL_RADIUS;
+	ctx->calibration.wheel_radius_right = WHEEL_RADIUS;
+	ctx->calibration.wheel_axis = WHEEL_AXIS;
+
+	return ctx;
+}
+
+/**
+ * @brief      Release an odometry context created with odo_create
+ */
+void odo_destroy(odometry_t *ctx)
+{
+	free(ctx);
+}
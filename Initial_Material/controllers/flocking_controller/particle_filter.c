@@ -0,0 +1,660 @@
+#include "particle_filter.h"
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <stdlib.h>
+
+//-----------------------------------------------------------------------------------//
+/*CONSTANTES*/
+#define WHEEL_AXIS 0.057    // Distance between the two wheels in meter
+#define WHEEL_RADIUS 0.0200 // Radius of the wheel in meter
+
+/*MOTION MODEL*/
+#define PF_WHEEL_NOISE 0.0005       // Variance of a wheel displacement per meter travelled (m), as ODO_WHEEL_NOISE
+#define PF_INIT_SPREAD_XY 0.01      // Std of the initial position around the origin (m)
+#define PF_INIT_SPREAD_HEADING 0.02 // Std of the initial heading around the origin (rad)
+#define PF_NOISE_SIZE 4096          // Precomputed standard normal samples, read at a random offset each step
+
+/*SENSOR MODEL*/
+#define PF_SENSOR_RADIUS 0.033 // Distance from the robot center to the proximity sensors (m)
+#define PF_IR_MIN_VALUE 150    // Weaker readings (about 4 cm and beyond) are ambient noise
+#define PF_SIGMA_HIT 0.01      // Std of the distance between a sensed point and the nearest obstacle (m)
+#define PF_Z_HIT 1.0           // Weight of the gaussian part of the likelihood field
+#define PF_Z_RAND 0.05         // Floor of the likelihood field, unmapped obstacles (other robots)
+#define PF_GPS_SIGMA 0.01      // Std of the gps position (m)
+#define PF_GPS_RESEED 0.5      // The cloud is lost when the gps is that far from every particle (m)
+#define PF_RESAMPLE_RATIO 0.5  // Resample when the effective sample size drops below this share
+
+/*MAP*/
+// Floor of obstacles.wbt (x from -3.1 to 3.1, z from -2 to 2) with a 10 cm border
+#define PF_MAP_X_MIN -3.2
+#define PF_MAP_Y_MIN -2.1
+#define PF_MAP_WIDTH 6.4
+#define PF_MAP_HEIGHT 4.2
+#define PF_MAP_RESOLUTION 0.01 // Cell size of the likelihood field (m)
+
+/*SIMD*/
+// One particle per lane. The likelihood field lookup is a hardware gather with AVX2,
+// a scalar loop over the lanes otherwise.
+#if defined(__AVX__)
+#include <immintrin.h>
+#define PF_LANES 8
+typedef __m256 pf_vec;
+#define PF_LOAD(p) _mm256_loadu_ps(p)
+#define PF_STORE(p, v) _mm256_storeu_ps(p, v)
+#define PF_SET1(a) _mm256_set1_ps(a)
+#define PF_ADD(a, b) _mm256_add_ps(a, b)
+#define PF_SUB(a, b) _mm256_sub_ps(a, b)
+#define PF_MUL(a, b) _mm256_mul_ps(a, b)
+#define PF_MIN(a, b) _mm256_min_ps(a, b)
+#define PF_MAX(a, b) _mm256_max_ps(a, b)
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+#define PF_LANES 4
+typedef __m128 pf_vec;
+#define PF_LOAD(p) _mm_loadu_ps(p)
+#define PF_STORE(p, v) _mm_storeu_ps(p, v)
+#define PF_SET1(a) _mm_set1_ps(a)
+#define PF_ADD(a, b) _mm_add_ps(a, b)
+#define PF_SUB(a, b) _mm_sub_ps(a, b)
+#define PF_MUL(a, b) _mm_mul_ps(a, b)
+#define PF_MIN(a, b) _mm_min_ps(a, b)
+#define PF_MAX(a, b) _mm_max_ps(a, b)
+#else
+#define PF_LANES 1
+typedef float pf_vec;
+#define PF_LOAD(p) (*(p))
+#define PF_STORE(p, v) (*(p) = (v))
+#define PF_SET1(a) (a)
+#define PF_ADD(a, b) ((a) + (b))
+#define PF_SUB(a, b) ((a) - (b))
+#define PF_MUL(a, b) ((a) * (b))
+#define PF_MIN(a, b) ((a) < (b) ? (a) : (b))
+#define PF_MAX(a, b) ((a) > (b) ? (a) : (b))
+#endif
+
+// Obstacle of the map, a box of half sizes half_x, half_y rotated by angle around its center
+typedef struct
+{
+    float x;
+    float y;
+    float half_x;
+    float half_y;
+    float angle;
+} pf_box_t;
+
+// Rocks of obstacles.wbt in the localization frame (x, -z), a rotation of a around the
+// Webots y axis is a rotation of a in this frame
+static const pf_box_t pf_map[] = {
+    {-3.0000f, 0.0000f, 0.3000f, 0.0050f, 1.5708f}, // long_rock_3
+    {-2.9000f, -0.3000f, 0.1000f, 0.0050f, 0.0000f}, // long_rock_4
+    {-2.9000f, 0.3000f, 0.1000f, 0.0050f, 0.0000f},  // long_rock_6
+    {-0.2675f, 0.2217f, 0.0750f, 0.0750f, 5.0266f},
+    {-1.3877f, 1.0653f, 0.0250f, 0.0250f, -2.0570f},
+    {1.2536f, -0.4753f, 0.0250f, 0.0250f, -2.0570f},
+    {-1.5354f, -0.1611f, 0.0250f, 0.0250f, -2.0570f},
+    {-1.3403f, -0.7762f, 0.0250f, 0.0250f, -2.0570f},
+    {-2.3429f, 0.0741f, 0.0250f, 0.0250f, -2.0570f},
+    {1.0999f, 1.3274f, 0.0250f, 0.0250f, -2.0570f},
+    {-0.1059f, 1.3463f, 0.0750f, 0.0750f, 0.0000f},
+    {0.9311f, -1.3168f, 0.0750f, 0.0750f, -0.3256f},
+    {-0.0855f, -0.8466f, 0.0750f, 0.0750f, 0.0000f},
+    {1.9149f, -0.1076f, 0.0750f, 0.0750f, 0.0000f},
+    {0.9580f, 0.1277f, 0.0750f, 0.0750f, 0.0000f},
+    {-1.0560f, -1.7237f, 0.0750f, 0.0750f, 0.0000f},
+    {-1.9549f, 0.6860f, 0.0750f, 0.1850f, 0.0000f},
+    {-1.2075f, 0.4787f, 0.0750f, 0.0750f, -2.0570f}};
+
+// Direction of ps0 to ps7 from the heading, counterclockwise
+static const float pf_sensor_angle[PF_NB_SENSORS] = {-0.30f, -0.80f, -1.57f, -2.64f, 2.64f, 1.57f, 0.80f, 0.30f};
+
+// Lookup table of the e-puck proximity sensors {distance (m), value}
+static const float pf_ir_table[][2] = {
+    {0.000f, 4095.0f},
+    {0.005f, 2133.33f},
+    {0.010f, 1465.73f},
+    {0.015f, 601.46f},
+    {0.020f, 383.84f},
+    {0.030f, 234.93f},
+    {0.040f, 158.03f},
+    {0.050f, 120.0f},
+    {0.060f, 104.09f},
+    {0.070f, 67.19f}};
+
+struct particle_filter
+{
+    int count;
+    int capacity;          // count rounded up to a multiple of PF_LANES, padding particles have no weight
+    unsigned int random;   // xorshift state
+
+    // Particles, the heading is kept as its cosine and sine so the kernels need no trigonometry
+    float *x;
+    float *y;
+    float *c;
+    float *s;
+    float *w;
+    float *x_next;         // Destination of the resampling, swapped with x, y, c, s
+    float *y_next;
+    float *c_next;
+    float *s_next;
+    float *block;          // Allocation holding all the arrays above
+
+    float *noise;          // PF_NOISE_SIZE + capacity standard normal samples, the tail repeats the head
+
+    float *field;          // Likelihood of a sensed point in each cell, row major
+    int field_nx;
+    int field_ny;
+};
+
+static unsigned int particle_filter_random(particle_filter_t *pf)
+{
+    unsigned int r = pf->random;
+
+    r ^= r << 13;
+    r ^= r >> 17;
+    r ^= r << 5;
+    pf->random = r;
+    return r;
+}
+
+// Uniform in (0, 1]
+static float particle_filter_uniform(particle_filter_t *pf)
+{
+    return ((particle_filter_random(pf) >> 8) + 1) * (1.0f / 16777216.0f);
+}
+
+static float particle_filter_sum(pf_vec v)
+{
+    float lanes[PF_LANES];
+    float sum = 0.0f;
+    int l;
+
+    PF_STORE(lanes, v);
+    for (l = 0; l < PF_LANES; l++)
+        sum += lanes[l];
+    return sum;
+}
+
+/**
+ * @brief      Likelihood field of PF_LANES points, fx and fy are cell coordinates already clamped to the map
+ */
+#if defined(__AVX2__)
+static pf_vec particle_filter_gather(const particle_filter_t *pf, pf_vec fx, pf_vec fy)
+{
+    __m256i index = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_cvttps_epi32(fy), _mm256_set1_epi32(pf->field_nx)), _mm256_cvttps_epi32(fx));
+
+    return _mm256_i32gather_ps(pf->field, index, 4);
+}
+#else
+static pf_vec particle_filter_gather(const particle_filter_t *pf, pf_vec fx, pf_vec fy)
+{
+    float cx[PF_LANES], cy[PF_LANES], value[PF_LANES];
+    int l;
+
+    PF_STORE(cx, fx);
+    PF_STORE(cy, fy);
+    for (l = 0; l < PF_LANES; l++)
+        value[l] = pf->field[(int)cy[l] * pf->field_nx + (int)cx[l]];
+    return PF_LOAD(value);
+}
+#endif
+
+/**
+ * @brief      Precompute the likelihood field of the map
+ *
+ *             Each cell holds PF_Z_HIT * exp(-d^2 / (2 * PF_SIGMA_HIT^2)) + PF_Z_RAND with d the
+ *             distance from its center to the nearest box, so weighting a particle is one lookup
+ *             per sensor. Cells further than 5 sigma from every box only keep PF_Z_RAND.
+ *
+ * @param      pf    The filter
+ */
+static void particle_filter_build_field(particle_filter_t *pf)
+{
+    const float res = PF_MAP_RESOLUTION;
+    const float reach = 5.0f * PF_SIGMA_HIT;
+    const int nx = pf->field_nx, ny = pf->field_ny;
+    int b, n, ix, iy, ix0, ix1, iy0, iy1;
+
+    for (n = 0; n < nx * ny; n++)
+        pf->field[n] = PF_Z_RAND;
+
+    for (b = 0; b < (int)(sizeof(pf_map) / sizeof(pf_map[0])); b++)
+    {
+        const pf_box_t *box = &pf_map[b];
+        float ca = cosf(box->angle), sa = sinf(box->angle);
+        float radius = sqrtf(box->half_x * box->half_x + box->half_y * box->half_y) + reach;
+
+        ix0 = (int)((box->x - radius - PF_MAP_X_MIN) / res);
+        ix1 = (int)((box->x + radius - PF_MAP_X_MIN) / res);
+        iy0 = (int)((box->y - radius - PF_MAP_Y_MIN) / res);
+        iy1 = (int)((box->y + radius - PF_MAP_Y_MIN) / res);
+        ix0 = ix0 < 0 ? 0 : ix0;
+        iy0 = iy0 < 0 ? 0 : iy0;
+        ix1 = ix1 > nx - 1 ? nx - 1 : ix1;
+        iy1 = iy1 > ny - 1 ? ny - 1 : iy1;
+
+        for (iy = iy0; iy <= iy1; iy++)
+        {
+            for (ix = ix0; ix <= ix1; ix++)
+            {
+                // Cell center in the frame of the box
+                float dx = PF_MAP_X_MIN + (ix + 0.5f) * res - box->x;
+                float dy = PF_MAP_Y_MIN + (iy + 0.5f) * res - box->y;
+                float qx = fmaxf(fabsf(ca * dx + sa * dy) - box->half_x, 0.0f);
+                float qy = fmaxf(fabsf(-sa * dx + ca * dy) - box->half_y, 0.0f);
+                float p = PF_Z_HIT * expf(-(qx * qx + qy * qy) / (2.0f * PF_SIGMA_HIT * PF_SIGMA_HIT)) + PF_Z_RAND;
+
+                if (p > pf->field[iy * nx + ix])
+                    pf->field[iy * nx + ix] = p;
+            }
+        }
+    }
+}
+
+/**
+ * @brief      Distance to the obstacle seen by a proximity sensor
+ *
+ * @param[in]  value  The raw sensor value
+ *
+ * @return     The distance in meter, negative when nothing is in range
+ */
+static float particle_filter_ir_distance(int value)
+{
+    int i;
+
+    if (value < PF_IR_MIN_VALUE)
+        return -1.0f;
+    for (i = 0; i < (int)(sizeof(pf_ir_table) / sizeof(pf_ir_table[0])) - 1; i++)
+    {
+        if (value >= pf_ir_table[i + 1][1])
+        {
+            float a = (pf_ir_table[i][1] - value) / (pf_ir_table[i][1] - pf_ir_table[i + 1][1]);
+            return pf_ir_table[i][0] + (a < 0.0f ? 0.0f : a) * (pf_ir_table[i + 1][0] - pf_ir_table[i][0]);
+        }
+    }
+    return -1.0f;
+}
+
+/**
+ * @brief      Move every particle by the wheel displacements plus noise
+ *
+ *             Each wheel displacement gets a noise of variance PF_WHEEL_NOISE * |displacement|,
+ *             the model of the EKF. The heading is rotated with a third order expansion of cos
+ *             and sin, exact to 1e-7 for the rotation of a 64 ms step, then renormalized by one
+ *             Newton step.
+ *
+ * @param      pf      The filter
+ * @param[in]  left    The displacement of the left wheel (m)
+ * @param[in]  right   The displacement of the right wheel (m)
+ */
+static void particle_filter_predict(particle_filter_t *pf, float left, float right)
+{
+    const float *noise_l = pf->noise + particle_filter_random(pf) % PF_NOISE_SIZE;
+    const float *noise_r = pf->noise + particle_filter_random(pf) % PF_NOISE_SIZE;
+    pf_vec l = PF_SET1(left);
+    pf_vec r = PF_SET1(right);
+    pf_vec std_l = PF_SET1(sqrtf(PF_WHEEL_NOISE * fabsf(left)));
+    pf_vec std_r = PF_SET1(sqrtf(PF_WHEEL_NOISE * fabsf(right)));
+    pf_vec inv_axis = PF_SET1(1.0f / WHEEL_AXIS);
+    pf_vec half = PF_SET1(0.5f);
+    pf_vec one = PF_SET1(1.0f);
+    pf_vec sixth = PF_SET1(1.0f / 6.0f);
+    pf_vec three_halves = PF_SET1(1.5f);
+    int n;
+
+    for (n = 0; n < pf->capacity; n += PF_LANES)
+    {
+        pf_vec x = PF_LOAD(pf->x + n), y = PF_LOAD(pf->y + n);
+        pf_vec c = PF_LOAD(pf->c + n), s = PF_LOAD(pf->s + n);
+        pf_vec ln = PF_ADD(l, PF_MUL(std_l, PF_LOAD(noise_l + n)));
+        pf_vec rgt = PF_ADD(r, PF_MUL(std_r, PF_LOAD(noise_r + n)));
+        pf_vec dn = PF_MUL(half, PF_ADD(ln, rgt));
+        pf_vec rn = PF_MUL(inv_axis, PF_SUB(rgt, ln));
+        pf_vec half_r = PF_MUL(half, rn);
+        pf_vec r2 = PF_MUL(rn, rn);
+        pf_vec cos_r = PF_SUB(one, PF_MUL(half, r2));
+        pf_vec sin_r = PF_MUL(rn, PF_SUB(one, PF_MUL(sixth, r2)));
+        pf_vec c_new, s_new, k;
+
+        // Move along the mid-step heading
+        x = PF_ADD(x, PF_MUL(dn, PF_SUB(c, PF_MUL(s, half_r))));
+        y = PF_ADD(y, PF_MUL(dn, PF_ADD(s, PF_MUL(c, half_r))));
+        c_new = PF_SUB(PF_MUL(c, cos_r), PF_MUL(s, sin_r));
+        s_new = PF_ADD(PF_MUL(s, cos_r), PF_MUL(c, sin_r));
+        k = PF_SUB(three_halves, PF_MUL(half, PF_ADD(PF_MUL(c_new, c_new), PF_MUL(s_new, s_new))));
+
+        PF_STORE(pf->x + n, x);
+        PF_STORE(pf->y + n, y);
+        PF_STORE(pf->c + n, PF_MUL(c_new, k));
+        PF_STORE(pf->s + n, PF_MUL(s_new, k));
+    }
+}
+
+/**
+ * @brief      Weight the particles by the likelihood field at the points seen by the proximity sensors
+ *
+ * @param      pf         The filter
+ * @param[in]  proximity  The raw values of ps0 to ps7
+ *
+ * @return     false if no sensor sees an obstacle
+ */
+static bool particle_filter_weight_proximity(particle_filter_t *pf, const int *proximity)
+{
+    float ex[PF_NB_SENSORS], ey[PF_NB_SENSORS];
+    pf_vec x_min = PF_SET1(PF_MAP_X_MIN), y_min = PF_SET1(PF_MAP_Y_MIN);
+    pf_vec inv_res = PF_SET1(1.0f / PF_MAP_RESOLUTION);
+    pf_vec zero = PF_SET1(0.0f);
+    pf_vec fx_max = PF_SET1(pf->field_nx - 1), fy_max = PF_SET1(pf->field_ny - 1);
+    int hits = 0, k, n;
+
+    // Sensed points in the robot frame
+    for (k = 0; k < PF_NB_SENSORS; k++)
+    {
+        float distance = particle_filter_ir_distance(proximity[k]);
+
+        if (distance < 0.0f)
+            continue;
+        ex[hits] = (PF_SENSOR_RADIUS + distance) * cosf(pf_sensor_angle[k]);
+        ey[hits] = (PF_SENSOR_RADIUS + distance) * sinf(pf_sensor_angle[k]);
+        hits++;
+    }
+    if (hits == 0)
+        return false;
+
+    for (n = 0; n < pf->capacity; n += PF_LANES)
+    {
+        pf_vec x = PF_LOAD(pf->x + n), y = PF_LOAD(pf->y + n);
+        pf_vec c = PF_LOAD(pf->c + n), s = PF_LOAD(pf->s + n);
+        pf_vec w = PF_LOAD(pf->w + n);
+
+        for (k = 0; k < hits; k++)
+        {
+            pf_vec px = PF_SET1(ex[k]), py = PF_SET1(ey[k]);
+            pf_vec wx = PF_ADD(x, PF_SUB(PF_MUL(c, px), PF_MUL(s, py)));
+            pf_vec wy = PF_ADD(y, PF_ADD(PF_MUL(s, px), PF_MUL(c, py)));
+            pf_vec fx = PF_MIN(PF_MAX(PF_MUL(PF_SUB(wx, x_min), inv_res), zero), fx_max);
+            pf_vec fy = PF_MIN(PF_MAX(PF_MUL(PF_SUB(wy, y_min), inv_res), zero), fy_max);
+
+            w = PF_MUL(w, particle_filter_gather(pf, fx, fy));
+        }
+        PF_STORE(pf->w + n, w);
+    }
+    return true;
+}
+
+/**
+ * @brief      Weighted mean of the particles, the heading from the mean of its cosine and sine
+ */
+static void particle_filter_estimate(const particle_filter_t *pf, pose_t *state_pf)
+{
+    pf_vec sx = PF_SET1(0.0f), sy = PF_SET1(0.0f), sc = PF_SET1(0.0f), ss = PF_SET1(0.0f);
+    int n;
+
+    for (n = 0; n < pf->capacity; n += PF_LANES)
+    {
+        pf_vec w = PF_LOAD(pf->w + n);
+
+        sx = PF_ADD(sx, PF_MUL(w, PF_LOAD(pf->x + n)));
+        sy = PF_ADD(sy, PF_MUL(w, PF_LOAD(pf->y + n)));
+        sc = PF_ADD(sc, PF_MUL(w, PF_LOAD(pf->c + n)));
+        ss = PF_ADD(ss, PF_MUL(w, PF_LOAD(pf->s + n)));
+    }
+    state_pf->x = particle_filter_sum(sx);
+    state_pf->y = particle_filter_sum(sy);
+    state_pf->heading = atan2f(particle_filter_sum(ss), particle_filter_sum(sc));
+}
+
+/**
+ * @brief      Weight the particles by a gps fix
+ *
+ *             The exponent is taken relative to the nearest particle so the weights cannot all
+ *             underflow. A fix further than PF_GPS_RESEED from every particle means the cloud
+ *             lost the robot, the particles are drawn again around the fix.
+ *
+ * @param      pf        The filter
+ * @param[in]  gps_pose  The gps pose
+ */
+static void particle_filter_weight_gps(particle_filter_t *pf, const pose_t *gps_pose)
+{
+    const float gx = gps_pose->x, gy = gps_pose->y;
+    const float k = 1.0f / (2.0f * PF_GPS_SIGMA * PF_GPS_SIGMA);
+    float d2_min = INFINITY;
+    int n;
+
+    for (n = 0; n < pf->count; n++)
+    {
+        float dx = pf->x[n] - gx, dy = pf->y[n] - gy;
+        float d2 = dx * dx + dy * dy;
+
+        d2_min = d2 < d2_min ? d2 : d2_min;
+    }
+    if (d2_min > PF_GPS_RESEED * PF_GPS_RESEED)
+    {
+        pose_t pose;
+
+        particle_filter_estimate(pf, &pose);
+        pose.x = gx;
+        pose.y = gy;
+        particle_filter_reset(pf, &pose);
+        return;
+    }
+    for (n = 0; n < pf->count; n++)
+    {
+        float dx = pf->x[n] - gx, dy = pf->y[n] - gy;
+
+        pf->w[n] *= expf(-(dx * dx + dy * dy - d2_min) * k);
+    }
+}
+
+/**
+ * @brief      Normalize the weights
+ *
+ * @param      pf    The filter
+ *
+ * @return     The effective sample size 1 / sum(w^2)
+ */
+static float particle_filter_normalize(particle_filter_t *pf)
+{
+    pf_vec sum = PF_SET1(0.0f), sum2 = PF_SET1(0.0f), scale;
+    float total;
+    int n;
+
+    for (n = 0; n < pf->capacity; n += PF_LANES)
+        sum = PF_ADD(sum, PF_LOAD(pf->w + n));
+    total = particle_filter_sum(sum);
+
+    // Every particle contradicts the measurements, keep them with equal weights
+    if (!(total > 1e-30f))
+    {
+        for (n = 0; n < pf->count; n++)
+            pf->w[n] = 1.0f / pf->count;
+        return pf->count;
+    }
+
+    scale = PF_SET1(1.0f / total);
+    for (n = 0; n < pf->capacity; n += PF_LANES)
+    {
+        pf_vec w = PF_MUL(PF_LOAD(pf->w + n), scale);
+
+        sum2 = PF_ADD(sum2, PF_MUL(w, w));
+        PF_STORE(pf->w + n, w);
+    }
+    return 1.0f / particle_filter_sum(sum2);
+}
+
+/**
+ * @brief      Systematic resampling of normalized weights
+ *
+ *             One uniform draw, then count equally spaced points walk the cumulative weights
+ *             once, O(count). The survivors are copied to the spare arrays which are swapped in.
+ *
+ * @param      pf    The filter
+ */
+static void particle_filter_resample(particle_filter_t *pf)
+{
+    const int count = pf->count;
+    const float step = 1.0f / count;
+    float u = particle_filter_uniform(pf) * step;
+    float cumulative = pf->w[0];
+    float *swap;
+    int i = 0, n;
+
+    for (n = 0; n < count; n++)
+    {
+        while (u > cumulative && i < count - 1)
+        {
+            i++;
+            cumulative += pf->w[i];
+        }
+        pf->x_next[n] = pf->x[i];
+        pf->y_next[n] = pf->y[i];
+        pf->c_next[n] = pf->c[i];
+        pf->s_next[n] = pf->s[i];
+        u += step;
+    }
+
+    swap = pf->x, pf->x = pf->x_next, pf->x_next = swap;
+    swap = pf->y, pf->y = pf->y_next, pf->y_next = swap;
+    swap = pf->c, pf->c = pf->c_next, pf->c_next = swap;
+    swap = pf->s, pf->s = pf->s_next, pf->s_next = swap;
+    for (n = 0; n < count; n++)
+        pf->w[n] = step;
+}
+
+static void particle_filter_update(particle_filter_t *pf)
+{
+    if (particle_filter_normalize(pf) < PF_RESAMPLE_RATIO * pf->count)
+        particle_filter_resample(pf);
+}
+
+/**
+ * @brief      Monte Carlo localization step: encoder prediction, then gps and proximity weighting
+ *
+ * @param      pf           The filter
+ * @param      state_pf     The estimated pose
+ * @param[in]  gps_pose     The gps pose, read only when gps_updated is set
+ * @param[in]  gps_updated  Whether a gps fix arrived this step
+ * @param[in]  proximity    The raw values of ps0 to ps7, NULL when they were not read this step
+ * @param[in]  Aleft_enc    The left encoder increment
+ * @param[in]  Aright_enc   The right encoder increment
+ */
+void particle_filter_compute_pose(particle_filter_t *pf, pose_t *state_pf, const pose_t *gps_pose, bool gps_updated, const int *proximity, double Aleft_enc, double Aright_enc)
+{
+    bool weighted = false;
+
+    Aleft_enc *= WHEEL_RADIUS;
+    Aright_enc *= WHEEL_RADIUS;
+    particle_filter_predict(pf, Aleft_enc, Aright_enc);
+
+    if (gps_updated)
+    {
+        particle_filter_weight_gps(pf, gps_pose);
+        weighted = true;
+    }
+    if (proximity != NULL && particle_filter_weight_proximity(pf, proximity))
+        weighted = true;
+    if (weighted)
+        particle_filter_update(pf);
+
+    particle_filter_estimate(pf, state_pf);
+}
+
+/**
+ * @brief      Weight the current particles by a gps fix received after its step
+ *
+ * @param      pf        The filter
+ * @param      state_pf  The estimated pose
+ * @param[in]  gps_pose  The gps pose
+ */
+void particle_filter_fuse_gps(particle_filter_t *pf, pose_t *state_pf, const pose_t *gps_pose)
+{
+    particle_filter_weight_gps(pf, gps_pose);
+    particle_filter_update(pf);
+    particle_filter_estimate(pf, state_pf);
+}
+
+void particle_filter_reset(particle_filter_t *pf, const pose_t *pose_origin)
+{
+    const unsigned int offset = particle_filter_random(pf);
+    const float *noise = pf->noise;
+    int n;
+
+    memset(pf->block, 0, 9 * pf->capacity * sizeof(float));
+    for (n = 0; n < pf->count; n++)
+    {
+        float heading = pose_origin->heading + PF_INIT_SPREAD_HEADING * noise[(offset + 3 * n) % PF_NOISE_SIZE];
+
+        pf->x[n] = pose_origin->x + PF_INIT_SPREAD_XY * noise[(offset + 3 * n + 1) % PF_NOISE_SIZE];
+        pf->y[n] = pose_origin->y + PF_INIT_SPREAD_XY * noise[(offset + 3 * n + 2) % PF_NOISE_SIZE];
+        pf->c[n] = cosf(heading);
+        pf->s[n] = sinf(heading);
+        pf->w[n] = 1.0f / pf->count;
+    }
+}
+
+particle_filter_t *particle_filter_create(int particle_count)
+{
+    particle_filter_t *pf = (particle_filter_t *)calloc(1, sizeof(particle_filter_t));
+    int cap = (particle_count + PF_LANES - 1) / PF_LANES * PF_LANES;
+    int n;
+
+    if (pf == NULL)
+    {
+        printf("particle filter create fail!\n");
+        return NULL;
+    }
+    pf->count = particle_count;
+    pf->capacity = cap;
+    pf->random = 2463534242u;
+    pf->field_nx = (int)(PF_MAP_WIDTH / PF_MAP_RESOLUTION + 0.5);
+    pf->field_ny = (int)(PF_MAP_HEIGHT / PF_MAP_RESOLUTION + 0.5);
+
+    pf->block = (float *)calloc(9 * cap, sizeof(float));
+    pf->noise = (float *)malloc((PF_NOISE_SIZE + cap) * sizeof(float));
+    pf->field = (float *)malloc(pf->field_nx * pf->field_ny * sizeof(float));
+    if (pf->block == NULL || pf->noise == NULL || pf->field == NULL)
+    {
+        printf("particle filter create fail!\n");
+        particle_filter_destroy(pf);
+        return NULL;
+    }
+    pf->x = pf->block + 0 * cap;
+    pf->y = pf->block + 1 * cap;
+    pf->c = pf->block + 2 * cap;
+    pf->s = pf->block + 3 * cap;
+    pf->w = pf->block + 4 * cap;
+    pf->x_next = pf->block + 5 * cap;
+    pf->y_next = pf->block + 6 * cap;
+    pf->c_next = pf->block + 7 * cap;
+    pf->s_next = pf->block + 8 * cap;
+
+    // Box-Muller, the tail repeats the head so any offset below PF_NOISE_SIZE reads capacity samples
+    for (n = 0; n < PF_NOISE_SIZE; n += 2)
+    {
+        float radius = sqrtf(-2.0f * logf(particle_filter_uniform(pf)));
+        float angle = 2.0f * (float)M_PI * particle_filter_uniform(pf);
+
+        pf->noise[n] = radius * cosf(angle);
+        pf->noise[n + 1] = radius * sinf(angle);
+    }
+    for (n = 0; n < cap; n++)
+        pf->noise[PF_NOISE_SIZE + n] = pf->noise[n % PF_NOISE_SIZE];
+
+    particle_filter_build_field(pf);
+    return pf;
+}
+
+void particle_filter_destroy(particle_filter_t *pf)
+{
+    if (pf == NULL)
+        return;
+    free(pf->block);
+    free(pf->noise);
+    free(pf->field);
+    free(pf);
+}
+
+int particle_filter_lanes()
+{
+    return PF_LANES;
+}
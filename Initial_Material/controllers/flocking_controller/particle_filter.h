@@ -0,0 +1,20 @@
+#ifndef PARTICLE_FILTER_H
+#define PARTICLE_FILTER_H
+
+#include "odometry.h"
+#include <stdbool.h>
+
+#define PF_NB_SENSORS 8 // Proximity sensors of the e-puck, ps0 to ps7
+
+// Opaque Monte Carlo localization context: particles in structure-of-arrays layout and
+// the likelihood field of the obstacles.wbt map, one per tracked robot
+typedef struct particle_filter particle_filter_t;
+
+particle_filter_t *particle_filter_create(int particle_count);
+void particle_filter_destroy(particle_filter_t *pf);
+void particle_filter_reset(particle_filter_t *pf, const pose_t *pose_origin);
+void particle_filter_compute_pose(particle_filter_t *pf, pose_t *state_pf, const pose_t *gps_pose, bool gps_updated, const int *proximity, double Aleft_enc, double Aright_enc);
+void particle_filter_fuse_gps(particle_filter_t *pf, pose_t *state_pf, const pose_t *gps_pose);
+int particle_filter_lanes();
+
+#endif
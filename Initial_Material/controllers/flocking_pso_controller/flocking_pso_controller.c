@@ -21,6 +21,10 @@
 #include <webots/emitter.h>
 #include <webots/receiver.h>
 
+#include "params.h"
+#include "neighbour_table.h"
+#include "ping_packet.h"
+
 #define NB_SENSORS 8  // Number of distance sensors
 #define MIN_SENS 350  // Minimum sensibility value
 #define MAX_SENS 4096 // Maximum sensibility value
@@ -28,13 +32,12 @@
 /*Webots 2018b*/
 #define MAX_SPEED_WEB 6.28 // Maximum speed webots
 /*Webots 2018b*/
-#define FLOCK_SIZE 5 // Size of flock
-#define TIME_STEP 64 // [ms] Length of time step
+#define FLOCK_SIZE PARAMS_MAX_FLOCK_SIZE // Capacity of the flock tables, params.flock_size robots are used
 
 #define AXLE_LENGTH 0.052		// Distance between wheels of robot (meters)
 #define SPEED_UNIT_RADS 0.00628 // Conversion factor from speed unit to radian per second
 #define WHEEL_RADIUS 0.0205		// Wheel radius (meters)
-#define DELTA_T 0.064			// Timestep (seconds)
+#define DELTA_T (params.time_step / 1000.0) // Timestep (seconds)
 
 //#define RULE1_THRESHOLD 0.20	// Threshold to activate aggregation rule. d//efault 0.20
 //#define RULE1_WEIGHT (0.6 / 10) // Weight of aggregation rule. default 0.6/10
@@ -50,7 +53,7 @@
 
 #define ABS(x) ((x >= 0) ? (x) : -(x))
 
-#define DATASIZE 5
+#define DATASIZE 4 // Weightings in a particle of flock_pso_super, see pso.h: rule1, rule2, rule2_thres, k
 
 /*Webots 2018b*/
 WbDeviceTag left_motor;	 //handler for left wheel of the robot
@@ -65,27 +68,29 @@ WbDeviceTag emitter_infrared;  // Handle for the emitter node
 WbDeviceTag receiver_radio;	   // Handle for the emitter node
 WbDeviceTag receiver_loc;
 
-int robot_id_u, robot_id; // Unique and normalized (between 0 and FLOCK_SIZE-1) robot ID
+int robot_id_u, robot_id; // Unique and normalized (between 0 and params.flock_size-1) robot ID
 
-float relative_pos[FLOCK_SIZE][3];		// relative X, Z, Theta of all robots
-float prev_relative_pos[FLOCK_SIZE][3]; // Previous relative  X, Z, Theta values
 float my_position[3];					// X, Z, Theta of the current robot
 float prev_my_position[3];				// X, Z, Theta of the current robot in the previous time step
+float my_velocity[2];					// X, Z speed of the current robot over the last time step
 float speed[FLOCK_SIZE][2];				// Speeds calculated with Reynold's rules
-float relative_speed[FLOCK_SIZE][2];	// Speeds calculated with Reynold's rules
 int initialized[FLOCK_SIZE];			// != 0 if initial positions have been received
-float migr[2] = {3, 0};					// Migration vector
 char *robot_name;
 float initial_position[3];
 int msl, msr; // Wheel speeds
 float theta_robots[FLOCK_SIZE];
 
-// Define the threshold and the weighting
+neighbour_table_t neighbours; // Flockmates heard on the infrared ping, by robot id
+int ping_sequence;			  // Pings sent so far
+
+// Define the threshold and the weighting, overwritten by the weightings of the supervisor.
+// The migration vector and the time step are read from the experiment parameters, see params_schema.h
 float rule1_weight = 0.06;
 float rule2_thres = 0.15;
 float rule2_weight = 0.002;
 float rule3_weight = 0.1;
 float migration_weight = 0.01;
+int topological_k = 0; // Flockmates the rules use, the k nearest, 0 for every flockmate in range
 
 int loop_num = 1000;
 
@@ -95,6 +100,7 @@ int loop_num = 1000;
 static void reset()
 {
 	wb_robot_init();
+	params_init(&params);
 	receiver_infrared = wb_robot_get_device("receiver_infrared");
 	receiver_radio = wb_robot_get_device("receiver_radio");
 	emitter_infrared = wb_robot_get_device("emitter_infrared");
@@ -116,39 +122,35 @@ static void reset()
 	robot_name = (char *)wb_robot_get_name();
 
 	for (i = 0; i < NB_SENSORS; i++)
-		wb_distance_sensor_enable(ds[i], 64);
+		wb_distance_sensor_enable(ds[i], params.time_step);
 
-	wb_receiver_enable(receiver_infrared, 1);
-	wb_receiver_enable(receiver_radio, 1);
-	wb_receiver_enable(receiver_loc, 5);
+	// Every device is read once per control step, sampling it faster only costs simulation time
+	wb_receiver_enable(receiver_infrared, params.time_step);
+	wb_receiver_enable(receiver_radio, params.time_step);
+	wb_receiver_enable(receiver_loc, params.time_step);
 
 	//Reading the robot's name. Pay attention to name specification when adding robots to the simulation!
 	sscanf(robot_name, "epuck%d", &robot_id_u); // read robot id from the robot's name
-	robot_id = robot_id_u % FLOCK_SIZE;			// normalize between 0 and FLOCK_SIZE-1
+	robot_id = robot_id_u % params.flock_size;	// normalize between 0 and params.flock_size-1
 
-	for (i = 0; i < FLOCK_SIZE; i++)
+	for (i = 0; i < params.flock_size; i++)
 	{
 		initialized[i] = 0; // Set initialization to 0 (= not yet initialized)
 	}
+	neighbour_table_reset(&neighbours);
 
-	// hard-code the initial state of robot [0]: x [1]: y [2]:theta
-	initial_position[0] = -2.9;
+	// initial state of robot [0]: x [1]: y [2]:theta, from the start pose of the localization
+	initial_position[0] = params.origin_x;
+	initial_position[1] = -params.origin_y[robot_id];
 	initial_position[2] = 0;
-	if (robot_id == 0)
-		initial_position[1] = 0.0;
-	if (robot_id == 1)
-		initial_position[1] = 0.1;
-	if (robot_id == 2)
-		initial_position[1] = -0.1;
-	if (robot_id == 3)
-		initial_position[1] = 0.2;
-	if (robot_id == 4)
-		initial_position[1] = -0.2;
 
 	for (i = 0; i < 3; i++)
 	{
 		my_position[i] = initial_position[i];
 	}
+	my_velocity[0] = 0;
+	my_velocity[1] = 0;
+	ping_sequence = 0;
 	msl = 0;
 	msr = 0;
 	wb_receiver_disable(receiver_infrared);
@@ -232,29 +234,47 @@ void compute_wheel_speeds(int *msl, int *msr)
  */
 void reynolds_rules()
 {
-	int i, j, k;					 // Loop counters
+	int i, j;						   // Loop counters
+	int nearest[NEIGHBOUR_TABLE_SIZE]; // Items of the neighbour table used by the rules
+	int count;						   // Number of neighbours used
 	float rel_avg_loc[2] = {0, 0};	 // Flock average positions
 	float rel_avg_speed[2] = {0, 0}; // Flock average speeds
 	float cohesion[2] = {0, 0};
 	float dispersion[2] = {0, 0};
 	float consistency[2] = {0, 0};
 
-	/* Compute averages over the whole flock */
-	for (i = 0; i < FLOCK_SIZE; i++)
+	/* Metric mode: every live neighbour, a robot out of range no longer counts.
+	   Topological mode: only the k nearest of them, whatever the density of the flock */
+	count = neighbour_table_nearest(&neighbours, topological_k > 0 ? topological_k : neighbours.count, nearest);
+
+	/* Compute averages over the selected neighbours */
+	/* Rule 2 - Dispersion/Separation: keep far enough from flockmates, in the same pass */
+	for (i = 0; i < count; i++)
 	{
-		if (i == robot_id)
-			continue;
+		const neighbour_t *neighbour = &neighbours.items[nearest[i]];
+		const float *relative_pos = neighbour->relative_pos;
 		for (j = 0; j < 2; j++)
 		{
-			rel_avg_speed[j] += relative_speed[i][j];
-			rel_avg_loc[j] += relative_pos[i][j];
+			rel_avg_speed[j] += neighbour->relative_speed[j];
+			rel_avg_loc[j] += relative_pos[j];
+		}
+		//printf("relative position of robot [%d] is: [1]%f, [2]%f \n", neighbour->id, relative_pos[0], relative_pos[1]);
+		// If neighbor i is too close (Euclidean distance)
+		if (pow(relative_pos[0], 2) + pow(relative_pos[1], 2) < rule2_thres)
+		{
+			for (j = 0; j < 2; j++)
+			{
+				dispersion[j] -= 1 / relative_pos[j]; // Relative distance to i
+			}
 		}
-		//printf("relative position of robot [%d] is: [1]%f, [2]%f \n", i, relative_pos[i][0], relative_pos[i][1]);
 	}
-	for (j = 0; j < 2; j++)
+	if (count > 0)
 	{
-		rel_avg_speed[j] /= FLOCK_SIZE - 1;
-		rel_avg_loc[j] /= FLOCK_SIZE - 1;
+		for (j = 0; j < 2; j++)
+		{
+			rel_avg_speed[j] /= count;
+			rel_avg_loc[j] /= count;
+		}
 	}
 
 	/* Rule 1 - Aggregation/Cohesion: move towards the center of mass */
@@ -264,27 +284,10 @@ void reynolds_rules()
 		cohesion[j] = rel_avg_loc[j];
 	}
 
-	/* Rule 2 - Dispersion/Separation: keep far enough from flockmates */
-	for (k = 0; k < FLOCK_SIZE; k++)
-	{
-		if (k != robot_id)
-		{ // Loop on flockmates only
-			// If neighbor k is too close (Euclidean distance)
-			if (pow(relative_pos[k][0], 2) + pow(relative_pos[k][1], 2) < rule2_thres)
-			{
-				for (j = 0; j < 2; j++)
-				{
-					dispersion[j] -= 1 / relative_pos[k][j]; // Relative distance to k
-				}
-			}
-		}
-	}
-
 	/* Rule 3 - Consistency/Alignment: match the speeds of flockmates */
 	for (j = 0; j < 2; j++)
 	{
-		//consistency[j] = rel_avg_speed[j];
-		consistency[j] = 0;
+		consistency[j] = rel_avg_speed[j];
 	}
 
 	//aggregation of all behaviors with relative influence determined by weights
@@ -308,11 +311,11 @@ void reynolds_rules()
 	}
 	else
 	{
-		speed[robot_id][0] += (migr[0] - my_position[0]) * migration_weight;
+		speed[robot_id][0] += (params.migr[0] - my_position[0]) * migration_weight;
 		//y axis of webots is inverted
-		speed[robot_id][1] -= (migr[1] - my_position[1]) * migration_weight;
+		speed[robot_id][1] -= (params.migr[1] - my_position[1]) * migration_weight;
 		// if (robot_id == 0)
-		// 	printf("migration is %f, %f\n", migr[0] - my_position[0], migr[1] - my_position[1]);
+		// 	printf("migration is %f, %f\n", params.migr[0] - my_position[0], params.migr[1] - my_position[1]);
 		// if (robot_id == 0)
 		// 	printf("my position is %f, %f, %f\n", my_position[0], my_position[1], my_position[2]);
 	}
@@ -320,14 +323,15 @@ void reynolds_rules()
 
 /*
  *  each robot sends a ping message, so the other robots can measure relative range and bearing to the sender.
- *  the message contains the robot's name
+ *  the message is a ping_packet_t with the robot's id, its pose and velocity
  *  the range and bearing will be measured directly out of message RSSI and direction
 */
 void send_ping(void)
 {
-	char out[10];
-	strcpy(out, robot_name); // in the ping message we send the name of the robot.
-	wb_emitter_send(emitter_infrared, out, strlen(out) + 1);
+	ping_packet_t packet;
+	// The pose comes from the supervisor, it has no covariance
+	ping_packet_encode(&packet, params.flock_id, robot_id_u, ping_sequence++, my_position, my_velocity, NULL);
+	wb_emitter_send(emitter_infrared, &packet, sizeof(packet));
 }
 
 void process_localization_messages(void)
@@ -336,7 +340,7 @@ void process_localization_messages(void)
 	int count = 0;
 	int rob_nb;
 	float rob_x, rob_z, rob_theta;
-	while (wb_receiver_get_queue_length(receiver_loc) > 0 && count < FLOCK_SIZE)
+	while (wb_receiver_get_queue_length(receiver_loc) > 0 && count < params.flock_size)
 	{
 		inbuffer = (char *)wb_receiver_get_data(receiver_loc);
 		sscanf(inbuffer, "%d#%f#%f#%f", &rob_nb, &rob_x, &rob_z, &rob_theta);
@@ -355,6 +359,7 @@ void process_localization_messages(void)
 /*
  * processing all the received ping messages, and calculate range and bearing to the other robots
  * the range and bearing are measured directly out of message RSSI and direction
+ * the flockmates not heard for params.neighbour_timeout are then dropped from the neighbour table
 */
 void process_received_ping_messages(void)
 {
@@ -362,11 +367,12 @@ void process_received_ping_messages(void)
 	double message_rssi; // Received Signal Strength indicator
 	double theta;
 	double range;
-	char *inbuffer; // Buffer for the receiver node
-	int other_robot_id;
+	const ping_packet_t *packet; // The ping, read in place from the receiver buffer
+	float relative_pos[2];
+	double time_now_s = wb_robot_get_time();
 	while (wb_receiver_get_queue_length(receiver_infrared) > 0)
 	{
-		inbuffer = (char *)wb_receiver_get_data(receiver_infrared);
+		packet = ping_packet_cast(wb_receiver_get_data(receiver_infrared), wb_receiver_get_data_size(receiver_infrared), params.flock_id);
 		message_direction = wb_receiver_get_emitter_direction(receiver_infrared);
 		message_rssi = wb_receiver_get_signal_strength(receiver_infrared);
 		double y = message_direction[2];
@@ -376,33 +382,21 @@ void process_received_ping_messages(void)
 		theta = theta + my_position[2]; // find the relative theta;
 		range = sqrt((1 / message_rssi));
 
-		other_robot_id = (int)(inbuffer[5] - '0'); // since the name of the sender is in the received message. Note: this does not work for robots having id bigger than 9!
-		//printf("robot_id is: %d, other_robot_id is: %d", robot_id, other_robot_id);
 		//printf("message_direction is: [0]%f, [1]%f, [2]%f\n", message_direction[0], message_direction[1], message_direction[2]);
-		// Get position update
-
-		// if (robot_id == 0)
-		// {
-		// 	printf("Robot id is: %d, range is: %f\n", other_robot_id, range);
-		// }
-		prev_relative_pos[other_robot_id][0] = relative_pos[other_robot_id][0];
-		prev_relative_pos[other_robot_id][1] = relative_pos[other_robot_id][1];
-
-		relative_pos[other_robot_id][0] = range * cos(theta);		 // relative x pos
-		relative_pos[other_robot_id][1] = -1.0 * range * sin(theta); // relative y pos
-
-		// if (robot_id == 2)
-		// {
-		// printf("relative_pos of robot %d is %f, %f\n", other_robot_id, relative_pos[other_robot_id][0], relative_pos[other_robot_id][0]);
-		// }
-
-		//printf("Robot %s, from robot %d, x: %g, y: %g, theta %g, my theta %g\n",robot_name,other_robot_id,relative_pos[other_robot_id][0],relative_pos[other_robot_id][1],-atan2(y,x)*180.0/3.141592,my_position[2]*180.0/3.141592);
-
-		relative_speed[other_robot_id][0] = relative_speed[other_robot_id][0] * 0.0 + 1.0 * (1 / DELTA_T) * (relative_pos[other_robot_id][0] - prev_relative_pos[other_robot_id][0]);
-		relative_speed[other_robot_id][1] = relative_speed[other_robot_id][1] * 0.0 + 1.0 * (1 / DELTA_T) * (relative_pos[other_robot_id][1] - prev_relative_pos[other_robot_id][1]);
+		if (packet != NULL && packet->robot_id != robot_id_u)
+		{
+			// Get position update
+			relative_pos[0] = range * cos(theta);		 // relative x pos
+			relative_pos[1] = -1.0 * range * sin(theta); // relative y pos
+			neighbour_table_observe(&neighbours, packet->robot_id, time_now_s, relative_pos, params.tracker_alpha, params.tracker_beta);
+			//printf("Robot %s, from robot %d, x: %g, y: %g, theta %g, my theta %g\n",robot_name,packet->robot_id,relative_pos[0],relative_pos[1],-atan2(y,x)*180.0/3.141592,my_position[2]*180.0/3.141592);
+		}
 
 		wb_receiver_next_packet(receiver_infrared);
 	}
+	neighbour_table_expire(&neighbours, time_now_s, params.neighbour_timeout);
+	// The neighbours not heard this step move on at their tracked speed
+	neighbour_table_predict(&neighbours, time_now_s);
 }
 
 void process_received_weightings_from_supervisor()
@@ -417,20 +411,12 @@ void process_received_weightings_from_supervisor()
 		rbuffer = (double *)wb_receiver_get_data(receiver_radio);
 		printf("Robot id: %d, Received weightings from supervisor and reset the postion for the motor\n", robot_id);
 		int i, j;
-		for (i = 0; i < FLOCK_SIZE; i++)
-		{
-			for (j = 0; j < 3; j++)
-			{
-				prev_relative_pos[i][j] = 0.0;
-				relative_pos[i][j] = 0.0;
-			}
-		}
+		neighbour_table_reset(&neighbours); // The flock is moved back to its start, forget the old positions
 		for (i = 0; i < 3; i++)
 		{
 			for (j = 0; j < 2; j++)
 			{
 				speed[i][j] = 0.0;
-				relative_speed[i][j] = 0.0;
 			}
 			prev_my_position[i] = 0.0;
 			my_position[i] = initial_position[i];
@@ -441,8 +427,10 @@ void process_received_weightings_from_supervisor()
 		//rule3_weight = rbuffer[2] / 10;
 		//migration_weight = rbuffer[2] / 100;
 		rule2_thres = rbuffer[2];
-		loop_num = rbuffer[3];
-		printf("weight: rule1 %f, rule2 %f, rule3 %f, migration %f, rule2_thres %f\n", rule1_weight, rule2_weight, rule3_weight, migration_weight, rule2_thres);
+		// From 1 to every other robot of the flock, the particle starts in [0, 1] but may leave it
+		topological_k = 1 + (int)lround(fmin(fmax(rbuffer[3], 0.0), 1.0) * (params.flock_size - 2));
+		loop_num = rbuffer[DATASIZE];
+		printf("weight: rule1 %f, rule2 %f, rule3 %f, migration %f, rule2_thres %f, k %d\n", rule1_weight, rule2_weight, rule3_weight, migration_weight, rule2_thres, topological_k);
 		wb_receiver_next_packet(receiver_radio);
 	}
 }
@@ -466,10 +454,12 @@ int main()
 		{
 			wb_motor_set_velocity(left_motor, 0);
 			wb_motor_set_velocity(right_motor, 0);
-			wb_robot_step(TIME_STEP);
+			wb_robot_step(params.time_step);
 		}
 		process_received_weightings_from_supervisor();
-		wb_receiver_enable(receiver_infrared, 1);
+		// Disabled by reset, the pings sent before the first weightings are not queued
+		if (wb_receiver_get_sampling_period(receiver_infrared) == 0)
+			wb_receiver_enable(receiver_infrared, params.time_step);
 
 		/* Braitenberg */
 		for (t = 0; t < loop_num; t++)
@@ -509,8 +499,10 @@ int main()
 
 			process_localization_messages();
 
-			speed[robot_id][0] = (1 / DELTA_T) * (my_position[0] - prev_my_position[0]);
-			speed[robot_id][1] = (1 / DELTA_T) * (my_position[1] - prev_my_position[1]);
+			my_velocity[0] = (1 / DELTA_T) * (my_position[0] - prev_my_position[0]);
+			my_velocity[1] = (1 / DELTA_T) * (my_position[1] - prev_my_position[1]);
+			speed[robot_id][0] = my_velocity[0];
+			speed[robot_id][1] = my_velocity[1];
 
 			// Reynold's rules with all previous info (updates the speed[][] table)
 			reynolds_rules();
@@ -538,7 +530,7 @@ int main()
 			//printf("msl_w is: %f, msr_w is: %f\n", msl_w, msr_w);
 
 			// Continue one step
-			wb_robot_step(TIME_STEP);
+			wb_robot_step(params.time_step);
 		}
 	}
 }
\ No newline at end of file
@@ -0,0 +1,276 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "neighbour_table.h"
+
+#define NEIGHBOUR_INDEX_MASK (NEIGHBOUR_INDEX_SIZE - 1)
+
+/**
+ * @brief      First slot of the index probed for an id, Fibonacci hashing
+ */
+static int neighbour_table_home(int id)
+{
+    return ((unsigned int)id * 2654435761u) & NEIGHBOUR_INDEX_MASK;
+}
+
+/**
+ * @brief      Slot of the index holding an id, or the free slot ending its probe sequence
+ *
+ *             The index always has free slots, NEIGHBOUR_INDEX_SIZE > NEIGHBOUR_TABLE_SIZE.
+ */
+static int neighbour_table_slot(const neighbour_table_t *table, int id)
+{
+    int slot = neighbour_table_home(id);
+
+    while (table->index[slot] != 0 && table->items[table->index[slot] - 1].id != id)
+        slot = (slot + 1) & NEIGHBOUR_INDEX_MASK;
+    return slot;
+}
+
+/**
+ * @brief      Remove an item, the last item takes its place
+ *
+ *             The index slot is freed by backward shift: the following entries of the probe
+ *             run move up unless their home lies after the hole, so no tombstone is left and
+ *             the lookups stay short after many expiries.
+ *
+ * @param      table  The table
+ * @param[in]  item   The item to remove
+ */
+static void neighbour_table_remove(neighbour_table_t *table, int item)
+{
+    int hole = neighbour_table_slot(table, table->items[item].id);
+    int slot = hole, home, last;
+
+    for (;;)
+    {
+        slot = (slot + 1) & NEIGHBOUR_INDEX_MASK;
+        if (table->index[slot] == 0)
+            break;
+        home = neighbour_table_home(table->items[table->index[slot] - 1].id);
+        // Stays if its home is cyclically in (hole, slot]
+        if (((slot - home) & NEIGHBOUR_INDEX_MASK) < ((slot - hole) & NEIGHBOUR_INDEX_MASK))
+            continue;
+        table->index[hole] = table->index[slot];
+        hole = slot;
+    }
+    table->index[hole] = 0;
+
+    last = table->count - 1;
+    if (item != last)
+    {
+        table->items[item] = table->items[last];
+        table->index[neighbour_table_slot(table, table->items[item].id)] = item + 1;
+    }
+    table->count--;
+}
+
+/**
+ * @brief      Forget every neighbour
+ *
+ * @param      table  The table
+ */
+void neighbour_table_reset(neighbour_table_t *table)
+{
+    memset(table->index, 0, sizeof(table->index));
+    table->count = 0;
+}
+
+/**
+ * @brief      Look up a neighbour by robot id
+ *
+ * @param      table  The table
+ * @param[in]  id     The robot id
+ *
+ * @return     The neighbour, NULL if it is not in the table
+ */
+neighbour_t *neighbour_table_find(neighbour_table_t *table, int id)
+{
+    int slot = neighbour_table_slot(table, id);
+
+    if (table->index[slot] == 0)
+        return NULL;
+    return &table->items[table->index[slot] - 1];
+}
+
+/**
+ * @brief      Advance the state of a neighbour to a time at constant relative speed
+ */
+static void neighbour_table_advance(neighbour_t *neighbour, double time)
+{
+    float dt = time - neighbour->time;
+    int j;
+
+    if (dt <= 0.0f)
+        return;
+    for (j = 0; j < 2; j++)
+        neighbour->relative_pos[j] += neighbour->relative_speed[j] * dt;
+    neighbour->time = time;
+}
+
+/**
+ * @brief      Record a ping of a neighbour, adding it if it is new
+ *
+ *             Each neighbour has an alpha-beta tracker of its relative position and speed: the
+ *             state is advanced to the ping at constant speed, then corrected by alpha times the
+ *             innovation for the position and beta / dt times it for the speed. Unlike the
+ *             difference of two pings the speed is not blown up by the range noise, and a missed
+ *             ping only lengthens dt. A new neighbour starts at rest at the measured position.
+ *
+ * @param      table         The table
+ * @param[in]  id            The robot id of the sender
+ * @param[in]  time          The time of the ping, in seconds
+ * @param[in]  relative_pos  The measured relative position of the sender {x, z}
+ * @param[in]  alpha         The position gain, in [0, 1], 1 trusts the ping alone
+ * @param[in]  beta          The speed gain, in [0, 2], stable for beta < 4 - 2 alpha
+ *
+ * @return     The neighbour, NULL if the table is full and the ping was dropped
+ */
+neighbour_t *neighbour_table_observe(neighbour_table_t *table, int id, double time, const float relative_pos[2], float alpha, float beta)
+{
+    int slot = neighbour_table_slot(table, id);
+    neighbour_t *neighbour;
+    float dt, innovation;
+    int j;
+
+    if (table->index[slot] == 0)
+    {
+        if (table->count == NEIGHBOUR_TABLE_SIZE)
+        {
+            printf("neighbour table full, ping of robot %d dropped!\n", id);
+            return NULL;
+        }
+        neighbour = &table->items[table->count++];
+        table->index[slot] = table->count;
+        neighbour->id = id;
+        neighbour->last_seen = time;
+        neighbour->time = time;
+        for (j = 0; j < 2; j++)
+        {
+            neighbour->relative_pos[j] = relative_pos[j];
+            neighbour->relative_speed[j] = 0.0;
+        }
+        return neighbour;
+    }
+
+    neighbour = &table->items[table->index[slot] - 1];
+    // From the last ping, not the last prediction, so the speed gain spans the whole gap
+    dt = time - neighbour->last_seen;
+    neighbour_table_advance(neighbour, time);
+    for (j = 0; j < 2; j++)
+    {
+        innovation = relative_pos[j] - neighbour->relative_pos[j];
+        neighbour->relative_pos[j] += alpha * innovation;
+        // A second ping within the same step only corrects the position
+        if (dt > 0.0f)
+            neighbour->relative_speed[j] += beta / dt * innovation;
+    }
+    neighbour->last_seen = time;
+    return neighbour;
+}
+
+/**
+ * @brief      Predict the neighbours not heard since their state time
+ *
+ *             Moves them at their tracked relative speed, so a missed ping leaves a neighbour
+ *             where it is expected rather than where it was last heard, until it expires.
+ *
+ * @param      table  The table
+ * @param[in]  time   The current time, in seconds
+ */
+void neighbour_table_predict(neighbour_table_t *table, double time)
+{
+    int i;
+
+    for (i = 0; i < table->count; i++)
+        neighbour_table_advance(&table->items[i], time);
+}
+
+/**
+ * @brief      Remove the neighbours not heard for more than timeout
+ *
+ * @param      table    The table
+ * @param[in]  time     The current time, in seconds
+ * @param[in]  timeout  The time without a ping after which a neighbour is dropped, in seconds
+ *
+ * @return     The number of neighbours removed
+ */
+int neighbour_table_expire(neighbour_table_t *table, double time, double timeout)
+{
+    int i, expired = 0;
+
+    // Backwards, the item moved into a hole has already been checked
+    for (i = table->count - 1; i >= 0; i--)
+    {
+        if (time - table->items[i].last_seen > timeout)
+        {
+            neighbour_table_remove(table, i);
+            expired++;
+        }
+    }
+    return expired;
+}
+
+/**
+ * @brief      Select the k neighbours nearest to the robot
+ *
+ *             Quickselect on the squared distances, O(count) on average and nothing allocated.
+ *             The k nearest come first in no particular order. With k at least the number of
+ *             neighbours every neighbour is returned, in table order.
+ *
+ * @param      table    The table
+ * @param[in]  k        The number of neighbours wanted
+ * @param      nearest  The items of the nearest neighbours, room for table->count
+ *
+ * @return     The number of neighbours selected, min(k, table->count)
+ */
+int neighbour_table_nearest(neighbour_table_t *table, int k, int *nearest)
+{
+    int first = 0, last = table->count - 1, i, j, item;
+    float pivot, swap;
+
+    for (i = 0; i < table->count; i++)
+        nearest[i] = i;
+    if (k >= table->count)
+        return table->count;
+    if (k <= 0)
+        return 0;
+    for (i = 0; i < table->count; i++)
+    {
+        const float *pos = table->items[i].relative_pos;
+        table->dist2[i] = pos[0] * pos[0] + pos[1] * pos[1];
+    }
+
+    // Partition until the k-th nearest is in place, the nearer ones before it
+    while (first < last)
+    {
+        pivot = table->dist2[(first + last) / 2];
+        i = first;
+        j = last;
+        while (i <= j)
+        {
+            while (table->dist2[i] < pivot)
+                i++;
+            while (table->dist2[j] > pivot)
+                j--;
+            if (i <= j)
+            {
+                swap = table->dist2[i];
+                table->dist2[i] = table->dist2[j];
+                table->dist2[j] = swap;
+                item = nearest[i];
+                nearest[i] = nearest[j];
+                nearest[j] = item;
+                i++;
+                j--;
+            }
+        }
+        if (k - 1 <= j)
+            last = j;
+        else if (k - 1 >= i)
+            first = i;
+        else
+            break;
+    }
+    return k;
+}
@@ -0,0 +1,163 @@
+#include <string.h>
+#include <math.h>
+
+#include "ping_packet.h"
+
+/**
+ * @brief      Round a value to a signed 16 bit field, saturating
+ */
+static short ping_packet_quantize(float value, float scale)
+{
+    float q = roundf(value * scale);
+
+    if (!(q > -32767.0f))
+        return -32767;
+    if (q > 32767.0f)
+        return 32767;
+    return (short)q;
+}
+
+/**
+ * @brief      Round a value to an unsigned 16 bit field, saturating
+ */
+static unsigned short ping_packet_quantize_unsigned(float value, float scale)
+{
+    float q = roundf(value * scale);
+
+    if (!(q > 0.0f))
+        return 0;
+    if (q > 65535.0f)
+        return 65535;
+    return (unsigned short)q;
+}
+
+/**
+ * @brief      Fill a ping
+ *
+ * @param      packet    The ping
+ * @param[in]  flock_id  The flock of the sender
+ * @param[in]  robot_id  The unique robot id of the sender, below 65536
+ * @param[in]  sequence  The number of the ping, kept modulo 65536
+ * @param[in]  pose      The estimated pose {x, y, heading}, NULL if unknown
+ * @param[in]  velocity  The estimated velocity {x, y}, NULL if unknown
+ * @param[in]  cov       The covariance of the position {xx, xy, yy}, NULL if unknown
+ */
+void ping_packet_encode(ping_packet_t *packet, int flock_id, int robot_id, int sequence, const float pose[3], const float velocity[2], const float cov[3])
+{
+    float std[2], heading;
+    int j;
+
+    memset(packet, 0, sizeof(*packet));
+    packet->version = PING_PACKET_VERSION;
+    packet->flock_id = flock_id;
+    packet->robot_id = robot_id;
+    packet->sequence = sequence;
+    if (pose != NULL)
+    {
+        packet->flags |= PING_HAS_POSE;
+        for (j = 0; j < 2; j++)
+            packet->position[j] = ping_packet_quantize(pose[j], PING_POSITION_SCALE);
+        // Heading wrapped to [0, 2 pi), the last unit wraps to 0
+        heading = fmodf(pose[2], 6.2831853f);
+        if (heading < 0.0f)
+            heading += 6.2831853f;
+        packet->heading = (unsigned short)((long)roundf(heading * PING_HEADING_SCALE) & 0xFFFF);
+    }
+    if (velocity != NULL)
+    {
+        packet->flags |= PING_HAS_VELOCITY;
+        for (j = 0; j < 2; j++)
+            packet->velocity[j] = ping_packet_quantize(velocity[j], PING_VELOCITY_SCALE);
+    }
+    if (cov != NULL)
+    {
+        packet->flags |= PING_HAS_COVARIANCE;
+        std[0] = sqrtf(fmaxf(cov[0], 0.0f));
+        std[1] = sqrtf(fmaxf(cov[2], 0.0f));
+        for (j = 0; j < 2; j++)
+            packet->std[j] = ping_packet_quantize_unsigned(std[j], PING_STD_SCALE);
+        if (std[0] * std[1] > 0.0f)
+            packet->correlation = ping_packet_quantize(fminf(fmaxf(cov[1] / (std[0] * std[1]), -1.0f), 1.0f), PING_CORRELATION_SCALE);
+    }
+}
+
+/**
+ * @brief      Read a received ping in place
+ *
+ *             The receiver buffer is used as is, nothing is copied. The data of another
+ *             version, size or flock, an old name string for instance, is not a ping and is
+ *             dropped silently, as it may come on every step.
+ *
+ * @param[in]  data      The data of the packet, wb_receiver_get_data
+ * @param[in]  size      Its size, wb_receiver_get_data_size
+ * @param[in]  flock_id  The flock of the receiver
+ *
+ * @return     The ping, NULL if the packet is not a ping of this flock
+ */
+const ping_packet_t *ping_packet_cast(const void *data, int size, int flock_id)
+{
+    const ping_packet_t *packet = (const ping_packet_t *)data;
+
+    if (data == NULL || size != (int)sizeof(ping_packet_t))
+        return NULL;
+    if (packet->version != PING_PACKET_VERSION || packet->flock_id != flock_id)
+        return NULL;
+    return packet;
+}
+
+/**
+ * @brief      Pose of the sender
+ *
+ * @param[in]  packet  The ping
+ * @param      pose    The pose {x, y, heading}, heading in [0, 2 pi)
+ *
+ * @return     false if the sender did not know its pose
+ */
+bool ping_packet_get_pose(const ping_packet_t *packet, float pose[3])
+{
+    if (!(packet->flags & PING_HAS_POSE))
+        return false;
+    pose[0] = packet->position[0] / PING_POSITION_SCALE;
+    pose[1] = packet->position[1] / PING_POSITION_SCALE;
+    pose[2] = packet->heading / PING_HEADING_SCALE;
+    return true;
+}
+
+/**
+ * @brief      Velocity of the sender
+ *
+ * @param[in]  packet    The ping
+ * @param      velocity  The velocity {x, y}
+ *
+ * @return     false if the sender did not know its velocity
+ */
+bool ping_packet_get_velocity(const ping_packet_t *packet, float velocity[2])
+{
+    if (!(packet->flags & PING_HAS_VELOCITY))
+        return false;
+    velocity[0] = packet->velocity[0] / PING_VELOCITY_SCALE;
+    velocity[1] = packet->velocity[1] / PING_VELOCITY_SCALE;
+    return true;
+}
+
+/**
+ * @brief      Covariance of the position of the sender
+ *
+ * @param[in]  packet  The ping
+ * @param      cov     The covariance {xx, xy, yy}
+ *
+ * @return     false if the sender sent no covariance
+ */
+bool ping_packet_get_cov(const ping_packet_t *packet, float cov[3])
+{
+    float std[2];
+
+    if (!(packet->flags & PING_HAS_COVARIANCE))
+        return false;
+    std[0] = packet->std[0] / PING_STD_SCALE;
+    std[1] = packet->std[1] / PING_STD_SCALE;
+    cov[0] = std[0] * std[0];
+    cov[1] = packet->correlation / PING_CORRELATION_SCALE * std[0] * std[1];
+    cov[2] = std[1] * std[1];
+    return true;
+}
@@ -0,0 +1,44 @@
+#ifndef PING_PACKET_H
+#define PING_PACKET_H
+
+#include <stdbool.h>
+
+#define PING_PACKET_VERSION 1
+
+#define PING_POSITION_SCALE 1000.0f                // Position unit of 1 mm, +-32 m
+#define PING_VELOCITY_SCALE 1000.0f                // Velocity unit of 1 mm/s
+#define PING_HEADING_SCALE (65536.0f / 6.2831853f) // Heading unit of 2 pi / 65536 rad
+#define PING_STD_SCALE 10000.0f                    // Standard deviation unit of 0.1 mm, up to 6.5 m
+#define PING_CORRELATION_SCALE 32767.0f            // Correlation unit of 1 / 32767
+
+// Bits of ping_packet_t.flags
+#define PING_HAS_POSE 0x01       // position and heading are set
+#define PING_HAS_VELOCITY 0x02   // velocity is set
+#define PING_HAS_COVARIANCE 0x04 // std and correlation are set
+
+// Infrared ping of a robot to its flockmates, 24 bytes without padding, every field on its own
+// alignment so a receiver reads it in place from the receiver buffer. The range and bearing
+// come from the signal itself; the payload adds who sent it and what the sender believes.
+typedef struct
+{
+    unsigned char version;
+    unsigned char flags;
+    unsigned short flock_id;
+    unsigned short robot_id; // Unique robot id, the number in its name
+    unsigned short sequence; // Pings sent by the robot, wraps around
+    short position[2];       // x, z estimated by the sender
+    unsigned short heading;
+    short velocity[2];       // x, z speed estimated by the sender
+    unsigned short std[2];   // Standard deviation of the position along x and z
+    short correlation;       // Correlation of x and z, in [-1, 1]
+} ping_packet_t;
+
+_Static_assert(sizeof(ping_packet_t) == 24, "a ping is 24 bytes without padding on every robot");
+
+void ping_packet_encode(ping_packet_t *packet, int flock_id, int robot_id, int sequence, const float pose[3], const float velocity[2], const float cov[3]);
+const ping_packet_t *ping_packet_cast(const void *data, int size, int flock_id);
+bool ping_packet_get_pose(const ping_packet_t *packet, float pose[3]);
+bool ping_packet_get_velocity(const ping_packet_t *packet, float velocity[2]);
+bool ping_packet_get_cov(const ping_packet_t *packet, float cov[3]);
+
+#endif
@@ -8,17 +8,22 @@
 #include <webots/receiver.h>
 #include <webots/supervisor.h>
 
+#include "loc_packet.h"
+#include "params.h"
+#include "spatial_grid.h"
+
 //----------------------------------------------------------
 /*DEFINITION*/
 
-// #define FLOCK_SIZE 1 // Number of robots in flock for localization world
-#define FLOCK_SIZE 5 //Number of robots in flock for obstacle world
-#define TIME_STEP 64 // [ms] Length of time step
+#define FLOCK_SIZE PARAMS_MAX_FLOCK_SIZE // Capacity of the flock tables, params.flock_size robots are used
 
 #define MAX_SPEED_WEB 6.28 // Maximum speed webots
 #define MAX_SPEED 800	   // Maximum speed
 #define TARGET_FLOCKING_DISTANCE 0.14
 #define WHEEL_RADIUS 0.0205
+#define STATS_PERIOD 10.0 // Time between two prints of the per method error statistics (s)
+#define RECORD_TRUTH false // Record the true positions of the robots, for tools/odo_calibration
+#define TRUTH_FILE "localization_truth.txt"
 //----------------------------------------------------------
 /*GLOBAL VARIABLE*/
 WbNodeRef robs[FLOCK_SIZE];			  // Robots nodes
@@ -28,18 +33,34 @@ WbDeviceTag receiver;				  //Single recevier
 
 float loc[FLOCK_SIZE][3];			 // Location of everybody in the flock
 float estimated_pose[FLOCK_SIZE][2]; // Estimated position of each robot by using different localization method
+spatial_grid_t grid;				 // Robots of the flock sorted by position, for the pair terms of the fitness
+int close_robots[FLOCK_SIZE];		 // Result of the grid queries
 int offset;							 // Offset of robots number
 float migrx, migrz;					 // Migration vector
 float orient_migr;					 // Migration orientation
 int t;
 float prev_flocking_center[2];
 
+// Position error of one method over the run, Welford running mean and variance
+typedef struct
+{
+	long count;
+	double mean;
+	double m2;
+	double max;
+} loc_error_stats_t;
+
+loc_error_stats_t error_stats[LOC_METHOD_COUNT]; // Over all robots, filled by shadow mode packets
+static const char *method_names[LOC_METHOD_COUNT] = {"gps", "acc+encoder", "encoder", "kalman", "ekf"};
+FILE *truth_log; // "time robot x y" per robot and step, in the localization frame (y = -z)
+
 /*
  * Initialize flock position and devices
  */
 void reset(void)
 {
 	wb_robot_init();
+	params_init(&params);
 
 	receiver = wb_robot_get_device("receiver");
 	wb_receiver_enable(receiver, 1);
@@ -49,10 +70,10 @@ void reset(void)
 	if (receiver == 0)
 		printf("missing receiver\n");
 
-	char rob[7] = "epuck0";
+	char rob[16] = "epuck0";
 	int i;
 	// Load robot field for flocking
-	for (i = 0; i < FLOCK_SIZE; i++)
+	for (i = 0; i < params.flock_size; i++)
 	{
 		sprintf(rob, "epuck%d", i + offset);
 		robs[i] = wb_supervisor_node_get_from_def(rob);
@@ -71,7 +92,7 @@ void reset(void)
 void get_initial_flocking_center()
 {
 	int i;
-	for (i = 0; i < FLOCK_SIZE; i++)
+	for (i = 0; i < params.flock_size; i++)
 	{
 		loc[i][0] = wb_supervisor_field_get_sf_vec3f(robs_trans[i])[0];		  // X
 		loc[i][1] = wb_supervisor_field_get_sf_vec3f(robs_trans[i])[2];		  // Z
@@ -79,8 +100,8 @@ void get_initial_flocking_center()
 		prev_flocking_center[0] += loc[i][0];
 		prev_flocking_center[1] += loc[i][1];
 	}
-	prev_flocking_center[0] /= FLOCK_SIZE;
-	prev_flocking_center[1] /= FLOCK_SIZE;
+	prev_flocking_center[0] /= params.flock_size;
+	prev_flocking_center[1] /= params.flock_size;
 }
 /*
  * Compute localization metric
@@ -91,12 +112,55 @@ void compute_localization_fitness(float *fit_loc)
 	*fit_loc = 0;
 	int i;
 	// When calculated error between the estimated pose and the pose get from webot world, covert y axis
-	for (i = 0; i < FLOCK_SIZE; i++)
+	for (i = 0; i < params.flock_size; i++)
 	{
 		*fit_loc += sqrt((powf(loc[i][0] - estimated_pose[i][0], 2) + powf(-loc[i][1] - estimated_pose[i][1], 2)));
 	}
 }
 
+/*
+ * Add the error of each method reported in a shadow mode packet to the statistics
+ */
+void update_error_stats(const loc_packet_t *packet)
+{
+	int m;
+	double error, delta;
+	const float *truth = loc[packet->robot_id];
+
+	for (m = 0; m < LOC_METHOD_COUNT; m++)
+	{
+		if (!(packet->method_mask & (1 << m)))
+			continue;
+		// Same error as compute_localization_fitness, y of the localization frame is -z
+		error = sqrt(pow(truth[0] - packet->position[m][0], 2) + pow(-truth[1] - packet->position[m][1], 2));
+		error_stats[m].count++;
+		delta = error - error_stats[m].mean;
+		error_stats[m].mean += delta / error_stats[m].count;
+		error_stats[m].m2 += delta * (error - error_stats[m].mean);
+		if (error > error_stats[m].max)
+			error_stats[m].max = error;
+	}
+}
+
+/*
+ * Print the error of every method, the live comparison of a shadow mode run
+ */
+void print_error_stats(void)
+{
+	int m;
+
+	printf("localization error at %.1f s     mean      std      rms      max\n", wb_robot_get_time());
+	for (m = 0; m < LOC_METHOD_COUNT; m++)
+	{
+		const loc_error_stats_t *stats = &error_stats[m];
+		double variance = stats->count > 1 ? stats->m2 / (stats->count - 1) : 0.0;
+
+		if (stats->count == 0)
+			continue;
+		printf("  %-24s %8.4f %8.4f %8.4f %8.4f\n", method_names[m], stats->mean, sqrt(variance), sqrt(stats->mean * stats->mean + stats->m2 / stats->count), stats->max);
+	}
+}
+
 /*
  * Compute flocking performance metric.
  */
@@ -112,23 +176,32 @@ void compute_flocking_fitness(float *fit_flocking)
 	float fit_flocking_center_dist = 0.0;
 	float flocking_center[] = {0.0, 0.0};
 	float dist_diff;
-	float N_pairs = FLOCK_SIZE * (FLOCK_SIZE + 1) / 2;
+	float radius = params.fitness_radius > 0.0f ? params.fitness_radius : INFINITY;
+	float N_pairs = params.flock_size * (params.flock_size + 1) / 2;
 	float speed_max = MAX_SPEED_WEB * MAX_SPEED * WHEEL_RADIUS / 1000;
-	float Dmax = speed_max * TIME_STEP;
+	float Dmax = speed_max * params.time_step;
 	int i;
 	int j;
-	for (i = 0; i < FLOCK_SIZE; i++)
+	int k, n;
+	for (i = 0; i < params.flock_size; i++)
 	{
 		flocking_center[0] += loc[i][0];
 		flocking_center[1] += loc[i][1];
 	}
-	flocking_center[0] /= FLOCK_SIZE;
-	flocking_center[1] /= FLOCK_SIZE;
+	flocking_center[0] /= params.flock_size;
+	flocking_center[1] /= params.flock_size;
 
-	for (i = 0; i < FLOCK_SIZE; i++)
+	// Only the pairs within params.fitness_radius are scored, each robot queries the grid instead of
+	// the whole flock. Without a radius the grid is a single cell and every pair is scored.
+	spatial_grid_build(&grid, &loc[0][0], 3, params.flock_size, params.fitness_radius);
+	for (i = 0; i < params.flock_size; i++)
 	{
-		for (j = i + 1; j < FLOCK_SIZE; j++)
+		n = spatial_grid_radius(&grid, loc[i][0], loc[i][1], radius, close_robots, FLOCK_SIZE);
+		for (k = 0; k < n; k++)
 		{
+			j = close_robots[k];
+			if (j <= i)
+				continue;
 			// Distance measure for each pair of robots
 			dist_diff = fabs(sqrtf(powf(loc[i][0] - loc[j][0], 2) + powf(loc[i][1] - loc[j][1], 2)));
 			fit_inter_dist += fmin(dist_diff / TARGET_FLOCKING_DISTANCE, 1 / powf(1 - TARGET_FLOCKING_DISTANCE + dist_diff, 2));
@@ -141,7 +214,7 @@ void compute_flocking_fitness(float *fit_flocking)
 	}
 
 	fit_inter_dist /= N_pairs;
-	fit_flocking_center_dist /= FLOCK_SIZE;
+	fit_flocking_center_dist /= params.flock_size;
 	fit_dist = 1 / (1 + fit_flocking_center_dist) * fit_inter_dist;
 	fit_heading /= N_pairs;
 	fit_heading = 1 - fit_heading;
@@ -166,17 +239,47 @@ int main(int argc, char *args[])
 	float fit_flocking;
 	float fit_localization; //Performance metric for localization
 	bool recevied_loc_data = false;
+	bool received_packet = false;
+	double last_stats_time = 0.0;
+	loc_packet_t packet;
 	get_initial_flocking_center();
+	if (RECORD_TRUTH)
+	{
+		truth_log = fopen(TRUTH_FILE, "w");
+		if (truth_log == NULL)
+			printf("cannot open %s, the true positions are not recorded!\n", TRUTH_FILE);
+		else
+			fprintf(truth_log, "# time robot x y\n");
+	}
 	for (;;)
 	{
-		wb_robot_step(TIME_STEP);
+		wb_robot_step(params.time_step);
 
 		int count = 0;
-		while (wb_receiver_get_queue_length(receiver) > 0 && count < FLOCK_SIZE)
+		while (wb_receiver_get_queue_length(receiver) > 0 && count < params.flock_size)
 		{
 			recevied_loc_data = true;
 			inbuffer = (char *)wb_receiver_get_data(receiver);
-			sscanf(inbuffer, "%d#%f#%f", &robot_id, &rob_x, &rob_z);
+			if (wb_receiver_get_data_size(receiver) == sizeof(loc_packet_t))
+			{
+				// Shadow mode, every method of the robot, the one driving it goes to the fitness
+				memcpy(&packet, inbuffer, sizeof(packet));
+				if (packet.version != LOC_PACKET_VERSION || packet.robot_id >= params.flock_size || packet.driving_method >= LOC_METHOD_COUNT)
+				{
+					wb_receiver_next_packet(receiver);
+					continue;
+				}
+				robot_id = packet.robot_id;
+				rob_x = packet.position[packet.driving_method][0];
+				rob_z = packet.position[packet.driving_method][1];
+				// The packet was sent last step, loc still holds the true poses of that step
+				update_error_stats(&packet);
+				received_packet = true;
+			}
+			else
+			{
+				sscanf(inbuffer, "%d#%f#%f", &robot_id, &rob_x, &rob_z);
+			}
 			estimated_pose[robot_id][0] = rob_x;
 			estimated_pose[robot_id][1] = rob_z;
 			//printf("message receive: %s\n", inbuffer);
@@ -185,17 +288,27 @@ int main(int argc, char *args[])
 			//printf("Recevied message from robot %d: %s\n", robot_id, inbuffer);
 			wb_receiver_next_packet(receiver);
 		}
-		for (i = 0; i < FLOCK_SIZE; i++)
+		for (i = 0; i < params.flock_size; i++)
 		{
 			loc[i][0] = wb_supervisor_field_get_sf_vec3f(robs_trans[i])[0];		  // X
 			loc[i][1] = wb_supervisor_field_get_sf_vec3f(robs_trans[i])[2];		  // Z
 			loc[i][2] = wb_supervisor_field_get_sf_rotation(robs_rotation[i])[3]; // THETA
+			if (truth_log != NULL)
+				fprintf(truth_log, "%f %d %f %f\n", wb_robot_get_time(), i + offset, loc[i][0], -loc[i][1]);
 		}
+		// The controller is killed when the simulation ends, nothing stays buffered
+		if (truth_log != NULL)
+			fflush(truth_log);
 		if (recevied_loc_data)
 		{
 			compute_localization_fitness(&fit_localization);
 			printf("fitness for localization is: %f \n", fit_localization);
 		}
+		if (received_packet && wb_robot_get_time() - last_stats_time >= STATS_PERIOD)
+		{
+			last_stats_time = wb_robot_get_time();
+			print_error_stats();
+		}
 
 		//compute_flocking_fitness(&fit_flocking);
 		//printf("fitness for flocking is: %f \n", fit_flocking);
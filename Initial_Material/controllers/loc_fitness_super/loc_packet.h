@@ -0,0 +1,28 @@
+#ifndef LOC_PACKET_H
+#define LOC_PACKET_H
+
+// Localization methods, the values of LOCALIZATION_METHOD
+typedef enum
+{
+  LOC_GPS = 0,         // gps only
+  LOC_ACC_ENCODER = 1, // acc + encoder (for heading) odometry
+  LOC_ENCODER = 2,     // encoder odometry
+  LOC_KALMAN = 3,      // kalman filter
+  LOC_EKF = 4,         // extended kalman filter (unicycle model)
+  LOC_METHOD_COUNT
+} loc_method_t;
+
+#define LOC_PACKET_VERSION 1
+
+// Shadow mode report of a robot to the supervisor: the position estimated by every method from
+// the same measurements of one step, 44 bytes. Also copied in loc_fitness_super.
+typedef struct
+{
+  unsigned char version;
+  unsigned char robot_id;
+  unsigned char driving_method;        // Method whose pose the robot uses
+  unsigned char method_mask;           // Bit m is set when method m ran this step
+  float position[LOC_METHOD_COUNT][2]; // x, y in the localization frame (y = -z)
+} loc_packet_t;
+
+#endif
@@ -0,0 +1,236 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "spatial_grid.h"
+
+/**
+ * @brief      Column or row of a coordinate, may lie outside the grid
+ */
+static int spatial_grid_cell(const spatial_grid_t *grid, int axis, float value)
+{
+    return (int)floorf((value - grid->origin[axis]) / grid->cell_size);
+}
+
+/**
+ * @brief      Clip a range of columns or rows to the grid
+ *
+ * @return     false if the range misses the grid
+ */
+static bool spatial_grid_clip(int size, int *first, int *last)
+{
+    if (*first < 0)
+        *first = 0;
+    if (*last > size - 1)
+        *last = size - 1;
+    return *first <= *last;
+}
+
+/**
+ * @brief      Sort a set of points into the grid
+ *
+ *             A counting sort on the cell of each point, O(count + cells), nothing is allocated.
+ *             The cells grow beyond cell_size when the points are spread over more than
+ *             SPATIAL_GRID_SIDE cells. With a cell_size of 0 a single cell holds every point,
+ *             a query then scans them all: the brute force result at the brute force cost.
+ *
+ * @param      grid       The grid
+ * @param[in]  xy         The points, x at xy[i * stride] and y at xy[i * stride + 1]
+ * @param[in]  stride     The floats between two points, 2 for an array of {x, y}
+ * @param[in]  count      The number of points
+ * @param[in]  cell_size  The side of a cell, best the radius of the queries
+ *
+ * @return     false if there are more than SPATIAL_GRID_CAPACITY points
+ */
+bool spatial_grid_build(spatial_grid_t *grid, const float *xy, int stride, int count, float cell_size)
+{
+    float low[2] = {0.0f, 0.0f}, high[2] = {0.0f, 0.0f}, extent;
+    int i, c, cells, column, row, slot;
+
+    if (count > SPATIAL_GRID_CAPACITY)
+    {
+        printf("spatial grid: %d points, at most %d\n", count, SPATIAL_GRID_CAPACITY);
+        return false;
+    }
+    for (i = 0; i < count; i++)
+    {
+        low[0] = i == 0 ? xy[0] : fminf(low[0], xy[i * stride]);
+        low[1] = i == 0 ? xy[1] : fminf(low[1], xy[i * stride + 1]);
+        high[0] = i == 0 ? xy[0] : fmaxf(high[0], xy[i * stride]);
+        high[1] = i == 0 ? xy[1] : fmaxf(high[1], xy[i * stride + 1]);
+    }
+    extent = fmaxf(high[0] - low[0], high[1] - low[1]);
+    if (!(cell_size > 0.0f) || isinf(cell_size))
+        cell_size = 2.0f * extent; // Not extent, the highest point would start a second cell
+    // Two cells of margin against the rounding of the division
+    if (cell_size < extent / (SPATIAL_GRID_SIDE - 2))
+        cell_size = extent / (SPATIAL_GRID_SIDE - 2);
+    if (!(cell_size > 0.0f))
+        cell_size = 1.0f;
+
+    grid->cell_size = cell_size;
+    grid->origin[0] = low[0];
+    grid->origin[1] = low[1];
+    grid->columns = spatial_grid_cell(grid, 0, high[0]) + 1;
+    grid->rows = spatial_grid_cell(grid, 1, high[1]) + 1;
+    grid->count = count;
+    cells = grid->columns * grid->rows;
+
+    memset(grid->cell_start, 0, (cells + 1) * sizeof(int));
+    for (i = 0; i < count; i++)
+    {
+        column = spatial_grid_cell(grid, 0, xy[i * stride]);
+        row = spatial_grid_cell(grid, 1, xy[i * stride + 1]);
+        grid->cell_start[column * grid->rows + row + 1]++;
+    }
+    for (c = 0; c < cells; c++)
+    {
+        grid->cell_start[c + 1] += grid->cell_start[c];
+        grid->cell_fill[c] = grid->cell_start[c];
+    }
+    for (i = 0; i < count; i++)
+    {
+        column = spatial_grid_cell(grid, 0, xy[i * stride]);
+        row = spatial_grid_cell(grid, 1, xy[i * stride + 1]);
+        slot = grid->cell_fill[column * grid->rows + row]++;
+        grid->x[slot] = xy[i * stride];
+        grid->y[slot] = xy[i * stride + 1];
+        grid->index[slot] = i;
+    }
+    return true;
+}
+
+/**
+ * @brief      Find the points within a radius of a position
+ *
+ *             Scans the cells overlapping the square around the disc, 3x3 cells when the
+ *             radius is the cell size, one contiguous run of points per column.
+ *
+ * @param[in]  grid       The grid
+ * @param[in]  x          The x of the position
+ * @param[in]  y          The y of the position
+ * @param[in]  radius     The radius, INFINITY for every point
+ * @param      found      The indices of the points found, in no particular order
+ * @param[in]  max_found  The size of found, the points beyond are not returned
+ *
+ * @return     The number of points found
+ */
+int spatial_grid_radius(const spatial_grid_t *grid, float x, float y, float radius, int *found, int max_found)
+{
+    float radius2 = radius * radius;
+    int first_column, last_column, first_row, last_row, column, p, end, n = 0;
+
+    if (grid->count == 0)
+        return 0;
+    // In floats, an infinite radius must not overflow the int
+    first_column = (int)fmaxf(floorf((x - radius - grid->origin[0]) / grid->cell_size), -1.0f);
+    last_column = (int)fminf(floorf((x + radius - grid->origin[0]) / grid->cell_size), grid->columns);
+    first_row = (int)fmaxf(floorf((y - radius - grid->origin[1]) / grid->cell_size), -1.0f);
+    last_row = (int)fminf(floorf((y + radius - grid->origin[1]) / grid->cell_size), grid->rows);
+    if (!spatial_grid_clip(grid->columns, &first_column, &last_column) || !spatial_grid_clip(grid->rows, &first_row, &last_row))
+        return 0;
+
+    for (column = first_column; column <= last_column; column++)
+    {
+        p = grid->cell_start[column * grid->rows + first_row];
+        end = grid->cell_start[column * grid->rows + last_row + 1];
+        // Branchless append, the test is taken about half the time and would be mispredicted
+        for (; p < end && n < max_found; p++)
+        {
+            float dx = grid->x[p] - x, dy = grid->y[p] - y;
+
+            found[n] = grid->index[p];
+            n += dx * dx + dy * dy <= radius2;
+        }
+    }
+    return n;
+}
+
+/**
+ * @brief      Scan one cell for the k nearest points
+ */
+static void spatial_grid_nearest_cell(const spatial_grid_t *grid, int cell, float x, float y, int k, int exclude, int *found, float *dist2, int *n)
+{
+    int p, i;
+
+    for (p = grid->cell_start[cell]; p < grid->cell_start[cell + 1]; p++)
+    {
+        float dx = grid->x[p] - x, dy = grid->y[p] - y;
+        float d2 = dx * dx + dy * dy;
+
+        if (grid->index[p] == exclude || (*n == k && d2 >= dist2[k - 1]))
+            continue;
+        // Insertion into the sorted k best
+        i = *n < k ? (*n)++ : k - 1;
+        for (; i > 0 && dist2[i - 1] > d2; i--)
+        {
+            dist2[i] = dist2[i - 1];
+            found[i] = found[i - 1];
+        }
+        dist2[i] = d2;
+        found[i] = grid->index[p];
+    }
+}
+
+/**
+ * @brief      Find the k points nearest to a position
+ *
+ *             Scans rings of cells outwards and stops once the k-th distance is shorter than
+ *             the nearest cell of the next ring.
+ *
+ * @param[in]  grid     The grid
+ * @param[in]  x        The x of the position
+ * @param[in]  y        The y of the position
+ * @param[in]  k        The number of points wanted
+ * @param[in]  exclude  The index of a point to skip, the robot itself, -1 for none
+ * @param      found    The indices of the points, nearest first
+ * @param      dist2    Their squared distances
+ *
+ * @return     The number of points found, less than k if the grid has fewer
+ */
+int spatial_grid_nearest(const spatial_grid_t *grid, float x, float y, int k, int exclude, int *found, float *dist2)
+{
+    int center_column = spatial_grid_cell(grid, 0, x), center_row = spatial_grid_cell(grid, 1, y);
+    int ring, column, row, first_row, last_row, n = 0;
+    float reach;
+
+    if (k <= 0 || grid->count == 0)
+        return 0;
+    // A position outside the grid starts from the nearest cell, the rings still cover the grid
+    center_column = center_column < 0 ? 0 : (center_column >= grid->columns ? grid->columns - 1 : center_column);
+    center_row = center_row < 0 ? 0 : (center_row >= grid->rows ? grid->rows - 1 : center_row);
+    for (ring = 0;; ring++)
+    {
+        // The cells of this ring are at least (ring - 1) cells away from the center cell
+        reach = (ring - 1) * grid->cell_size;
+        if (n == k && ring > 0 && dist2[k - 1] <= reach * reach)
+            break;
+        if (center_column - ring < 0 && center_column + ring >= grid->columns && center_row - ring < 0 && center_row + ring >= grid->rows)
+            break;
+
+        for (column = center_column - ring; column <= center_column + ring; column++)
+        {
+            if (column < 0 || column >= grid->columns)
+                continue;
+            first_row = center_row - ring;
+            last_row = center_row + ring;
+            if (!spatial_grid_clip(grid->rows, &first_row, &last_row))
+                continue;
+            if (column == center_column - ring || column == center_column + ring)
+            {
+                // The side columns of the ring are whole
+                for (row = first_row; row <= last_row; row++)
+                    spatial_grid_nearest_cell(grid, column * grid->rows + row, x, y, k, exclude, found, dist2, &n);
+            }
+            else
+            {
+                // The inner columns only have their top and bottom cell in the ring
+                if (center_row - ring >= 0)
+                    spatial_grid_nearest_cell(grid, column * grid->rows + center_row - ring, x, y, k, exclude, found, dist2, &n);
+                if (center_row + ring < grid->rows)
+                    spatial_grid_nearest_cell(grid, column * grid->rows + center_row + ring, x, y, k, exclude, found, dist2, &n);
+            }
+        }
+    }
+    return n;
+}
@@ -0,0 +1,210 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <ctype.h>
+
+#include "params.h"
+
+#define PARAMS_LINE_SIZE 256
+#define PARAMS_KEY_SIZE 64
+
+typedef enum
+{
+    PARAM_TYPE_int,
+    PARAM_TYPE_float,
+    PARAM_TYPE_double,
+    PARAM_TYPE_bool
+} param_type_t;
+
+// Where and how to store the value of a key
+typedef struct
+{
+    const char *name;
+    param_type_t type;
+    size_t offset;
+    int count; // 1 for a scalar, the size of a PARAM_ARRAY
+    double min;
+    double max;
+} param_field_t;
+
+static const param_field_t _fields[] = {
+#define PARAM(type, name, value, min, max, doc) {#name, PARAM_TYPE_##type, offsetof(params_t, name), 1, min, max},
+#define PARAM_ARRAY(type, name, count, min, max, doc, ...) {#name, PARAM_TYPE_##type, offsetof(params_t, name), count, min, max},
+#include "params_schema.h"
+#undef PARAM
+#undef PARAM_ARRAY
+};
+
+static const params_t _defaults = {
+#define PARAM(type, name, value, min, max, doc) .name = value,
+#define PARAM_ARRAY(type, name, count, min, max, doc, ...) .name = {__VA_ARGS__},
+#include "params_schema.h"
+#undef PARAM
+#undef PARAM_ARRAY
+};
+
+params_t params;
+
+/**
+ * @brief      Set every parameter to its default of params_schema.h
+ *
+ * @param      p     The parameters
+ */
+void params_reset(params_t *p)
+{
+    memcpy(p, &_defaults, sizeof(params_t));
+}
+
+/**
+ * @brief      Parse a value of the given type
+ *
+ * @param[in]  text   The text of the value, trailing spaces and comment allowed
+ * @param[in]  type   The type of the value
+ * @param      value  The value
+ *
+ * @return     false if the text is not a value of the type
+ */
+static bool params_parse_value(const char *text, param_type_t type, double *value)
+{
+    char *end;
+
+    if (type == PARAM_TYPE_bool && strncmp(text, "true", 4) == 0)
+    {
+        *value = 1.0;
+        end = (char *)text + 4;
+    }
+    else if (type == PARAM_TYPE_bool && strncmp(text, "false", 5) == 0)
+    {
+        *value = 0.0;
+        end = (char *)text + 5;
+    }
+    else if (type == PARAM_TYPE_float || type == PARAM_TYPE_double)
+    {
+        *value = strtod(text, &end);
+    }
+    else
+    {
+        *value = strtol(text, &end, 10);
+    }
+    if (end == text)
+        return false;
+    while (isspace((unsigned char)*end))
+        end++;
+    return *end == '\0' || *end == '#';
+}
+
+/**
+ * @brief      Apply the "key = value" and "key[i] = value" lines of a file over the current parameters
+ *
+ *             Parsed line by line in a stack buffer, nothing is allocated. '#' starts a comment.
+ *             An unknown key, a bad value or a value out of the schema range is reported and
+ *             skipped, the other lines are still applied.
+ *
+ * @param      p          The parameters
+ * @param[in]  file_name  The parameter file
+ *
+ * @return     false if the file cannot be read
+ */
+bool params_load(params_t *p, const char *file_name)
+{
+    FILE *file = fopen(file_name, "r");
+    char line[PARAMS_LINE_SIZE], key[PARAMS_KEY_SIZE];
+    const param_field_t *field;
+    const char *text;
+    double value;
+    int line_number = 0, index, length, i;
+
+    if (file == NULL)
+        return false;
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        line_number++;
+        text = line;
+        while (isspace((unsigned char)*text))
+            text++;
+        if (*text == '\0' || *text == '#')
+            continue;
+
+        // key, optional [index], '='
+        index = 0;
+        if (sscanf(text, "%63[a-z0-9_]%n", key, &length) != 1)
+        {
+            printf("%s:%d: no parameter name, line skipped\n", file_name, line_number);
+            continue;
+        }
+        text += length;
+        if (sscanf(text, " [ %d ]%n", &index, &length) == 1)
+            text += length;
+        while (isspace((unsigned char)*text))
+            text++;
+        if (*text != '=')
+        {
+            printf("%s:%d: missing '=' after %s, line skipped\n", file_name, line_number, key);
+            continue;
+        }
+        text++;
+        while (isspace((unsigned char)*text))
+            text++;
+
+        field = NULL;
+        for (i = 0; i < (int)(sizeof(_fields) / sizeof(_fields[0])); i++)
+        {
+            if (strcmp(_fields[i].name, key) == 0)
+            {
+                field = &_fields[i];
+                break;
+            }
+        }
+        if (field == NULL)
+        {
+            printf("%s:%d: unknown parameter %s\n", file_name, line_number, key);
+            continue;
+        }
+        if (index < 0 || index >= field->count)
+        {
+            printf("%s:%d: %s has %d element(s), index %d skipped\n", file_name, line_number, key, field->count, index);
+            continue;
+        }
+        if (!params_parse_value(text, field->type, &value) || value < field->min || value > field->max)
+        {
+            printf("%s:%d: %s must be in [%g, %g], kept at its previous value\n", file_name, line_number, key, field->min, field->max);
+            continue;
+        }
+
+        char *member = (char *)p + field->offset;
+        if (field->type == PARAM_TYPE_int)
+            ((int *)member)[index] = (int)value;
+        else if (field->type == PARAM_TYPE_float)
+            ((float *)member)[index] = (float)value;
+        else if (field->type == PARAM_TYPE_double)
+            ((double *)member)[index] = value;
+        else
+            ((bool *)member)[index] = value != 0.0;
+    }
+    fclose(file);
+    return true;
+}
+
+/**
+ * @brief      Reset the parameters and apply the experiment file, called by the controllers at reset time
+ *
+ *             The file is named by the PARAMS_FILE_ENV environment variable when it is set,
+ *             PARAMS_FILE otherwise. Without a file the defaults are used.
+ *
+ * @param      p     The parameters
+ *
+ * @return     true if a parameter file was applied
+ */
+bool params_init(params_t *p)
+{
+    const char *file_name = getenv(PARAMS_FILE_ENV);
+
+    if (file_name == NULL)
+        file_name = PARAMS_FILE;
+    params_reset(p);
+    if (!params_load(p, file_name))
+        return false;
+    printf("parameters loaded from %s\n", file_name);
+    return true;
+}
@@ -0,0 +1,26 @@
+#ifndef PARAMS_H
+#define PARAMS_H
+
+#include <stdbool.h>
+
+#define PARAMS_MAX_FLOCK_SIZE 512               // Capacity of the per robot tables, the FLOCK_SIZE of the controllers, robots of the largest flock
+#define PARAMS_FILE "../params.txt"             // Relative to the controller directory, shared by all controllers
+#define PARAMS_FILE_ENV "FLOCKING_PARAMS"       // Environment variable naming another file, for batch sweeps
+
+// Experiment parameters, one member per entry of params_schema.h
+typedef struct
+{
+#define PARAM(type, name, value, min, max, doc) type name;
+#define PARAM_ARRAY(type, name, count, min, max, doc, ...) type name[count];
+#include "params_schema.h"
+#undef PARAM
+#undef PARAM_ARRAY
+} params_t;
+
+extern params_t params; // Filled by params_init, which every controller calls at reset time
+
+void params_reset(params_t *p);
+bool params_load(params_t *p, const char *file_name);
+bool params_init(params_t *p);
+
+#endif
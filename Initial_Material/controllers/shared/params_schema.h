@@ -0,0 +1,38 @@
+// Schema of the experiment parameters, shared by every controller from controllers/shared and expanded by params.h and params.c.
+// No include guard, it is included once per expansion.
+//
+// PARAM(type, name, default, min, max, description)
+// PARAM_ARRAY(type, name, count, min, max, description, defaults...), set per element with "name[i] = value"
+// type is int, float, double or bool, a value outside [min, max] is rejected and the default kept.
+
+/* FLOCK */
+PARAM(int, flock_size, 5, 2, PARAMS_MAX_FLOCK_SIZE, "Robots in the flock")
+PARAM(int, flock_id, 0, 0, 65535, "Flock of the robots, the pings of another flock are ignored")
+PARAM(int, time_step, 64, 8, 1024, "Control step of the robots and supervisors (ms)")
+PARAM(int, loop_num, 1000, 1, 1000000, "Control steps of the Braitenberg loop")
+PARAM(double, neighbour_timeout, 0.5, 0.0, 100.0, "Time without a ping after which a flockmate is dropped (s)")
+PARAM(float, tracker_alpha, 0.5, 0.0, 1.0, "Position gain of the flockmate tracker, 1 uses the last ping alone")
+PARAM(float, tracker_beta, 0.17, 0.0, 2.0, "Speed gain of the flockmate tracker, alpha^2 / (2 - alpha) damps it best")
+
+/* REYNOLDS RULES */
+PARAM(float, rule1_weight, 0.06, 0.0, 10.0, "Weight of the cohesion rule")
+PARAM(float, rule2_thres, 0.06, 0.0, 10.0, "Squared distance below which the separation rule acts (m^2)")
+PARAM(float, rule2_weight, 0.001, 0.0, 10.0, "Weight of the separation rule")
+PARAM(float, rule3_weight, 0.1, 0.0, 10.0, "Weight of the alignment rule")
+PARAM(float, migration_weight, 0.005, 0.0, 10.0, "Weight of the migration urge")
+PARAM_ARRAY(float, migr, 2, -100.0, 100.0, "Migration goal {x, z} (m)", 3.0, 0.0)
+PARAM(int, topological_k, 0, 0, 100000, "Flockmates the rules use, the k nearest, 0 for every flockmate in range")
+
+/* LOCALIZATION */
+PARAM(int, localization_method, 3, 0, 5, "Estimator of the flocking controller, see estimate_self_position")
+PARAM(bool, cooperative_localization, false, 0, 1, "Ping the position covariance, fuse the neighbours' positions as independent fixes (optimistic)")
+PARAM(double, gps_period, 1.0, 0.0, 100.0, "Time between two gps samples (s)")
+PARAM(double, origin_x, -2.9, -100.0, 100.0, "Start x of the robots in the localization frame (m)")
+PARAM_ARRAY(double, origin_y, PARAMS_MAX_FLOCK_SIZE, -100.0, 100.0, "Start y of each robot in the localization frame (m), 0 past the listed defaults", 0.0, -0.1, 0.1, -0.2, 0.2)
+
+/* SUPERVISORS */
+PARAM(float, fitness_radius, 0.0, 0.0, 100.0, "Only the pairs of robots closer than this enter the flocking fitness, 0 for all pairs (m)")
+
+/* PSO */
+PARAM(int, pso_iterations, 100, 1, 100000, "Iterations of the PSO")
+PARAM(int, fit_its, 1800, 1, 1000000, "Control steps of one fitness evaluation")
@@ -0,0 +1,170 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "acc_bias.h"
+
+#define ACC_BIAS_STEADY_ACC 0.02   // Encoder acceleration below which a step is steady (m/s^2)
+#define ACC_BIAS_SETTLE_STEPS 3    // Steady steps skipped before sampling, the body oscillations settle
+#define ACC_BIAS_MIN_SAMPLES 20    // Samples needed before the bias is used
+#define ACC_BIAS_MAX_ERROR 0.005   // Largest standard error of the mean of a ready estimate (m/s^2)
+#define ACC_BIAS_MAX_COUNT 2000    // Beyond it the mean becomes a moving average and follows a drift
+#define ACC_BIAS_PRIOR_COUNT 50    // Weight of a loaded calibration, in samples
+
+/**
+ * @brief      Reset the estimate, no bias known
+ *
+ * @param      bias       The estimate
+ * @param[in]  time_step  The time step in milliseconds
+ */
+void acc_bias_reset(acc_bias_t *bias, int time_step)
+{
+    memset(bias, 0, sizeof(acc_bias_t));
+    bias->T = time_step / 1000.0;
+}
+
+/**
+ * @brief      Add the accelerometer sample of a step if the encoders show no acceleration
+ *
+ *             The acceleration expected from the encoders, along the robot and centripetal,
+ *             is removed from the sample. The steady gate keeps it small, so its errors
+ *             (wheel slip) do not reach the bias.
+ *
+ * @param      bias        The estimate
+ * @param[in]  acc         The accelerometer values, forward is acc[1] and left is -acc[0]
+ * @param[in]  Aleft_enc   The left encoder increment of the step
+ * @param[in]  Aright_enc  The right encoder increment of the step
+ * @param[in]  calibration  The wheel radii and axle length of the odometry
+ *
+ * @return     true if the sample was used
+ */
+bool acc_bias_update(acc_bias_t *bias, const double acc[3], double Aleft_enc, double Aright_enc, const odo_calibration_t *calibration)
+{
+    double left = calibration->wheel_radius_left * Aleft_enc;
+    double right = calibration->wheel_radius_right * Aright_enc;
+    double speed = (left + right) / (2.0 * bias->T);
+    double omega = (right - left) / (calibration->wheel_axis * bias->T);
+    double expected[3];
+    double delta;
+    int i;
+
+    expected[1] = (speed - bias->prev_speed) / bias->T;
+    expected[0] = -speed * omega;
+    expected[2] = 0.0;
+    bias->prev_speed = speed;
+
+    if (fabs(expected[0]) > ACC_BIAS_STEADY_ACC || fabs(expected[1]) > ACC_BIAS_STEADY_ACC)
+    {
+        bias->steady_steps = 0;
+        return false;
+    }
+    if (++bias->steady_steps <= ACC_BIAS_SETTLE_STEPS)
+        return false;
+
+    if (bias->count < ACC_BIAS_MAX_COUNT)
+        bias->count++;
+    for (i = 0; i < 3; i++)
+    {
+        double sample = acc[i] - expected[i];
+
+        delta = sample - bias->mean[i];
+        bias->mean[i] += delta / bias->count;
+        bias->m2[i] += delta * (sample - bias->mean[i]);
+    }
+    // Keep m2 the sum over count samples once the count is capped
+    if (bias->count == ACC_BIAS_MAX_COUNT)
+    {
+        for (i = 0; i < 3; i++)
+            bias->m2[i] *= (ACC_BIAS_MAX_COUNT - 1.0) / ACC_BIAS_MAX_COUNT;
+    }
+    return true;
+}
+
+/**
+ * @brief      Whether the estimate is good enough to correct the accelerometer
+ *
+ * @param[in]  bias  The estimate
+ *
+ * @return     true once the standard error of every axis is below ACC_BIAS_MAX_ERROR
+ */
+bool acc_bias_ready(const acc_bias_t *bias)
+{
+    int i;
+
+    if (bias->count < ACC_BIAS_MIN_SAMPLES)
+        return false;
+    for (i = 0; i < 3; i++)
+    {
+        if (sqrt(bias->m2[i] / (bias->count - 1) / bias->count) > ACC_BIAS_MAX_ERROR)
+            return false;
+    }
+    return true;
+}
+
+/**
+ * @brief      Start from the bias saved by a previous run
+ *
+ *             The calibration counts as ACC_BIAS_PRIOR_COUNT samples at most, so the estimate
+ *             is ready at once and still follows a change of the sensor.
+ *
+ * @param      bias       The estimate
+ * @param[in]  file_name  The calibration file, "count mean_x mean_y mean_z var_x var_y var_z"
+ *
+ * @return     false if there is no valid calibration
+ */
+bool acc_bias_load(acc_bias_t *bias, const char *file_name)
+{
+    FILE *file = fopen(file_name, "r");
+    double mean[3], var[3];
+    long count;
+    int i;
+
+    if (file == NULL)
+        return false;
+    if (fscanf(file, "%ld %lf %lf %lf %lf %lf %lf", &count, &mean[0], &mean[1], &mean[2], &var[0], &var[1], &var[2]) != 7 || count < 2)
+    {
+        printf("%s is not an accelerometer calibration, ignored\n", file_name);
+        fclose(file);
+        return false;
+    }
+    fclose(file);
+
+    bias->count = count < ACC_BIAS_PRIOR_COUNT ? count : ACC_BIAS_PRIOR_COUNT;
+    for (i = 0; i < 3; i++)
+    {
+        bias->mean[i] = mean[i];
+        bias->m2[i] = var[i] * (bias->count - 1);
+    }
+    return true;
+}
+
+/**
+ * @brief      Save the estimate for the next runs
+ *
+ * @param[in]  bias       The estimate
+ * @param[in]  file_name  The calibration file
+ *
+ * @return     false if the file cannot be written
+ */
+bool acc_bias_save(const acc_bias_t *bias, const char *file_name)
+{
+    FILE *file;
+    int i;
+
+    if (bias->count < 2)
+        return false;
+    file = fopen(file_name, "w");
+    if (file == NULL)
+    {
+        printf("cannot write %s, the accelerometer calibration is not saved\n", file_name);
+        return false;
+    }
+    fprintf(file, "%ld", bias->count);
+    for (i = 0; i < 3; i++)
+        fprintf(file, " %.9g", bias->mean[i]);
+    for (i = 0; i < 3; i++)
+        fprintf(file, " %.9g", bias->m2[i] / (bias->count - 1));
+    fprintf(file, "\n");
+    fclose(file);
+    return true;
+}
@@ -3,128 +3,526 @@
 #include <string.h>
 #include <math.h>
 #include <stdbool.h>
+#include <stdlib.h>
 #include "light_matrix.h"
 
-static Mat X;
-static Mat u;
-static Mat R;
-static Mat Cov;
-static Mat A;
-static Mat meas;
-static Mat C;
-static Mat Q;
-static Mat I;
-static double _T;
-static double prev_gps_time;
-static state_t estimate_state;
-static int _robot_id;
+struct kalman_filter
+{
+    MatFixed X;
+    MatFixed u;
+    MatFixed R;
+    MatFixed Cov;
+    MatFixed A;
+    MatFixed meas;
+    MatFixed C;
+    MatFixed Q;
+    MatFixed I;
+    double T;
+    double prev_gps_time;
+    state_t estimate_state;
+    int robot_id;
+
+    // Workspace used by kalman_filter_compute_pose, sized once in kalman_filter_reset
+    MatFixed R_T;
+    MatFixed X_new;
+    MatFixed ACov;
+    MatFixed Cov_new;
+    MatFixed CCov;
+    MatFixed S;
+    MatFixed S_chol;
+    MatFixed K_trans;
+    MatFixed K;
+    MatFixed CX;
+    MatFixed innov;
+    MatFixed K_innov;
+    MatFixed KC;
+    MatFixed IKC;
+    MatFixed Cov_update;
+
+    // Steady-state gain, see kalman_filter_steady_state_check
+    bool steady;
+    int steps_since_gps;
+    int gps_period;      // Steps between the last two gps fixes
+    int converged_fixes; // Consecutive fixes with the same gain and period
+    float K_gps[2][6];   // Gains of the x and y updates at the last fix
+    MatFixed Cov_gps;    // Covariance right after the last fix
+
+    // Extended Kalman filter on the unicycle model, X = [x, y, theta]
+    MatFixed ekf_X;
+    MatFixed ekf_Cov;
+    kalman_filter_ekf_step_t ekf_step; // Last step, for kalman_filter_ekf_record
+};
 
 //-----------------------------------------------------------------------------------//
 /*CONSTANTES*/
 #define WHEEL_AXIS 0.057    // Distance between the two wheels in meter
 #define WHEEL_RADIUS 0.0200 // Radius of the wheel in meter
 
-void kalman_filter_compute_pose(pose_t *state_kalman, pose_t *gps_pose, bool gps_updated, double Aleft_enc, double Aright_enc)
+/*FLAGS*/
+// The flags can be set on the command line, tools/kalman_cov_bench and tools/kalman_update_check build the variants
+#ifndef KALMAN_FUSED_COV_PROPAGATION
+#define KALMAN_FUSED_COV_PROPAGATION true // Propagate the covariance with the structured kernel instead of generic matrix products
+#endif
+#ifndef KALMAN_SEQUENTIAL_GPS_UPDATE
+#define KALMAN_SEQUENTIAL_GPS_UPDATE true // Fuse the gps x and y as two scalar updates instead of the matrix update
+#endif
+#ifndef KALMAN_STEADY_STATE_GAIN
+// Switch to a constant gain once the covariance is periodic (needs KALMAN_SEQUENTIAL_GPS_UPDATE),
+// only while no other position is fused, see kalman_filter_fuse_position
+#define KALMAN_STEADY_STATE_GAIN true
+#endif
+
+/*STEADY STATE DETECTION*/
+#define KALMAN_STEADY_STATE_TOL 1e-5 // Relative change of the gain below which two fixes have the same gain
+#define KALMAN_STEADY_STATE_FIXES 3  // Consecutive unchanged fixes before the gain is frozen
+
+/*EKF NOISE*/
+#define EKF_WHEEL_NOISE ODO_WHEEL_NOISE // Variance of a wheel displacement per meter travelled (m), see odometry.h
+#define EKF_GPS_NOISE 0.0001   // Variance of a gps coordinate (m^2), the gps noise is 0.01 m in the worlds
+
+/*POSITION MEASUREMENTS*/
+#define KALMAN_POSITION_GATE 9.21 // Squared Mahalanobis distance above which a position measurement is rejected (chi2, 2 dof, 99%)
+
+/**
+ * @brief      Cov_new = A * Cov * A' + R * dt for the A built in kalman_filter_reset
+ *
+ *             A = [I3, dt * I3; 0, 0], so A * Cov * A' only has the upper-left block
+ *             Cov11 + dt * (Cov12 + Cov12') + dt^2 * Cov22. Cov is symmetric, the upper
+ *             triangle is computed in one pass and mirrored.
+ *
+ * @param      cov_new  The propagated covariance (6x6)
+ * @param[in]  cov      The covariance of the previous step (6x6, symmetric)
+ * @param[in]  r_t      The process noise of a step, R * dt (6x6, symmetric)
+ * @param[in]  dt       The time step in seconds
+ */
+static void kalman_filter_propagate_cov(Mat *cov_new, const Mat *cov, const Mat *r_t, float dt)
+{
+    const float *P = cov->data;
+    const float *RT = r_t->data;
+    float *P_new = cov_new->data;
+    float value;
+    int i, j;
+
+    for (i = 0; i < 6; i++)
+    {
+        for (j = i; j < 6; j++)
+        {
+            value = RT[i * 6 + j];
+            if (j < 3)
+                value += P[i * 6 + j] + dt * (P[i * 6 + j + 3] + P[j * 6 + i + 3]) + dt * dt * P[(i + 3) * 6 + j + 3];
+            P_new[i * 6 + j] = value;
+            P_new[j * 6 + i] = value;
+        }
+    }
+}
+
+/**
+ * @brief      Scalar measurement update of the state component index
+ *
+ *             The measurement is z = X[index] + noise of variance q, i.e. one row of C
+ *             with a single 1. The gain is a column of Cov divided by a scalar, so no
+ *             matrix is inverted. The covariance is updated in Joseph form,
+ *             (I - K h') Cov (I - K h')' + K q K', which stays symmetric and positive
+ *             definite in float.
+ *
+ * @param      x      The state (nx1, n <= 6)
+ * @param      cov    The covariance (nxn, symmetric)
+ * @param[in]  index  The measured state component
+ * @param[in]  z      The measurement
+ * @param[in]  q      The variance of the measurement noise
+ * @param      gain   The gain K used for the update (n entries), may be NULL
+ */
+static void kalman_filter_update_scalar(Mat *x, Mat *cov, int index, float z, float q, float *gain)
+{
+    const int n = x->row;
+    float *P = cov->data;
+    float P_col[6];
+    float K_col[6];
+    float s, innovation, value;
+    int i, j;
+
+    for (i = 0; i < n; i++)
+        P_col[i] = P[i * n + index];
+    s = P[index * n + index] + q;
+    for (i = 0; i < n; i++)
+        K_col[i] = P_col[i] / s;
+    if (gain != NULL)
+        memcpy(gain, K_col, n * sizeof(float));
+
+    innovation = z - x->data[index];
+    for (i = 0; i < n; i++)
+        x->data[i] += K_col[i] * innovation;
+
+    // Joseph form expanded for h = e_index: Cov - K h'Cov - Cov h K' + K (h'Cov h + q) K'
+    for (i = 0; i < n; i++)
+    {
+        for (j = i; j < n; j++)
+        {
+            value = P[i * n + j] - K_col[i] * P_col[j] - P_col[i] * K_col[j] + K_col[i] * K_col[j] * s;
+            P[i * n + j] = value;
+            P[j * n + i] = value;
+        }
+    }
+}
+
+/**
+ * @brief      Update with a measurement of the position, z = [X[0], X[1]] + noise of covariance r
+ *
+ *             Unlike the gps, r is a full 2x2 covariance, so x and y are fused together:
+ *             S = H Cov H' + r is inverted in closed form and Cov = Cov - K H Cov.
+ *             Measurements further than KALMAN_POSITION_GATE from the estimate are rejected.
+ *
+ * @param      x      The state (nx1, n <= 6)
+ * @param      cov    The covariance (nxn, symmetric)
+ * @param[in]  zx     The measured x
+ * @param[in]  zy     The measured y
+ * @param[in]  r      The measurement covariance {xx, xy, yy}
+ *
+ * @return     false if the measurement was rejected
+ */
+static bool kalman_filter_update_position(Mat *x, Mat *cov, float zx, float zy, const float r[3])
+{
+    const int n = x->row;
+    float *P = cov->data;
+    float HP[2][6];
+    float K[6][2];
+    float s00, s01, s11, det, inv00, inv01, inv11, dx, dy, value;
+    int i, j;
+
+    for (j = 0; j < n; j++)
+    {
+        HP[0][j] = P[0 * n + j];
+        HP[1][j] = P[1 * n + j];
+    }
+    s00 = HP[0][0] + r[0];
+    s01 = HP[0][1] + r[1];
+    s11 = HP[1][1] + r[2];
+    det = s00 * s11 - s01 * s01;
+    if (det <= 0.0f)
+        return false;
+    inv00 = s11 / det;
+    inv01 = -s01 / det;
+    inv11 = s00 / det;
+
+    dx = zx - x->data[0];
+    dy = zy - x->data[1];
+    if (dx * (inv00 * dx + inv01 * dy) + dy * (inv01 * dx + inv11 * dy) > KALMAN_POSITION_GATE)
+        return false;
+
+    // K = Cov H' inv(S), Cov H' is HP transposed since Cov is symmetric
+    for (i = 0; i < n; i++)
+    {
+        K[i][0] = HP[0][i] * inv00 + HP[1][i] * inv01;
+        K[i][1] = HP[0][i] * inv01 + HP[1][i] * inv11;
+    }
+    for (i = 0; i < n; i++)
+        x->data[i] += K[i][0] * dx + K[i][1] * dy;
+    for (i = 0; i < n; i++)
+    {
+        for (j = i; j < n; j++)
+        {
+            value = P[i * n + j] - K[i][0] * HP[0][j] - K[i][1] * HP[1][j];
+            P[i * n + j] = value;
+            P[j * n + i] = value;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief      Cov_new = A * Cov * A' + R * dt
+ *
+ * @param      kf    The filter
+ */
+static void kalman_filter_predict_cov(kalman_filter_t *kf)
+{
+    if (KALMAN_FUSED_COV_PROPAGATION)
+    {
+        kalman_filter_propagate_cov(&kf->Cov_new.mat, &kf->Cov.mat, &kf->R_T.mat, kf->T);
+    }
+    else
+    {
+        MatMulInto(&kf->ACov.mat, &kf->A.mat, &kf->Cov.mat);
+        MatTransMulInto(&kf->Cov_new.mat, &kf->ACov.mat, &kf->A.mat);
+        MatAddInto(&kf->Cov_new.mat, &kf->Cov_new.mat, &kf->R_T.mat);
+    }
+}
+
+/**
+ * @brief      Track the gain of the sequential gps update and freeze it once it has converged
+ *
+ *             A, R, C and Q are constant and the covariance does not depend on the state,
+ *             so with fixes at a constant period the covariance becomes periodic and the
+ *             gain constant. After KALMAN_STEADY_STATE_FIXES fixes with the same period and
+ *             gain, the filter stops propagating the covariance and reuses the gain.
+ *
+ * @param      kf    The filter, with Cov_new the covariance right after the fix
+ * @param[in]  K     The gains of the x and y updates of this fix
+ */
+static void kalman_filter_steady_state_check(kalman_filter_t *kf, float K[2][6])
+{
+    bool unchanged = kf->steps_since_gps == kf->gps_period;
+    int i, j;
+
+    for (i = 0; i < 2 && unchanged; i++)
+    {
+        for (j = 0; j < 6; j++)
+        {
+            if (fabs(K[i][j] - kf->K_gps[i][j]) > KALMAN_STEADY_STATE_TOL * fabs(kf->K_gps[i][j]))
+                unchanged = false;
+        }
+    }
+    kf->converged_fixes = unchanged ? kf->converged_fixes + 1 : 0;
+    kf->gps_period = kf->steps_since_gps;
+    memcpy(kf->K_gps, K, sizeof(kf->K_gps));
+    MatCopy(&kf->Cov_new.mat, &kf->Cov_gps.mat);
+
+    if (kf->converged_fixes >= KALMAN_STEADY_STATE_FIXES)
+        kf->steady = true;
+}
+
+/**
+ * @brief      Leave the steady state when a fix breaks the period
+ *
+ *             The covariance is rebuilt by propagating the covariance of the last fix over
+ *             the steps since, so the full update of this fix starts from the right Cov_new.
+ *             A fix early or on time rebuilds at most gps_period steps, a missing fix leaves
+ *             the steady state one step after it was due, so an outage costs one rebuild.
+ *
+ * @param      kf    The filter
+ */
+static void kalman_filter_steady_state_leave(kalman_filter_t *kf)
+{
+    int i;
+
+    MatCopy(&kf->Cov_gps.mat, &kf->Cov.mat);
+    for (i = 0; i < kf->steps_since_gps; i++)
+    {
+        kalman_filter_predict_cov(kf);
+        MatCopy(&kf->Cov_new.mat, &kf->Cov.mat);
+    }
+    kf->steady = false;
+    kf->converged_fixes = 0;
+}
+
+void kalman_filter_compute_pose(kalman_filter_t *kf, pose_t *state_kalman, pose_t *gps_pose, bool gps_updated, double Aleft_enc, double Aright_enc)
 {
     Aleft_enc *= WHEEL_RADIUS;
     Aright_enc *= WHEEL_RADIUS;
-    float X_value[] = {estimate_state.x, estimate_state.y, estimate_state.theta, estimate_state.vx, estimate_state.vy, estimate_state.omega};
-    MatSetVal(&X, X_value);
+    float X_value[] = {kf->estimate_state.x, kf->estimate_state.y, kf->estimate_state.theta, kf->estimate_state.vx, kf->estimate_state.vy, kf->estimate_state.omega};
+    MatSetVal(&kf->X.mat, X_value);
     float u_value[] = {Aleft_enc, Aright_enc};
-    MatSetVal(&u, u_value);
+    MatSetVal(&kf->u.mat, u_value);
     // X_new = A * X + B * acc
     // In order to get conparable result with the localization with purely encorder odometry, we first update velocity and then the pose
-    double vx_new = cos(estimate_state.theta) / (2.0 * _T) * (Aleft_enc + Aright_enc);
-    double vy_new = sin(estimate_state.theta) / (2.0 * _T) * (Aleft_enc + Aright_enc);
-    double omega_new = -1 / (WHEEL_AXIS * _T) * Aleft_enc + 1 / (WHEEL_AXIS * _T) * Aright_enc;
-    double x_new = estimate_state.x + vx_new * _T;
-    double y_new = estimate_state.y + vy_new * _T;
-    double theta_new = estimate_state.theta + omega_new * _T;
+    double vx_new = cos(kf->estimate_state.theta) / (2.0 * kf->T) * (Aleft_enc + Aright_enc);
+    double vy_new = sin(kf->estimate_state.theta) / (2.0 * kf->T) * (Aleft_enc + Aright_enc);
+    double omega_new = -1 / (WHEEL_AXIS * kf->T) * Aleft_enc + 1 / (WHEEL_AXIS * kf->T) * Aright_enc;
+    double x_new = kf->estimate_state.x + vx_new * kf->T;
+    double y_new = kf->estimate_state.y + vy_new * kf->T;
+    double theta_new = kf->estimate_state.theta + omega_new * kf->T;
     float X_new_value[] = {x_new, y_new, theta_new, vx_new, vy_new, omega_new};
-    Mat X_new;
-    MatCreate(&X_new, 6, 1);
-    MatSetVal(&X_new, X_new_value);
-
-    // Con_new = A * Cov * A' + R * dt
-    Mat ACov = MatMul(&A, &Cov);
-    Mat A_trans = MatTrans(&A);
-    Mat ACovA_trans = MatMul(&ACov, &A_trans);
-    Mat R_T = MatExpd(&R, &_T);
-    Mat Cov_new = MatAdd(&ACovA_trans, &R_T);
+    MatSetVal(&kf->X_new.mat, X_new_value);
+
+    // Con_new = A * Cov * A' + R * dt, not needed while the gain is frozen
+    kf->steps_since_gps++;
+    if (!kf->steady)
+        kalman_filter_predict_cov(kf);
+    else if (kf->steps_since_gps > kf->gps_period)
+        kalman_filter_steady_state_leave(kf); // The fix is late, the rebuild covers this step
     if (gps_updated)
     {
         float meas_value[] = {gps_pose->x, gps_pose->y};
-        MatSetVal(&meas, meas_value);
-        //     // K = Cov_new * C' * inv(C * Cov_new * C' + Q)
-        Mat C_trans = MatTrans(&C);
-        Mat inter1 = MatMul(&C, &Cov_new);
-        Mat inter2 = MatMul(&inter1, &C_trans);
-        Mat inter3 = MatAdd(&inter2, &Q);
-        Mat inter4 = MatInv(&inter3);
-        Mat inter5 = MatMul(&Cov_new, &C_trans);
-        Mat K = MatMul(&inter5, &inter4);
-        // X_new = X_new + K * (z - C * X_new)
-        Mat inter6 = MatMul(&C, &X_new);
-        Mat inter7 = MatSub(&meas, &inter6);
-        Mat inter8 = MatMul(&K, &inter7);
-        Mat X_update = MatAdd(&X_new, &inter8);
-        MatCopy(&X_update, &X_new);
-        // Cov_new = (I - K * C) * Cov_new
-        Mat inter9 = MatMul(&K, &C);
-        Mat inter10 = MatSub(&I, &inter9);
-        Mat Cov_update = MatMul(&inter10, &Cov_new);
-        MatCopy(&Cov_update, &Cov_new);
-
-        MatDelete(&C_trans);
-        MatDelete(&inter1);
-        MatDelete(&inter2);
-        MatDelete(&inter3);
-        MatDelete(&inter4);
-        MatDelete(&inter5);
-        MatDelete(&K);
-        MatDelete(&inter6);
-        MatDelete(&inter7);
-        MatDelete(&inter8);
-        MatDelete(&X_update);
-        MatDelete(&inter9);
-        MatDelete(&inter10);
-        MatDelete(&Cov_update);
+        MatSetVal(&kf->meas.mat, meas_value);
+        if (kf->steady && kf->steps_since_gps != kf->gps_period)
+        {
+            // The gps schedule changed, back to the full filter
+            kalman_filter_steady_state_leave(kf);
+        }
+        if (kf->steady)
+        {
+            // X_new = X_new + K * (z - X_new[index]) with the frozen gains
+            float *X_new = kf->X_new.mat.data;
+            float innovation;
+            int i, index;
+
+            for (index = 0; index < 2; index++)
+            {
+                innovation = kf->meas.mat.data[index] - X_new[index];
+                for (i = 0; i < 6; i++)
+                    X_new[i] += kf->K_gps[index][i] * innovation;
+            }
+        }
+        else if (KALMAN_SEQUENTIAL_GPS_UPDATE)
+        {
+            // Q is diagonal and C picks x and y, so the two components are fused one after the other
+            float K[2][6];
+
+            kalman_filter_update_scalar(&kf->X_new.mat, &kf->Cov_new.mat, 0, kf->meas.mat.element[0][0], kf->Q.mat.element[0][0], K[0]);
+            kalman_filter_update_scalar(&kf->X_new.mat, &kf->Cov_new.mat, 1, kf->meas.mat.element[1][0], kf->Q.mat.element[1][1], K[1]);
+            if (KALMAN_STEADY_STATE_GAIN)
+                kalman_filter_steady_state_check(kf, K);
+        }
+        else
+        {
+            // K = Cov_new * C' * inv(C * Cov_new * C' + Q)
+            // S and Cov_new are symmetric, so K' = S \ (C * Cov_new) is solved by Cholesky without forming inv(S)
+            MatMulInto(&kf->CCov.mat, &kf->C.mat, &kf->Cov_new.mat);
+            MatTransMulInto(&kf->S.mat, &kf->CCov.mat, &kf->C.mat);
+            MatAddInto(&kf->S.mat, &kf->S.mat, &kf->Q.mat);
+            MatCholesky(&kf->S_chol.mat, &kf->S.mat);
+            MatCholSolve(&kf->K_trans.mat, &kf->S_chol.mat, &kf->CCov.mat);
+            MatTransInto(&kf->K.mat, &kf->K_trans.mat);
+            // X_new = X_new + K * (z - C * X_new)
+            MatMulInto(&kf->CX.mat, &kf->C.mat, &kf->X_new.mat);
+            MatSubInto(&kf->innov.mat, &kf->meas.mat, &kf->CX.mat);
+            MatMulInto(&kf->K_innov.mat, &kf->K.mat, &kf->innov.mat);
+            MatAddInto(&kf->X_new.mat, &kf->X_new.mat, &kf->K_innov.mat);
+            // Cov_new = (I - K * C) * Cov_new
+            MatMulInto(&kf->KC.mat, &kf->K.mat, &kf->C.mat);
+            MatSubInto(&kf->IKC.mat, &kf->I.mat, &kf->KC.mat);
+            MatMulInto(&kf->Cov_update.mat, &kf->IKC.mat, &kf->Cov_new.mat);
+            MatCopy(&kf->Cov_update.mat, &kf->Cov_new.mat);
+        }
+        kf->steps_since_gps = 0;
     }
-    estimate_state.x = X_new.element[0][0];
-    estimate_state.y = X_new.element[1][0];
-    estimate_state.theta = X_new.element[2][0];
-    estimate_state.vx = X_new.element[3][0];
-    estimate_state.vy = X_new.element[4][0];
-    estimate_state.omega = X_new.element[5][0];
-    MatCopy(&Cov_new, &Cov);
-
-    state_kalman->x = estimate_state.x;
-    state_kalman->y = estimate_state.y;
-    state_kalman->heading = estimate_state.theta;
+    kf->estimate_state.x = kf->X_new.mat.element[0][0];
+    kf->estimate_state.y = kf->X_new.mat.element[1][0];
+    kf->estimate_state.theta = kf->X_new.mat.element[2][0];
+    kf->estimate_state.vx = kf->X_new.mat.element[3][0];
+    kf->estimate_state.vy = kf->X_new.mat.element[4][0];
+    kf->estimate_state.omega = kf->X_new.mat.element[5][0];
+    if (!kf->steady)
+        MatCopy(&kf->Cov_new.mat, &kf->Cov.mat);
+
+    state_kalman->x = kf->estimate_state.x;
+    state_kalman->y = kf->estimate_state.y;
+    state_kalman->heading = kf->estimate_state.theta;
 
     //printf("Kalman estimated pose is: %f, %f, %f \n", -2.9 + estimate_state->x, estimate_state->y, estimate_state->theta);
-    // MatDelete(&AX);
-    // MatDelete(&B);
-    // MatDelete(&Bu);
-    // MatDelete(&X_new);
-    // MatDelete(&ACov);
-    // MatDelete(&A_trans);
-    // MatDelete(&ACovA_trans);
-    // MatDelete(&R_T);
-    // MatDelete(&Cov_new);
+}
+
+/**
+ * @brief      Cov = F * Cov * F' + G * N * G' for the unicycle step of kalman_filter_ekf_compute_pose
+ *
+ *             F = [1, 0, f02; 0, 1, f12; 0, 0, 1] is the Jacobian of the step with respect to
+ *             the state and G (3x2) the Jacobian with respect to the wheel displacements,
+ *             whose noise N = diag(n_left, n_right) is independent.
+ *
+ * @param      cov      The covariance (3x3, symmetric), updated in place
+ * @param[in]  f02      The derivative of x with respect to theta
+ * @param[in]  f12      The derivative of y with respect to theta
+ * @param[in]  G        The derivatives of [x, y, theta] with respect to [left, right] displacements
+ * @param[in]  n_left   The variance of the left wheel displacement
+ * @param[in]  n_right  The variance of the right wheel displacement
+ */
+static void kalman_filter_ekf_propagate_cov(Mat *cov, float f02, float f12, const float G[3][2], float n_left, float n_right)
+{
+    float *P = cov->data;
+    float FP[3][3];
+    float value;
+    int i, j;
+
+    // F * Cov, F only adds theta row multiples to the x and y rows
+    for (j = 0; j < 3; j++)
+    {
+        FP[0][j] = P[0 * 3 + j] + f02 * P[2 * 3 + j];
+        FP[1][j] = P[1 * 3 + j] + f12 * P[2 * 3 + j];
+        FP[2][j] = P[2 * 3 + j];
+    }
+    // (F * Cov) * F' + G * N * G', symmetric so only the upper triangle is computed
+    for (i = 0; i < 3; i++)
+    {
+        for (j = i; j < 3; j++)
+        {
+            value = FP[i][j] + G[i][0] * n_left * G[j][0] + G[i][1] * n_right * G[j][1];
+            if (j == 0)
+                value += f02 * FP[i][2];
+            if (j == 1)
+                value += f12 * FP[i][2];
+            P[i * 3 + j] = value;
+            P[j * 3 + i] = value;
+        }
+    }
+}
+
+/**
+ * @brief      Extended Kalman filter step with the unicycle model, X = [x, y, theta]
+ *
+ *             The encoder displacements are the control input. The state moves by the
+ *             travelled distance along the heading at mid step, and the covariance is
+ *             propagated with the Jacobian of that step, so the heading uncertainty flows
+ *             into the position uncertainty. GPS fixes are fused as two scalar updates.
+ *
+ * @param      kf            The filter
+ * @param      state_kalman  The estimated pose
+ * @param[in]  gps_pose      The gps pose, read only when gps_updated is set
+ * @param[in]  gps_updated   Whether a new gps fix is available
+ * @param[in]  Aleft_enc     The delta left encoder
+ * @param[in]  Aright_enc    The delta right encoder
+ */
+void kalman_filter_ekf_compute_pose(kalman_filter_t *kf, pose_t *state_kalman, pose_t *gps_pose, bool gps_updated, double Aleft_enc, double Aright_enc)
+{
+    float *X = kf->ekf_X.mat.data;
+    Aleft_enc *= WHEEL_RADIUS;
+    Aright_enc *= WHEEL_RADIUS;
+
+    double distance = (Aleft_enc + Aright_enc) / 2.0;
+    double rotation = (Aright_enc - Aleft_enc) / WHEEL_AXIS;
+    double heading = X[2] + rotation / 2.0;
+    double cos_heading = cos(heading);
+    double sin_heading = sin(heading);
+
+    // Jacobians of the step with respect to the state (F) and to [left, right] displacements (G)
+    float f02 = -distance * sin_heading;
+    float f12 = distance * cos_heading;
+    float G[3][2] = {
+        {cos_heading / 2.0 + distance * sin_heading / (2.0 * WHEEL_AXIS), cos_heading / 2.0 - distance * sin_heading / (2.0 * WHEEL_AXIS)},
+        {sin_heading / 2.0 - distance * cos_heading / (2.0 * WHEEL_AXIS), sin_heading / 2.0 + distance * cos_heading / (2.0 * WHEEL_AXIS)},
+        {-1.0 / WHEEL_AXIS, 1.0 / WHEEL_AXIS}};
+
+    X[0] += distance * cos_heading;
+    X[1] += distance * sin_heading;
+    X[2] += rotation;
+    kalman_filter_ekf_propagate_cov(&kf->ekf_Cov.mat, f02, f12, G, EKF_WHEEL_NOISE * fabs(Aleft_enc), EKF_WHEEL_NOISE * fabs(Aright_enc));
+    kf->ekf_step.f02 = f02;
+    kf->ekf_step.f12 = f12;
+    memcpy(kf->ekf_step.X_pred, X, sizeof(kf->ekf_step.X_pred));
+    memcpy(kf->ekf_step.Cov_pred, kf->ekf_Cov.data, sizeof(kf->ekf_step.Cov_pred));
+
+    if (gps_updated)
+    {
+        kalman_filter_update_scalar(&kf->ekf_X.mat, &kf->ekf_Cov.mat, 0, gps_pose->x, EKF_GPS_NOISE, NULL);
+        kalman_filter_update_scalar(&kf->ekf_X.mat, &kf->ekf_Cov.mat, 1, gps_pose->y, EKF_GPS_NOISE, NULL);
+    }
+
+    state_kalman->x = X[0];
+    state_kalman->y = X[1];
+    state_kalman->heading = X[2];
+}
 
-    // MatDelete(&X);
+/**
+ * @brief      Copy the last EKF step, what a Rauch-Tung-Striebel smoother needs to go back over it
+ *
+ * @param[in]  kf    The filter
+ * @param      step  The prediction, Jacobian and filtered estimate of the last step
+ */
+void kalman_filter_ekf_record(const kalman_filter_t *kf, kalman_filter_ekf_step_t *step)
+{
+    memcpy(step, &kf->ekf_step, sizeof(kalman_filter_ekf_step_t));
+    memcpy(step->X, kf->ekf_X.data, sizeof(step->X));
+    memcpy(step->Cov, kf->ekf_Cov.data, sizeof(step->Cov));
 }
 
-void kalman_filter_reset(int time_step, pose_t *pose_origin, int robot_id)
+void kalman_filter_reset(kalman_filter_t *kf, int time_step, pose_t *pose_origin, int robot_id)
 {
-    _robot_id = robot_id;
-    _T = time_step / 1000.0;
-    prev_gps_time = 0.0;
+    kf->robot_id = robot_id;
+    kf->T = time_step / 1000.0;
+    kf->prev_gps_time = 0.0;
 
-    MatCreate(&X, 6, 1);
-    MatCreate(&u, 2, 1);
-    MatCreate(&meas, 2, 1);
+    MatInitFixed(&kf->X, 6, 1);
+    MatInitFixed(&kf->u, 2, 1);
+    MatInitFixed(&kf->meas, 2, 1);
     float R_value[] = {
         0.1, 0.0, 0.0, 0.0, 0.0, 0.0,
         0.0, 0.1, 0.0, 0.0, 0.0, 0.0,
@@ -132,8 +530,8 @@ void kalman_filter_reset(int time_step, pose_t *pose_origin, int robot_id)
         0.0, 0.0, 0.0, 0.1, 0.0, 0.0,
         0.0, 0.0, 0.0, 0.0, 0.1, 0.0,
         0.0, 0.0, 0.0, 0.0, 0.0, 0.1};
-    MatCreate(&R, 6, 6);
-    MatSetVal(&R, R_value);
+    MatInitFixed(&kf->R, 6, 6);
+    MatSetVal(&kf->R.mat, R_value);
     float Cov_value[] = {
         0.001, 0.0, 0.0, 0.0, 0.0, 0.0,
         0.0, 0.001, 0.0, 0.0, 0.0, 0.0,
@@ -141,45 +539,236 @@ void kalman_filter_reset(int time_step, pose_t *pose_origin, int robot_id)
         0.0, 0.0, 0.0, 0.001, 0.0, 0.0,
         0.0, 0.0, 0.0, 0.0, 0.001, 0.0,
         0.0, 0.0, 0.0, 0.0, 0.0, 0.001};
-    MatCreate(&Cov, 6, 6);
-    MatSetVal(&Cov, Cov_value);
+    MatInitFixed(&kf->Cov, 6, 6);
+    MatSetVal(&kf->Cov.mat, Cov_value);
     float A_value[] = {
-        1.0, 0.0, 0.0, _T, 0.0, 0.0,
-        0.0, 1.0, 0.0, 0.0, _T, 0.0,
-        0.0, 0.0, 1.0, 0.0, 0.0, _T,
+        1.0, 0.0, 0.0, kf->T, 0.0, 0.0,
+        0.0, 1.0, 0.0, 0.0, kf->T, 0.0,
+        0.0, 0.0, 1.0, 0.0, 0.0, kf->T,
         0.0, 0.0, 0.0, 0.0, 0.0, 0.0,
         0.0, 0.0, 0.0, 0.0, 0.0, 0.0,
         0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
-    MatCreate(&A, 6, 6);
-    MatSetVal(&A, A_value);
+    MatInitFixed(&kf->A, 6, 6);
+    MatSetVal(&kf->A.mat, A_value);
     float C_value[] = {
         1.0, 0.0, 0.0, 0.0, 0.0, 0.0,
         0.0, 1.0, 0.0, 0.0, 0.0, 0.0};
-    MatCreate(&C, 2, 6);
-    MatSetVal(&C, C_value);
+    MatInitFixed(&kf->C, 2, 6);
+    MatSetVal(&kf->C.mat, C_value);
     float Q_value[] = {
         0.01, 0.0,
         0.0, 0.01};
-    MatCreate(&Q, 2, 2);
-    MatSetVal(&Q, Q_value);
-    MatCreate(&I, 6, 6);
-    MatEye(&I);
-
-    memset(&estimate_state, 0, sizeof(state_t));
-    estimate_state.x = pose_origin->x;
-    estimate_state.y = pose_origin->y;
-    estimate_state.theta = pose_origin->heading;
-}
-
-void kalman_filter_cleanup()
-{
-    MatDelete(&X);
-    MatDelete(&u);
-    MatDelete(&R);
-    MatDelete(&Cov);
-    MatDelete(&A);
-    MatDelete(&meas);
-    MatDelete(&C);
-    MatDelete(&Q);
-    MatDelete(&I);
-}
\ No newline at end of file
+    MatInitFixed(&kf->Q, 2, 2);
+    MatSetVal(&kf->Q.mat, Q_value);
+    MatInitFixed(&kf->I, 6, 6);
+    MatEye(&kf->I.mat);
+
+    // R and T are constant, so the process noise of a step is computed only once. R is not the
+    // step covariance of the encoder odometry (odo_get_covariance): the velocities are overwritten
+    // from the encoders at every step and the steady-state gain needs a constant R. The EKF takes
+    // that covariance, G * N * G' with the odometry wheel noise, see kalman_filter_ekf_compute_pose.
+    MatInitFixed(&kf->R_T, 6, 6);
+    MatExpdInto(&kf->R_T.mat, &kf->R.mat, &kf->T);
+
+    MatInitFixed(&kf->X_new, 6, 1);
+    MatInitFixed(&kf->ACov, 6, 6);
+    MatInitFixed(&kf->Cov_new, 6, 6);
+    MatInitFixed(&kf->CCov, 2, 6);
+    MatInitFixed(&kf->S, 2, 2);
+    MatInitFixed(&kf->S_chol, 2, 2);
+    MatInitFixed(&kf->K_trans, 2, 6);
+    MatInitFixed(&kf->K, 6, 2);
+    MatInitFixed(&kf->CX, 2, 1);
+    MatInitFixed(&kf->innov, 2, 1);
+    MatInitFixed(&kf->K_innov, 6, 1);
+    MatInitFixed(&kf->KC, 6, 6);
+    MatInitFixed(&kf->IKC, 6, 6);
+    MatInitFixed(&kf->Cov_update, 6, 6);
+
+    kf->steady = false;
+    kf->steps_since_gps = 0;
+    kf->gps_period = -1;
+    kf->converged_fixes = 0;
+    memset(kf->K_gps, 0, sizeof(kf->K_gps));
+    MatInitFixed(&kf->Cov_gps, 6, 6);
+
+    float ekf_X_value[] = {pose_origin->x, pose_origin->y, pose_origin->heading};
+    MatInitFixed(&kf->ekf_X, 3, 1);
+    MatSetVal(&kf->ekf_X.mat, ekf_X_value);
+    float ekf_Cov_value[] = {
+        0.001, 0.0, 0.0,
+        0.0, 0.001, 0.0,
+        0.0, 0.0, 0.001};
+    MatInitFixed(&kf->ekf_Cov, 3, 3);
+    MatSetVal(&kf->ekf_Cov.mat, ekf_Cov_value);
+
+    memset(&kf->estimate_state, 0, sizeof(state_t));
+    kf->estimate_state.x = pose_origin->x;
+    kf->estimate_state.y = pose_origin->y;
+    kf->estimate_state.theta = pose_origin->heading;
+}
+
+/**
+ * @brief      Fuse a measurement of the position into the filter of kalman_filter_compute_pose
+ *
+ *             Meant for measurements other than the gps, e.g. relative to a neighbour, taken
+ *             at the time of the last step. A frozen gain no longer holds after it, so the
+ *             steady state is left first and its convergence count restarts. The steady-state
+ *             gain and these measurements therefore exclude each other: with a neighbour fix
+ *             every few steps the filter stays on the full update.
+ *
+ * @param      kf            The filter
+ * @param      state_kalman  The estimated pose after the update
+ * @param[in]  position      The measured position
+ * @param[in]  r             The measurement covariance {xx, xy, yy}
+ *
+ * @return     false if the measurement was rejected
+ */
+bool kalman_filter_fuse_position(kalman_filter_t *kf, pose_t *state_kalman, const pose_t *position, const float r[3])
+{
+    bool fused;
+
+    if (kf->steady)
+        kalman_filter_steady_state_leave(kf);
+    float X_value[] = {kf->estimate_state.x, kf->estimate_state.y, kf->estimate_state.theta, kf->estimate_state.vx, kf->estimate_state.vy, kf->estimate_state.omega};
+    MatSetVal(&kf->X.mat, X_value);
+    fused = kalman_filter_update_position(&kf->X.mat, &kf->Cov.mat, position->x, position->y, r);
+    if (fused)
+    {
+        kf->estimate_state.x = kf->X.mat.data[0];
+        kf->estimate_state.y = kf->X.mat.data[1];
+        kf->estimate_state.theta = kf->X.mat.data[2];
+        kf->estimate_state.vx = kf->X.mat.data[3];
+        kf->estimate_state.vy = kf->X.mat.data[4];
+        kf->estimate_state.omega = kf->X.mat.data[5];
+        kf->converged_fixes = 0;
+    }
+    state_kalman->x = kf->estimate_state.x;
+    state_kalman->y = kf->estimate_state.y;
+    state_kalman->heading = kf->estimate_state.theta;
+    return fused;
+}
+
+/**
+ * @brief      Fuse a measurement of the position into the filter of kalman_filter_ekf_compute_pose
+ *
+ * @param      kf            The filter
+ * @param      state_kalman  The estimated pose after the update
+ * @param[in]  position      The measured position
+ * @param[in]  r             The measurement covariance {xx, xy, yy}
+ *
+ * @return     false if the measurement was rejected
+ */
+bool kalman_filter_ekf_fuse_position(kalman_filter_t *kf, pose_t *state_kalman, const pose_t *position, const float r[3])
+{
+    bool fused = kalman_filter_update_position(&kf->ekf_X.mat, &kf->ekf_Cov.mat, position->x, position->y, r);
+
+    state_kalman->x = kf->ekf_X.data[0];
+    state_kalman->y = kf->ekf_X.data[1];
+    state_kalman->heading = kf->ekf_X.data[2];
+    return fused;
+}
+
+/**
+ * @brief      Covariance of the position estimated by kalman_filter_compute_pose
+ *
+ *             The covariance at the last step, also while the gain is frozen. It then costs
+ *             one propagation per step since the last gps fix.
+ *
+ * @param[in]  kf    The filter
+ * @param      cov   The covariance {xx, xy, yy}
+ */
+void kalman_filter_get_position_cov(const kalman_filter_t *kf, float cov[3])
+{
+    MatFixed propagated, scratch;
+    const float *P = kf->Cov.data;
+    int i;
+
+    // While the gain is frozen Cov is not propagated, so it is rebuilt from the covariance after
+    // the last fix, as kalman_filter_steady_state_leave does, without touching the filter.
+    // That is at most gps_period steps, a late fix ends the steady state.
+    if (kf->steady)
+    {
+        MatInitFixed(&propagated, 6, 6);
+        MatInitFixed(&scratch, 6, 6);
+        MatCopy(&kf->Cov_gps.mat, &propagated.mat);
+        for (i = 0; i < kf->steps_since_gps; i++)
+        {
+            kalman_filter_propagate_cov(&scratch.mat, &propagated.mat, &kf->R_T.mat, kf->T);
+            MatCopy(&scratch.mat, &propagated.mat);
+        }
+        P = propagated.mat.data;
+    }
+    cov[0] = P[0 * 6 + 0];
+    cov[1] = P[0 * 6 + 1];
+    cov[2] = P[1 * 6 + 1];
+}
+
+/**
+ * @brief      Covariance of the position estimated by kalman_filter_ekf_compute_pose
+ *
+ * @param[in]  kf    The filter
+ * @param      cov   The covariance {xx, xy, yy}
+ */
+void kalman_filter_ekf_get_position_cov(const kalman_filter_t *kf, float cov[3])
+{
+    cov[0] = kf->ekf_Cov.data[0 * 3 + 0];
+    cov[1] = kf->ekf_Cov.data[0 * 3 + 1];
+    cov[2] = kf->ekf_Cov.data[1 * 3 + 1];
+}
+
+/**
+ * @brief      Save the evolving part of the filter
+ *
+ * @param[in]  kf     The filter
+ * @param      state  The saved state
+ */
+void kalman_filter_save(const kalman_filter_t *kf, kalman_filter_state_t *state)
+{
+    state->estimate_state = kf->estimate_state;
+    memcpy(state->Cov, kf->Cov.data, sizeof(state->Cov));
+    memcpy(state->ekf_X, kf->ekf_X.data, sizeof(state->ekf_X));
+    memcpy(state->ekf_Cov, kf->ekf_Cov.data, sizeof(state->ekf_Cov));
+    state->steady = kf->steady;
+    state->steps_since_gps = kf->steps_since_gps;
+    state->gps_period = kf->gps_period;
+    state->converged_fixes = kf->converged_fixes;
+    memcpy(state->K_gps, kf->K_gps, sizeof(state->K_gps));
+    memcpy(state->Cov_gps, kf->Cov_gps.data, sizeof(state->Cov_gps));
+}
+
+/**
+ * @brief      Roll the filter back to a state saved with kalman_filter_save
+ *
+ * @param      kf     The filter
+ * @param[in]  state  The saved state
+ */
+void kalman_filter_restore(kalman_filter_t *kf, const kalman_filter_state_t *state)
+{
+    kf->estimate_state = state->estimate_state;
+    memcpy(kf->Cov.data, state->Cov, sizeof(state->Cov));
+    memcpy(kf->ekf_X.data, state->ekf_X, sizeof(state->ekf_X));
+    memcpy(kf->ekf_Cov.data, state->ekf_Cov, sizeof(state->ekf_Cov));
+    kf->steady = state->steady;
+    kf->steps_since_gps = state->steps_since_gps;
+    kf->gps_period = state->gps_period;
+    kf->converged_fixes = state->converged_fixes;
+    memcpy(kf->K_gps, state->K_gps, sizeof(state->K_gps));
+    memcpy(kf->Cov_gps.data, state->Cov_gps, sizeof(state->Cov_gps));
+}
+
+kalman_filter_t *kalman_filter_create()
+{
+    kalman_filter_t *kf = (kalman_filter_t *)calloc(1, sizeof(kalman_filter_t));
+
+    if (kf == NULL)
+        printf("kalman filter create fail!\n");
+
+    return kf;
+}
+
+void kalman_filter_destroy(kalman_filter_t *kf)
+{
+    // All matrices live in fixed-capacity storage inside the filter
+    free(kf);
+}
@@ -0,0 +1,315 @@
+#include "kalman_filter_batch.h"
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+//-----------------------------------------------------------------------------------//
+/*CONSTANTES*/
+#define WHEEL_AXIS 0.057    // Distance between the two wheels in meter
+#define WHEEL_RADIUS 0.0200 // Radius of the wheel in meter
+
+// Same noise model as kalman_filter_reset: diagonal R, Q and initial Cov
+#define KFB_R_DIAG 0.1f
+#define KFB_Q_DIAG 0.01f
+#define KFB_COV_DIAG 0.001f
+
+#define KFB_STATE_DIM 6
+#define KFB_COV_SIZE 21 // Upper triangle of the 6x6 covariance
+
+/*SIMD*/
+// One robot per lane. The kernels only use add, sub, mul and div in the order of the
+// scalar filter, so each lane rounds exactly like kalman_filter_compute_pose.
+#if defined(__AVX__)
+#include <immintrin.h>
+#define KFB_LANES 8
+typedef __m256 kfb_vec;
+#define KFB_LOAD(p) _mm256_loadu_ps(p)
+#define KFB_STORE(p, v) _mm256_storeu_ps(p, v)
+#define KFB_SET1(a) _mm256_set1_ps(a)
+#define KFB_ADD(a, b) _mm256_add_ps(a, b)
+#define KFB_SUB(a, b) _mm256_sub_ps(a, b)
+#define KFB_MUL(a, b) _mm256_mul_ps(a, b)
+#define KFB_DIV(a, b) _mm256_div_ps(a, b)
+#define KFB_MASK(m) _mm256_cmp_ps(m, _mm256_setzero_ps(), _CMP_NEQ_OQ)
+#define KFB_SELECT(mask, a, b) _mm256_blendv_ps(b, a, mask)
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+#define KFB_LANES 4
+typedef __m128 kfb_vec;
+#define KFB_LOAD(p) _mm_loadu_ps(p)
+#define KFB_STORE(p, v) _mm_storeu_ps(p, v)
+#define KFB_SET1(a) _mm_set1_ps(a)
+#define KFB_ADD(a, b) _mm_add_ps(a, b)
+#define KFB_SUB(a, b) _mm_sub_ps(a, b)
+#define KFB_MUL(a, b) _mm_mul_ps(a, b)
+#define KFB_DIV(a, b) _mm_div_ps(a, b)
+#define KFB_MASK(m) _mm_cmpneq_ps(m, _mm_setzero_ps())
+#define KFB_SELECT(mask, a, b) _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b))
+#else
+#define KFB_LANES 1
+typedef float kfb_vec;
+#define KFB_LOAD(p) (*(p))
+#define KFB_STORE(p, v) (*(p) = (v))
+#define KFB_SET1(a) (a)
+#define KFB_ADD(a, b) ((a) + (b))
+#define KFB_SUB(a, b) ((a) - (b))
+#define KFB_MUL(a, b) ((a) * (b))
+#define KFB_DIV(a, b) ((a) / (b))
+#define KFB_MASK(m) (m)
+#define KFB_SELECT(mask, a, b) ((mask) != 0.0f ? (a) : (b))
+#endif
+
+// Position of element (i, j) of the symmetric covariance in the upper triangle storage
+static const int kfb_tri[KFB_STATE_DIM][KFB_STATE_DIM] = {
+    {0, 1, 2, 3, 4, 5},
+    {1, 6, 7, 8, 9, 10},
+    {2, 7, 11, 12, 13, 14},
+    {3, 8, 12, 15, 16, 17},
+    {4, 9, 13, 16, 18, 19},
+    {5, 10, 14, 17, 19, 20}};
+
+struct kalman_filter_batch
+{
+    int robot_count;
+    int capacity; // robot_count rounded up to a multiple of KFB_LANES
+    double T;
+    float dt;
+    float r_t; // Diagonal of the process noise of a step, R * dt
+
+    // Estimated state, component by component, in double like state_t
+    double *x;
+    double *y;
+    double *theta;
+    double *vx;
+    double *vy;
+    double *omega;
+
+    // Float arrays of capacity entries each, indexed [component * capacity + robot]
+    float *X_new;    // Predicted state (6 components)
+    float *Cov;      // Covariance (KFB_COV_SIZE components)
+    float *meas;     // GPS measurement (2 components)
+    float *gps_mask; // Non zero when the robot received a GPS fix this step
+};
+
+/**
+ * @brief      Covariance propagation and GPS update of KFB_LANES robots starting at robot first
+ *
+ *             Lane by lane this is kalman_filter_propagate_cov followed, for the robots with
+ *             a GPS fix, by the two kalman_filter_update_scalar calls of the sequential update.
+ *
+ * @param      kfb         The batch filter
+ * @param[in]  first       The first robot of the block
+ * @param[in]  gps_update  Whether any robot of the batch received a GPS fix this step
+ */
+static void kalman_filter_batch_step_block(kalman_filter_batch_t *kfb, int first, bool gps_update)
+{
+    const int cap = kfb->capacity;
+    kfb_vec P[KFB_COV_SIZE];
+    kfb_vec P_new[KFB_COV_SIZE];
+    kfb_vec dt = KFB_SET1(kfb->dt);
+    kfb_vec dt2 = KFB_MUL(dt, dt);
+    kfb_vec zero = KFB_SET1(0.0f);
+    kfb_vec r_t = KFB_SET1(kfb->r_t);
+    kfb_vec value;
+    int i, j, k;
+
+    for (k = 0; k < KFB_COV_SIZE; k++)
+        P[k] = KFB_LOAD(kfb->Cov + k * cap + first);
+
+    // Cov_new = A * Cov * A' + R * dt, only the position block depends on Cov
+    for (i = 0; i < KFB_STATE_DIM; i++)
+    {
+        for (j = i; j < KFB_STATE_DIM; j++)
+        {
+            value = (i == j) ? r_t : zero;
+            if (j < 3)
+                value = KFB_ADD(value, KFB_ADD(KFB_ADD(P[kfb_tri[i][j]], KFB_MUL(dt, KFB_ADD(P[kfb_tri[i][j + 3]], P[kfb_tri[j][i + 3]]))), KFB_MUL(dt2, P[kfb_tri[i + 3][j + 3]])));
+            P_new[kfb_tri[i][j]] = value;
+        }
+    }
+
+    if (gps_update)
+    {
+        kfb_vec mask = KFB_MASK(KFB_LOAD(kfb->gps_mask + first));
+        kfb_vec q = KFB_SET1(KFB_Q_DIAG);
+        kfb_vec X[KFB_STATE_DIM];
+        kfb_vec X_upd[KFB_STATE_DIM];
+        kfb_vec P_upd[KFB_COV_SIZE];
+        kfb_vec P_col[KFB_STATE_DIM];
+        kfb_vec K_col[KFB_STATE_DIM];
+        kfb_vec s, z, innovation;
+        int index;
+
+        for (i = 0; i < KFB_STATE_DIM; i++)
+            X[i] = X_upd[i] = KFB_LOAD(kfb->X_new + i * cap + first);
+        for (k = 0; k < KFB_COV_SIZE; k++)
+            P_upd[k] = P_new[k];
+
+        // Fuse x then y, see kalman_filter_update_scalar
+        for (index = 0; index < 2; index++)
+        {
+            for (i = 0; i < KFB_STATE_DIM; i++)
+                P_col[i] = P_upd[kfb_tri[i][index]];
+            s = KFB_ADD(P_col[index], q);
+            for (i = 0; i < KFB_STATE_DIM; i++)
+                K_col[i] = KFB_DIV(P_col[i], s);
+
+            z = KFB_LOAD(kfb->meas + index * cap + first);
+            innovation = KFB_SUB(z, X_upd[index]);
+            for (i = 0; i < KFB_STATE_DIM; i++)
+                X_upd[i] = KFB_ADD(X_upd[i], KFB_MUL(K_col[i], innovation));
+
+            for (i = 0; i < KFB_STATE_DIM; i++)
+            {
+                for (j = i; j < KFB_STATE_DIM; j++)
+                {
+                    k = kfb_tri[i][j];
+                    P_upd[k] = KFB_ADD(KFB_SUB(KFB_SUB(P_upd[k], KFB_MUL(K_col[i], P_col[j])), KFB_MUL(P_col[i], K_col[j])), KFB_MUL(KFB_MUL(K_col[i], K_col[j]), s));
+                }
+            }
+        }
+
+        // Robots without a fix keep the prediction
+        for (i = 0; i < KFB_STATE_DIM; i++)
+            KFB_STORE(kfb->X_new + i * cap + first, KFB_SELECT(mask, X_upd[i], X[i]));
+        for (k = 0; k < KFB_COV_SIZE; k++)
+            P_new[k] = KFB_SELECT(mask, P_upd[k], P_new[k]);
+    }
+
+    for (k = 0; k < KFB_COV_SIZE; k++)
+        KFB_STORE(kfb->Cov + k * cap + first, P_new[k]);
+}
+
+/**
+ * @brief      Step the Kalman filter of every robot of the batch
+ *
+ * @param      kfb           The batch filter
+ * @param      state_kalman  The estimated pose of each robot (robot_count entries)
+ * @param[in]  gps_pose      The gps pose of each robot, read only where gps_updated is set
+ * @param[in]  gps_updated   Whether each robot received a GPS fix this step
+ * @param[in]  Aleft_enc     The left encoder increment of each robot
+ * @param[in]  Aright_enc    The right encoder increment of each robot
+ */
+void kalman_filter_batch_compute_pose(kalman_filter_batch_t *kfb, pose_t *state_kalman, const pose_t *gps_pose, const bool *gps_updated, const double *Aleft_enc, const double *Aright_enc)
+{
+    const int cap = kfb->capacity;
+    const double T = kfb->T;
+    bool gps_update = false;
+    int n;
+
+    // State prediction, in double and in the order of kalman_filter_compute_pose
+    for (n = 0; n < kfb->robot_count; n++)
+    {
+        double Aleft = Aleft_enc[n] * WHEEL_RADIUS;
+        double Aright = Aright_enc[n] * WHEEL_RADIUS;
+        double vx_new = cos(kfb->theta[n]) / (2.0 * T) * (Aleft + Aright);
+        double vy_new = sin(kfb->theta[n]) / (2.0 * T) * (Aleft + Aright);
+        double omega_new = -1 / (WHEEL_AXIS * T) * Aleft + 1 / (WHEEL_AXIS * T) * Aright;
+
+        kfb->X_new[0 * cap + n] = kfb->x[n] + vx_new * T;
+        kfb->X_new[1 * cap + n] = kfb->y[n] + vy_new * T;
+        kfb->X_new[2 * cap + n] = kfb->theta[n] + omega_new * T;
+        kfb->X_new[3 * cap + n] = vx_new;
+        kfb->X_new[4 * cap + n] = vy_new;
+        kfb->X_new[5 * cap + n] = omega_new;
+
+        kfb->gps_mask[n] = gps_updated[n] ? 1.0f : 0.0f;
+        if (gps_updated[n])
+        {
+            kfb->meas[0 * cap + n] = gps_pose[n].x;
+            kfb->meas[1 * cap + n] = gps_pose[n].y;
+            gps_update = true;
+        }
+    }
+
+    for (n = 0; n < cap; n += KFB_LANES)
+        kalman_filter_batch_step_block(kfb, n, gps_update);
+
+    for (n = 0; n < kfb->robot_count; n++)
+    {
+        kfb->x[n] = kfb->X_new[0 * cap + n];
+        kfb->y[n] = kfb->X_new[1 * cap + n];
+        kfb->theta[n] = kfb->X_new[2 * cap + n];
+        kfb->vx[n] = kfb->X_new[3 * cap + n];
+        kfb->vy[n] = kfb->X_new[4 * cap + n];
+        kfb->omega[n] = kfb->X_new[5 * cap + n];
+
+        state_kalman[n].x = kfb->x[n];
+        state_kalman[n].y = kfb->y[n];
+        state_kalman[n].heading = kfb->theta[n];
+    }
+}
+
+void kalman_filter_batch_reset(kalman_filter_batch_t *kfb, int time_step, const pose_t *pose_origin)
+{
+    const int cap = kfb->capacity;
+    int n, i;
+
+    kfb->T = time_step / 1000.0;
+    kfb->dt = kfb->T;
+    kfb->r_t = KFB_R_DIAG * kfb->T;
+
+    memset(kfb->x, 0, KFB_STATE_DIM * cap * sizeof(double));
+    memset(kfb->X_new, 0, (KFB_STATE_DIM + KFB_COV_SIZE + 3) * cap * sizeof(float));
+    for (n = 0; n < kfb->robot_count; n++)
+    {
+        kfb->x[n] = pose_origin[n].x;
+        kfb->y[n] = pose_origin[n].y;
+        kfb->theta[n] = pose_origin[n].heading;
+    }
+    for (i = 0; i < KFB_STATE_DIM; i++)
+    {
+        for (n = 0; n < cap; n++)
+            kfb->Cov[kfb_tri[i][i] * cap + n] = KFB_COV_DIAG;
+    }
+}
+
+kalman_filter_batch_t *kalman_filter_batch_create(int robot_count)
+{
+    kalman_filter_batch_t *kfb = (kalman_filter_batch_t *)calloc(1, sizeof(kalman_filter_batch_t));
+    int cap = (robot_count + KFB_LANES - 1) / KFB_LANES * KFB_LANES;
+
+    if (kfb == NULL)
+    {
+        printf("kalman filter batch create fail!\n");
+        return NULL;
+    }
+    kfb->robot_count = robot_count;
+    kfb->capacity = cap;
+
+    // One block per element type, the padding lanes are never read back
+    kfb->x = (double *)calloc(KFB_STATE_DIM * cap, sizeof(double));
+    kfb->X_new = (float *)calloc((KFB_STATE_DIM + KFB_COV_SIZE + 3) * cap, sizeof(float));
+    if (kfb->x == NULL || kfb->X_new == NULL)
+    {
+        printf("kalman filter batch create fail!\n");
+        kalman_filter_batch_destroy(kfb);
+        return NULL;
+    }
+    kfb->y = kfb->x + 1 * cap;
+    kfb->theta = kfb->x + 2 * cap;
+    kfb->vx = kfb->x + 3 * cap;
+    kfb->vy = kfb->x + 4 * cap;
+    kfb->omega = kfb->x + 5 * cap;
+    kfb->Cov = kfb->X_new + KFB_STATE_DIM * cap;
+    kfb->meas = kfb->Cov + KFB_COV_SIZE * cap;
+    kfb->gps_mask = kfb->meas + 2 * cap;
+
+    return kfb;
+}
+
+void kalman_filter_batch_destroy(kalman_filter_batch_t *kfb)
+{
+    if (kfb == NULL)
+        return;
+    free(kfb->x);
+    free(kfb->X_new);
+    free(kfb);
+}
+
+int kalman_filter_batch_lanes()
+{
+    return KFB_LANES;
+}
@@ -0,0 +1,18 @@
+#ifndef KALMAN_FILTER_BATCH_H
+#define KALMAN_FILTER_BATCH_H
+
+#include "odometry.h"
+#include <stdbool.h>
+
+// Opaque context holding the Kalman filter of robot_count robots in structure-of-arrays layout.
+// Every robot runs the same model as kalman_filter_compute_pose, one robot per SIMD lane.
+// For headless runs of many robots, tools/kalman_batch_check compares it with the per robot filter.
+typedef struct kalman_filter_batch kalman_filter_batch_t;
+
+kalman_filter_batch_t *kalman_filter_batch_create(int robot_count);
+void kalman_filter_batch_destroy(kalman_filter_batch_t *kfb);
+void kalman_filter_batch_reset(kalman_filter_batch_t *kfb, int time_step, const pose_t *pose_origin);
+void kalman_filter_batch_compute_pose(kalman_filter_batch_t *kfb, pose_t *state_kalman, const pose_t *gps_pose, const bool *gps_updated, const double *Aleft_enc, const double *Aright_enc);
+int kalman_filter_batch_lanes();
+
+#endif
@@ -0,0 +1,229 @@
+#include "kalman_smoother.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "light_matrix.h"
+
+// Workspace of a backward step, all 3x3
+typedef struct
+{
+    MatFixed FCov;
+    MatFixed Cov_pred;
+    MatFixed chol;
+    MatFixed G_trans;
+    MatFixed G;
+    MatFixed D;
+    MatFixed GD;
+    MatFixed GDG;
+} smoother_work_t;
+
+struct kalman_smoother
+{
+    int lag;
+    int head;
+    int count;
+    kalman_filter_ekf_step_t *window; // lag + 1 steps, oldest at head
+    smoother_work_t work;
+};
+
+static void kalman_smoother_work_init(smoother_work_t *w)
+{
+    MatInitFixed(&w->FCov, 3, 3);
+    MatInitFixed(&w->Cov_pred, 3, 3);
+    MatInitFixed(&w->chol, 3, 3);
+    MatInitFixed(&w->G_trans, 3, 3);
+    MatInitFixed(&w->G, 3, 3);
+    MatInitFixed(&w->D, 3, 3);
+    MatInitFixed(&w->GD, 3, 3);
+    MatInitFixed(&w->GDG, 3, 3);
+}
+
+/**
+ * @brief      One backward step of the Rauch-Tung-Striebel smoother
+ *
+ *             G = Cov_k * F' * inv(Cov_pred_k+1) is solved by Cholesky as
+ *             G' = Cov_pred_k+1 \ (F * Cov_k), then
+ *             X_s_k = X_k + G * (X_s_k+1 - X_pred_k+1) and
+ *             Cov_s_k = Cov_k + G * (Cov_s_k+1 - Cov_pred_k+1) * G'.
+ *
+ * @param      w      The workspace
+ * @param[in]  step   The step k (filtered estimate)
+ * @param[in]  next   The step k + 1 (prediction and Jacobian)
+ * @param      X_s    In: smoothed state of step k + 1, out: of step k
+ * @param      Cov_s  In: smoothed covariance of step k + 1, out: of step k
+ */
+static void kalman_smoother_backward(smoother_work_t *w, const kalman_filter_ekf_step_t *step, const kalman_filter_ekf_step_t *next, float X_s[3], float Cov_s[9])
+{
+    float *FCov = w->FCov.data;
+    float *D = w->D.data;
+    float *G = w->G.data;
+    float dX[3];
+    int i, j;
+
+    memcpy(w->Cov_pred.data, next->Cov_pred, sizeof(next->Cov_pred));
+
+    // F * Cov, F only adds theta row multiples to the x and y rows
+    for (j = 0; j < 3; j++)
+    {
+        FCov[0 * 3 + j] = step->Cov[0 * 3 + j] + next->f02 * step->Cov[2 * 3 + j];
+        FCov[1 * 3 + j] = step->Cov[1 * 3 + j] + next->f12 * step->Cov[2 * 3 + j];
+        FCov[2 * 3 + j] = step->Cov[2 * 3 + j];
+    }
+    MatCholesky(&w->chol.mat, &w->Cov_pred.mat);
+    MatCholSolve(&w->G_trans.mat, &w->chol.mat, &w->FCov.mat);
+    MatTransInto(&w->G.mat, &w->G_trans.mat);
+
+    for (i = 0; i < 3; i++)
+        dX[i] = X_s[i] - next->X_pred[i];
+    for (i = 0; i < 3; i++)
+        X_s[i] = step->X[i] + G[i * 3 + 0] * dX[0] + G[i * 3 + 1] * dX[1] + G[i * 3 + 2] * dX[2];
+
+    for (i = 0; i < 9; i++)
+        D[i] = Cov_s[i] - next->Cov_pred[i];
+    MatMulInto(&w->GD.mat, &w->G.mat, &w->D.mat);
+    MatTransMulInto(&w->GDG.mat, &w->GD.mat, &w->G.mat);
+    for (i = 0; i < 9; i++)
+        Cov_s[i] = step->Cov[i] + w->GDG.data[i];
+}
+
+static void kalman_smoother_to_pose(const float X[3], pose_t *pose)
+{
+    pose->x = X[0];
+    pose->y = X[1];
+    pose->heading = X[2];
+}
+
+/**
+ * @brief      Smooth the current window backward from its newest step
+ *
+ * @param      ks        The smoother
+ * @param[in]  first     Index of the oldest window step to output
+ * @param      smoothed  The smoothed poses of window steps first to count - 1
+ */
+static void kalman_smoother_window(kalman_smoother_t *ks, int first, pose_t *smoothed)
+{
+    const kalman_filter_ekf_step_t *step, *next;
+    float X_s[3], Cov_s[9];
+    int k;
+
+    next = &ks->window[(ks->head + ks->count - 1) % (ks->lag + 1)];
+    memcpy(X_s, next->X, sizeof(X_s));
+    memcpy(Cov_s, next->Cov, sizeof(Cov_s));
+    if (ks->count - 1 >= first)
+        kalman_smoother_to_pose(X_s, &smoothed[ks->count - 1 - first]);
+
+    for (k = ks->count - 2; k >= first; k--)
+    {
+        step = &ks->window[(ks->head + k) % (ks->lag + 1)];
+        kalman_smoother_backward(&ks->work, step, next, X_s, Cov_s);
+        kalman_smoother_to_pose(X_s, &smoothed[k - first]);
+        next = step;
+    }
+}
+
+/**
+ * @brief      Fixed-lag smoothing, add the newest filter step
+ *
+ * @param      ks        The smoother
+ * @param[in]  step      The step, from kalman_filter_ekf_record
+ * @param      smoothed  The smoothed pose of the step lag steps back
+ *
+ * @return     true once lag + 1 steps were pushed and smoothed holds a pose
+ */
+bool kalman_smoother_push(kalman_smoother_t *ks, const kalman_filter_ekf_step_t *step, pose_t *smoothed)
+{
+    if (ks->count == ks->lag + 1)
+    {
+        ks->head = (ks->head + 1) % (ks->lag + 1);
+        ks->count--;
+    }
+    ks->window[(ks->head + ks->count) % (ks->lag + 1)] = *step;
+    ks->count++;
+
+    if (ks->count < ks->lag + 1)
+        return false;
+    kalman_smoother_window(ks, 0, smoothed);
+    return true;
+}
+
+/**
+ * @brief      Output the steps still in the window at the end of a log
+ *
+ * @param      ks        The smoother
+ * @param      smoothed  The smoothed poses, at most lag entries
+ *
+ * @return     The number of poses written
+ */
+int kalman_smoother_flush(kalman_smoother_t *ks, pose_t *smoothed)
+{
+    // The oldest step was already output by kalman_smoother_push when the window is full
+    int first = ks->count == ks->lag + 1 ? 1 : 0;
+    int count = ks->count - first;
+
+    if (ks->count > 0)
+        kalman_smoother_window(ks, first, smoothed);
+    kalman_smoother_reset(ks);
+    return count;
+}
+
+/**
+ * @brief      Smooth a whole recorded run
+ *
+ * @param[in]  steps     The filter steps, from kalman_filter_ekf_record
+ * @param[in]  count     The number of steps
+ * @param      smoothed  The smoothed poses, count entries
+ */
+void kalman_smoother_batch(const kalman_filter_ekf_step_t *steps, int count, pose_t *smoothed)
+{
+    smoother_work_t work;
+    float X_s[3], Cov_s[9];
+    int k;
+
+    if (count == 0)
+        return;
+    kalman_smoother_work_init(&work);
+    memcpy(X_s, steps[count - 1].X, sizeof(X_s));
+    memcpy(Cov_s, steps[count - 1].Cov, sizeof(Cov_s));
+    kalman_smoother_to_pose(X_s, &smoothed[count - 1]);
+    for (k = count - 2; k >= 0; k--)
+    {
+        kalman_smoother_backward(&work, &steps[k], &steps[k + 1], X_s, Cov_s);
+        kalman_smoother_to_pose(X_s, &smoothed[k]);
+    }
+}
+
+void kalman_smoother_reset(kalman_smoother_t *ks)
+{
+    ks->head = 0;
+    ks->count = 0;
+}
+
+kalman_smoother_t *kalman_smoother_create(int lag)
+{
+    kalman_smoother_t *ks = (kalman_smoother_t *)calloc(1, sizeof(kalman_smoother_t));
+
+    if (ks == NULL)
+    {
+        printf("kalman smoother create fail!\n");
+        return NULL;
+    }
+    ks->window = (kalman_filter_ekf_step_t *)calloc(lag + 1, sizeof(kalman_filter_ekf_step_t));
+    if (ks->window == NULL)
+    {
+        printf("kalman smoother create fail!\n");
+        free(ks);
+        return NULL;
+    }
+    ks->lag = lag;
+    kalman_smoother_work_init(&ks->work);
+    kalman_smoother_reset(ks);
+    return ks;
+}
+
+void kalman_smoother_destroy(kalman_smoother_t *ks)
+{
+    if (ks == NULL)
+        return;
+    free(ks->window);
+    free(ks);
+}
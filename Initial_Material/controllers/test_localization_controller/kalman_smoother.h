@@ -0,0 +1,17 @@
+#ifndef KALMAN_SMOOTHER_H
+#define KALMAN_SMOOTHER_H
+
+#include "kalman_filter.h"
+#include <stdbool.h>
+
+// Rauch-Tung-Striebel smoother over the steps of kalman_filter_ekf_compute_pose
+typedef struct kalman_smoother kalman_smoother_t;
+
+kalman_smoother_t *kalman_smoother_create(int lag);
+void kalman_smoother_destroy(kalman_smoother_t *ks);
+void kalman_smoother_reset(kalman_smoother_t *ks);
+bool kalman_smoother_push(kalman_smoother_t *ks, const kalman_filter_ekf_step_t *step, pose_t *smoothed);
+int kalman_smoother_flush(kalman_smoother_t *ks, pose_t *smoothed);
+void kalman_smoother_batch(const kalman_filter_ekf_step_t *steps, int count, pose_t *smoothed);
+
+#endif
@@ -20,13 +20,30 @@
 #ifndef __LIGHT_MATRIX__
 #define __LIGHT_MATRIX__
 
+// Largest dimension supported by the fixed-capacity matrices
+#define MAT_MAX_DIM 8
+
+// Elements are stored contiguously in row-major order in data,
+// element[row] points at data + row * col
 typedef struct mat
 {
 	int row, col;
 	float **element;
+	float *data;
 } Mat;
 
+// Fixed-capacity matrix (up to MAT_MAX_DIM x MAT_MAX_DIM) that needs no heap
+// allocation. Initialize it with MatInitFixed and use &fixed.mat with the
+// other functions. It must not be copied by value or passed to MatDelete.
+typedef struct
+{
+	Mat mat;
+	float *rows[MAT_MAX_DIM];
+	float data[MAT_MAX_DIM * MAT_MAX_DIM];
+} MatFixed;
+
 Mat *MatCreate(Mat *mat, int row, int col);
+Mat *MatInitFixed(MatFixed *fixed, int row, int col);
 void MatDelete(Mat *mat);
 Mat *MatSetVal(Mat *mat, float *val);
 void MatDump(const Mat *mat);
@@ -34,15 +51,32 @@ void MatDump(const Mat *mat);
 Mat *MatZeros(Mat *mat);
 Mat *MatEye(Mat *mat);
 
+// Allocating variants, the returned matrix must be released with MatDelete
 Mat MatExpd(const Mat *sc1, const double *expd);
 Mat MatAdd(const Mat *src1, const Mat *src2);
-Mat MatSub(Mat *src1, Mat *src2);
+Mat MatSub(const Mat *src1, const Mat *src2);
 Mat MatMul(const Mat *src1, const Mat *src2);
 Mat MatTrans(const Mat *src);
-float MatDet(Mat *mat);
+float MatDet(const Mat *mat);
 Mat MatAdj(const Mat *src);
 Mat MatInv(const Mat *src);
 
-void MatCopy(Mat *src, Mat *dst);
+// Destination-passing variants writing into caller-owned storage, NULL on dimension mismatch
+Mat *MatExpdInto(Mat *dst, const Mat *src, const double *expd);
+Mat *MatAddInto(Mat *dst, const Mat *src1, const Mat *src2);
+Mat *MatSubInto(Mat *dst, const Mat *src1, const Mat *src2);
+Mat *MatMulInto(Mat *dst, const Mat *src1, const Mat *src2);
+Mat *MatTransMulInto(Mat *dst, const Mat *src1, const Mat *src2);
+Mat *MatTransInto(Mat *dst, const Mat *src);
+Mat *MatAdjInto(Mat *dst, const Mat *src);
+Mat *MatInvInto(Mat *dst, const Mat *src);
+
+Mat *MatLUDecomp(Mat *lu, int *perm, const Mat *src);
+Mat *MatLUSolve(Mat *x, const Mat *lu, const int *perm, const Mat *b);
+Mat *MatCholesky(Mat *l, const Mat *src);
+Mat *MatCholSolve(Mat *x, const Mat *l, const Mat *b);
+Mat *MatSolve(Mat *x, const Mat *a, const Mat *b);
+
+void MatCopy(const Mat *src, Mat *dst);
 
 #endif
@@ -1,7 +1,10 @@
 #ifndef ODOMETRY_H
 #define ODOMETRY_H
 
+#include <stdbool.h>
+
 #define RAD2DEG(X) X / M_PI * 180.0
+#define ODO_WHEEL_NOISE 0.0005 // Variance of a wheel displacement per meter travelled (m), the slip noise of odo_get_covariance
 
 typedef struct
 {
@@ -10,9 +13,26 @@ typedef struct
   double heading;
 } pose_t;
 
-void odo_compute_acc_encoders(pose_t *odo, const double acc[3], const double acc_mean[3], double Aleft_enc, double Aright_enc);
-void odo_compute_encoders(pose_t *odo, double Aleft_enc, double Aright_enc);
-void odo_compute_encoders_bonus(pose_t *odo, double Aleft_enc, double Aright_enc);
-void odo_reset(int time_step, pose_t *pose_orgin);
+// Opaque odometry context, one per tracked robot
+typedef struct odometry odometry_t;
+
+// Kinematic constants of the robot in meter, estimated by tools/odo_calibration
+typedef struct
+{
+  double wheel_radius_left;
+  double wheel_radius_right;
+  double wheel_axis;
+} odo_calibration_t;
+
+odometry_t *odo_create();
+void odo_destroy(odometry_t *ctx);
+void odo_compute_acc_encoders(odometry_t *ctx, pose_t *odo, const double acc[3], const double acc_mean[3], double Aleft_enc, double Aright_enc);
+void odo_compute_encoders(odometry_t *ctx, pose_t *odo, double Aleft_enc, double Aright_enc);
+void odo_get_covariance(const odometry_t *ctx, double cov[3][3]);
+void odo_compute_encoders_bonus(odometry_t *ctx, pose_t *odo, double Aleft_enc, double Aright_enc);
+void odo_reset(odometry_t *ctx, int time_step, pose_t *pose_orgin);
+void odo_set_calibration(odometry_t *ctx, const odo_calibration_t *calibration);
+void odo_get_calibration(const odometry_t *ctx, odo_calibration_t *calibration);
+bool odo_load_calibration(odometry_t *ctx, const char *file_name);
 
 #endif
\ No newline at end of file
@@ -11,6 +11,9 @@
 #include "odometry.h"
 #include <webots/emitter.h>
 #include "kalman_filter.h"
+#include "loc_packet.h"
+#include "acc_bias.h"
+#include "params.h"
 
 //----------------------------------------------------------
 /* FLAGS_ENABLE_DIFFERENT LOCALIZATION_METHOD*/
@@ -19,12 +22,23 @@
 // LOCALIZATION_METHOD 1: localization by using acc + encoder (for heading) odometry
 // LOCALIZATION_METHOD 2: localization by using encoder odometry
 // LOCALIZATION_METHOD 3: localization by using kalman filter
+// LOCALIZATION_METHOD 4: localization by using extended kalman filter (unicycle model)
 #define LOCALIZATION_METHOD 3
+// Run every method on the same measurements each step and report all of them to the supervisor,
+// LOCALIZATION_METHOD still gives the pose used by the robot
+#define SHADOW_MODE true
+// Record the encoder deltas and gps fixes of the run, for tools/loc_smoother and tools/odo_calibration
+#define RECORD_LOG false
+#define LOG_FILE "localization_log_%s.txt" // Per robot name, the robots share the controller directory
 //----------------------------------------------------------
 /*DEFINITION*/
-#define TIME_INIT_ACC 5 // Time in second
-// #define FLOCK_SIZE 1 // Used in localization world
-#define FLOCK_SIZE 5
+#define ACC_CALIBRATION true                     // Start from the accelerometer bias of the last run, save it once estimated
+#define ACC_CALIBRATION_FILE "acc_calibration_%s.txt" // Per robot name
+#define ODO_CALIBRATION_FILE "odo_calibration_%s.txt" // Wheel radii and axle length from tools/odo_calibration, per robot name
+// Devices read by the localization methods, see controller_schedule_devices
+#define DEVICE_GPS (1 << 0)
+#define DEVICE_ACC (1 << 1)
+#define DEVICE_ENCODERS (1 << 2)
 typedef struct
 {
   double prev_gps[3];
@@ -49,27 +63,48 @@ WbDeviceTag radio_emitter;
 
 static measurement_t _meas;
 // We have the following formulation of pose variable:  X= [pos_x, pos_y, heading]^T;
-static pose_t _estimated_pose, _gps_pose, _odo_acc_encoder, _odo_enc, _kalman_pose;
+static pose_t _estimated_pose, _gps_pose, _odo_acc_encoder, _odo_enc, _kalman_pose, _ekf_pose;
 // We have the following formulation of state variable:  X= [pos_x, pos_y, vel_x, vel_y]^T;
 static pose_t _pose_origin = {-2.9, 0.0, 0.0};
+// Pose estimated by each method, indexed by loc_method_t
+static pose_t *const _method_pose[LOC_METHOD_COUNT] = {&_gps_pose, &_odo_acc_encoder, &_odo_enc, &_kalman_pose, &_ekf_pose};
+// Per-robot estimator contexts
+static odometry_t *_odometry;
+static kalman_filter_t *_kalman;
 double last_gps_time = 0.0f;
 int time_step;
+static FILE *_log;
 char *robot_name;
-int robot_id_u, robot_id; // Unique and normalized (between 0 and FLOCK_SIZE-1) robot ID
+int robot_id_u, robot_id; // Unique and normalized (between 0 and params.flock_size-1) robot ID
 static bool gps_updated;
+static acc_bias_t _acc_bias;
+static bool _acc_bias_loaded;
+// Devices of each method, indexed by loc_method_t
+static const int _method_devices[LOC_METHOD_COUNT] = {
+  DEVICE_GPS,                   // gps only
+  DEVICE_ACC | DEVICE_ENCODERS, // acc + encoder (for heading) odometry
+  DEVICE_ENCODERS,              // encoder odometry
+  DEVICE_GPS | DEVICE_ENCODERS, // kalman filter
+  DEVICE_GPS | DEVICE_ENCODERS, // extended kalman filter
+};
+static int _enabled_devices;
 //----------------------------------------------------------
 /*FUNCTIONS*/
 static void controller_init(int ts);
 static void init_localization_devices(int ts);
+static void controller_schedule_devices(int method_mask);
 static void controller_get_pose();
 static void controller_get_acc();
 static void controller_get_encoder();
 static double controller_get_heading();
 static void controller_compute_mean_acc();
+static void controller_run_method(loc_method_t method);
 
 //-----------------------------------------------------------
 void controller_init(int time_step)
 {
+  char file_name[64];
+
   init_localization_devices(time_step);
 
   memset(&_meas, 0, sizeof(measurement_t));
@@ -82,22 +117,32 @@ void controller_init(int time_step)
 
   memset(&_odo_acc_encoder, 0, sizeof(pose_t));
 
-  odo_reset(time_step, &_pose_origin);
+  if (_odometry == NULL)
+    _odometry = odo_create();
+  snprintf(file_name, sizeof(file_name), ODO_CALIBRATION_FILE, robot_name);
+  odo_load_calibration(_odometry, file_name);
+  odo_reset(_odometry, time_step, &_pose_origin);
+
+  if (_kalman == NULL)
+    _kalman = kalman_filter_create();
+  kalman_filter_reset(_kalman, time_step, &_pose_origin, robot_id);
 
-  kalman_filter_reset(time_step, &_pose_origin, robot_id);
+  acc_bias_reset(&_acc_bias, time_step);
+  _acc_bias_loaded = false;
+  if (ACC_CALIBRATION)
+  {
+    snprintf(file_name, sizeof(file_name), ACC_CALIBRATION_FILE, robot_name);
+    _acc_bias_loaded = acc_bias_load(&_acc_bias, file_name);
+    memcpy(_meas.acc_mean, _acc_bias.mean, sizeof(_meas.acc_mean));
+  }
 }
 void init_localization_devices(int ts)
 {
+  // The devices are enabled by controller_schedule_devices, for the methods in use only
   dev_gps = wb_robot_get_device("gps");
-  wb_gps_enable(dev_gps, 1000);
-
   dev_acc = wb_robot_get_device("accelerometer");
-  wb_accelerometer_enable(dev_acc, ts);
-
   dev_left_encoder = wb_robot_get_device("left wheel sensor");
   dev_right_encoder = wb_robot_get_device("right wheel sensor");
-  wb_position_sensor_enable(dev_left_encoder, ts);
-  wb_position_sensor_enable(dev_right_encoder, ts);
 
   dev_left_motor = wb_robot_get_device("left wheel motor");
   dev_right_motor = wb_robot_get_device("right wheel motor");
@@ -109,29 +154,43 @@ void init_localization_devices(int ts)
   radio_emitter = wb_robot_get_device("emitter_radio");
   robot_name = (char *)wb_robot_get_name();
   sscanf(robot_name, "epuck%d", &robot_id_u); // read robot id from the robot's name
-  robot_id = robot_id_u % FLOCK_SIZE;         // normalize between 0 and FLOCK_SIZE-1
+  robot_id = robot_id_u % params.flock_size; // normalize between 0 and params.flock_size-1
   gps_updated = false;
-  if (FLOCK_SIZE == 5)
+  // start pose of the robot, the y axis is the opposite of the webots z axis
+  _pose_origin.x = params.origin_x;
+  _pose_origin.y = params.origin_y[robot_id];
+}
+
+/**
+ * @brief      Enable only the devices read by the given localization methods
+ *
+ *             The gps is sampled every second, the accelerometer and the encoders every time
+ *             step. The readers of a device that is not enabled do nothing.
+ *
+ * @param[in]  method_mask  Bit m is set to run method m
+ */
+void controller_schedule_devices(int method_mask)
+{
+  int method;
+
+  _enabled_devices = 0;
+  for (method = 0; method < LOC_METHOD_COUNT; method++)
   {
-    // covert y axis, set y equal to -y of what get from webot world
-    switch (robot_id)
-    {
-    case 0:
-      _pose_origin.y = 0.0;
-      break;
-    case 1:
-      _pose_origin.y = -0.1;
-      break;
-    case 2:
-      _pose_origin.y = 0.1;
-      break;
-    case 3:
-      _pose_origin.y = -0.2;
-      break;
-    case 4:
-      _pose_origin.y = 0.2;
-      break;
-    }
+    if (method_mask & (1 << method))
+      _enabled_devices |= _method_devices[method];
+  }
+  // The log holds the measurements of the Kalman filter
+  if (RECORD_LOG)
+    _enabled_devices |= DEVICE_GPS | DEVICE_ENCODERS;
+
+  if (_enabled_devices & DEVICE_GPS)
+    wb_gps_enable(dev_gps, 1000);
+  if (_enabled_devices & DEVICE_ACC)
+    wb_accelerometer_enable(dev_acc, time_step);
+  if (_enabled_devices & DEVICE_ENCODERS)
+  {
+    wb_position_sensor_enable(dev_left_encoder, time_step);
+    wb_position_sensor_enable(dev_right_encoder, time_step);
   }
 }
 
@@ -149,6 +208,9 @@ void controller_get_gps()
 
 void controller_get_encoder()
 {
+  if (!(_enabled_devices & DEVICE_ENCODERS))
+    return;
+
   // Store previous value of the left encoder
   _meas.prev_left_enc = _meas.left_enc;
 
@@ -164,6 +226,9 @@ void controller_get_encoder()
 
 void controller_get_acc()
 {
+  if (!(_enabled_devices & DEVICE_ACC))
+    return;
+
   const double *acc_values = wb_accelerometer_get_values(dev_acc);
 
   memcpy(_meas.acc, acc_values, sizeof(_meas.acc));
@@ -175,7 +240,7 @@ void controller_get_pose()
 {
   // Call the function to get the gps measurements
   double time_now_s = wb_robot_get_time();
-  if (time_now_s - last_gps_time > 1.0f)
+  if ((_enabled_devices & DEVICE_GPS) && time_now_s - last_gps_time > params.gps_period)
   {
     last_gps_time = time_now_s;
     controller_get_gps();
@@ -210,36 +275,94 @@ double controller_get_heading()
 
   return heading;
 }
+/**
+ * @brief      Refine the accelerometer bias with the measurements of this step
+ *
+ *             Call after controller_get_acc and controller_get_encoder. The bias is estimated
+ *             online whenever the encoders show no acceleration, the robot does not need to
+ *             wait still at startup.
+ */
 void controller_compute_mean_acc()
 {
-  static int count = 0;
+  char file_name[64];
+  bool was_ready = acc_bias_ready(&_acc_bias);
+  odo_calibration_t calibration;
 
-  count++;
+  if (!(_enabled_devices & DEVICE_ACC))
+    return;
 
-  if (count > 20) // Remove the effects of strong acceleration at the begining
-  {
-    for (int i = 0; i < 3; i++)
-      _meas.acc_mean[i] = (_meas.acc_mean[i] * (count - 21) + _meas.acc[i]) / (double)(count - 20);
-  }
+  // The encoder accelerations with the constants the odometry uses, calibrated or not
+  odo_get_calibration(_odometry, &calibration);
+  acc_bias_update(&_acc_bias, _meas.acc, _meas.left_enc - _meas.prev_left_enc, _meas.right_enc - _meas.prev_right_enc, &calibration);
+  memcpy(_meas.acc_mean, _acc_bias.mean, sizeof(_meas.acc_mean));
 
-  if (count == (int)(TIME_INIT_ACC / (double)time_step * 1000))
+  if (!was_ready && acc_bias_ready(&_acc_bias))
   {
     printf("Accelerometer initialization Done ! \n");
     printf("acc_mean is: [0]%f, [1]%f \n", _meas.acc_mean[0], _meas.acc_mean[1]);
+    if (ACC_CALIBRATION && !_acc_bias_loaded)
+    {
+      snprintf(file_name, sizeof(file_name), ACC_CALIBRATION_FILE, robot_name);
+      acc_bias_save(&_acc_bias, file_name);
+    }
   }
 
   //printf("ROBOT acc mean : %g %g %g\n", _meas.acc_mean[0], _meas.acc_mean[1], _meas.acc_mean[2]);
 }
 
+/**
+ * @brief      Run one step of a localization method on the measurements of this step
+ *
+ * @param[in]  method  The method, its pose is updated in _method_pose
+ */
+void controller_run_method(loc_method_t method)
+{
+  double Aleft_enc = _meas.left_enc - _meas.prev_left_enc;
+  double Aright_enc = _meas.right_enc - _meas.prev_right_enc;
+
+  switch (method)
+  {
+  case LOC_GPS:
+    break;
+  case LOC_ACC_ENCODER:
+    odo_compute_acc_encoders(_odometry, &_odo_acc_encoder, _meas.acc, _meas.acc_mean, Aleft_enc, Aright_enc);
+    break;
+  case LOC_ENCODER:
+    odo_compute_encoders(_odometry, &_odo_enc, Aleft_enc, Aright_enc);
+    break;
+  case LOC_KALMAN:
+    kalman_filter_compute_pose(_kalman, &_kalman_pose, &_gps_pose, gps_updated, Aleft_enc, Aright_enc);
+    break;
+  case LOC_EKF:
+    kalman_filter_ekf_compute_pose(_kalman, &_ekf_pose, &_gps_pose, gps_updated, Aleft_enc, Aright_enc);
+    break;
+  default:
+    break;
+  }
+}
+
 //----------------------------------------------------------
 /*MAIN FUNCTION*/
 int main()
 {
   char buffer[255]; // Buffer for sending data
+  loc_packet_t packet;
+  int method;
   wb_robot_init();
   //time_step = wb_robot_get_basic_time_step();
-  time_step = 64;
+  params_init(&params);
+  time_step = params.time_step;
   controller_init(time_step);
+  controller_schedule_devices(SHADOW_MODE ? (1 << LOC_METHOD_COUNT) - 1 : 1 << LOCALIZATION_METHOD);
+  if (RECORD_LOG)
+  {
+    snprintf(buffer, sizeof(buffer), LOG_FILE, robot_name);
+    _log = fopen(buffer, "w");
+    if (_log == NULL)
+      printf("cannot open %s, the run is not recorded!\n", buffer);
+    else
+      fprintf(_log, "# %d %f %f %f\n", time_step, _pose_origin.x, _pose_origin.y, _pose_origin.heading);
+  }
 
   while (wb_robot_step(time_step) != -1)
   {
@@ -252,47 +375,60 @@ int main()
 
     controller_get_encoder();
 
-    if (wb_robot_get_time() < TIME_INIT_ACC)
-    {
     controller_compute_mean_acc();
-    wb_motor_set_velocity(dev_left_motor, 0.0);
-    wb_motor_set_velocity(dev_right_motor, 0.0);
-    }
-    else
-    {
-    if (LOCALIZATION_METHOD == 0)
-    {
-      memcpy(&_estimated_pose, &_gps_pose, sizeof(pose_t));
-    }
-    if (LOCALIZATION_METHOD == 1)
-    {
-      odo_compute_acc_encoders(&_odo_acc_encoder, _meas.acc, _meas.acc_mean, _meas.left_enc - _meas.prev_left_enc, _meas.right_enc - _meas.prev_right_enc);
-      memcpy(&_estimated_pose, &_odo_acc_encoder, sizeof(pose_t));
-    }
-    if (LOCALIZATION_METHOD == 2)
+
+    if (_log != NULL)
     {
-      odo_compute_encoders(&_odo_enc, _meas.left_enc - _meas.prev_left_enc, _meas.right_enc - _meas.prev_right_enc);
-      memcpy(&_estimated_pose, &_odo_enc, sizeof(pose_t));
+      // time delta_left_enc delta_right_enc gps_updated gps_x gps_y
+      fprintf(_log, "%f %.9g %.9g %d %.9g %.9g\n", wb_robot_get_time(), _meas.left_enc - _meas.prev_left_enc, _meas.right_enc - _meas.prev_right_enc, gps_updated, _gps_pose.x, _gps_pose.y);
     }
-    if (LOCALIZATION_METHOD == 3)
+    // The odometry and the two filters keep separate states, so the methods do not interfere
+    for (method = 0; method < LOC_METHOD_COUNT; method++)
     {
-      kalman_filter_compute_pose(&_kalman_pose, &_gps_pose, gps_updated, _meas.left_enc - _meas.prev_left_enc, _meas.right_enc - _meas.prev_right_enc);
-      memcpy(&_estimated_pose, &_kalman_pose, sizeof(pose_t));
+      if (SHADOW_MODE || method == LOCALIZATION_METHOD)
+        controller_run_method(method);
     }
+    memcpy(&_estimated_pose, _method_pose[LOCALIZATION_METHOD], sizeof(pose_t));
     // Use one of the two trajectories.
     trajectory_2(dev_left_motor, dev_right_motor);
     //    trajectory_2(dev_left_motor, dev_right_motor);
     // Send the estimated pose to supervisor
 
-    sprintf(buffer, "%1d#%f#%f", robot_id, _estimated_pose.x, _estimated_pose.y);
-    //sprintf(buffer, "%1d#%f#%f", 1, 1.2, 1.2);
-    //printf("message sent: %s\n", buffer);
-    wb_emitter_send(radio_emitter, buffer, strlen(buffer));
+    if (SHADOW_MODE)
+    {
+      memset(&packet, 0, sizeof(packet));
+      packet.version = LOC_PACKET_VERSION;
+      packet.robot_id = robot_id;
+      packet.driving_method = LOCALIZATION_METHOD;
+      for (method = 0; method < LOC_METHOD_COUNT; method++)
+      {
+        packet.method_mask |= 1 << method;
+        packet.position[method][0] = _method_pose[method]->x;
+        packet.position[method][1] = _method_pose[method]->y;
+      }
+      wb_emitter_send(radio_emitter, &packet, sizeof(packet));
+    }
+    else
+    {
+      sprintf(buffer, "%1d#%f#%f", robot_id, _estimated_pose.x, _estimated_pose.y);
+      //sprintf(buffer, "%1d#%f#%f", 1, 1.2, 1.2);
+      //printf("message sent: %s\n", buffer);
+      wb_emitter_send(radio_emitter, buffer, strlen(buffer));
+    }
     //printf("Robot %d send the message: %s\n", robot_id, buffer);
-     }
   }
 
-  kalman_filter_cleanup();
+  // Keep the bias refined over the whole run for the next one
+  if (ACC_CALIBRATION && acc_bias_ready(&_acc_bias))
+  {
+    snprintf(buffer, sizeof(buffer), ACC_CALIBRATION_FILE, robot_name);
+    acc_bias_save(&_acc_bias, buffer);
+  }
+
+  kalman_filter_destroy(_kalman);
+  odo_destroy(_odometry);
+  if (_log != NULL)
+    fclose(_log);
 
   wb_robot_cleanup();
 
@@ -0,0 +1,127 @@
+// Position and heading error of methods 3 and 4 with wheel slip, and their time per step
+//
+// usage: ekf_bench [runs]
+// Simulates runs (default 50) runs of 96 s at 64 ms on wavy wheel speeds. The true wheels have
+// a radius of 0.0205 m against the 0.0200 m of the filters and slip by 5% (gaussian, per wheel
+// and step). A gps fix with 0.01 m noise comes every second. Both filters get the same encoder
+// increments and fixes, the RMSE is taken over every step against the true pose.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+
+#include "kalman_filter.h"
+
+#define STEPS 1500 // 96 s at 64 ms
+#define TIME_STEP 0.064
+#define TRUE_WHEEL_RADIUS 0.0205
+#define WHEEL_AXIS 0.057
+#define SLIP 0.05
+#define GPS_PERIOD 1.0
+#define GPS_NOISE 0.01
+
+// A step of a run: encoder increments, the gps fix if any and the true pose after the step
+typedef struct
+{
+    double Aleft_enc;
+    double Aright_enc;
+    bool gps_updated;
+    pose_t gps;
+    pose_t truth;
+} run_step_t;
+
+static run_step_t run[STEPS];
+static pose_t estimate[STEPS];
+
+static double gaussian(void)
+{
+    double u = (rand() + 1.0) / (RAND_MAX + 2.0), v = (rand() + 1.0) / (RAND_MAX + 2.0);
+
+    return sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * v);
+}
+
+static void make_run(int r, const pose_t *origin)
+{
+    double x = origin->x, y = origin->y, heading = origin->heading, last_gps = 0.0;
+    double left, right, distance, rotation;
+    int t;
+
+    for (t = 0; t < STEPS; t++)
+    {
+        // Wheel speeds in rad/s, the encoders count the wheel angle
+        run[t].Aleft_enc = (4.0 + 3.0 * sin(t * 0.01 + r)) * TIME_STEP;
+        run[t].Aright_enc = (4.0 + 3.0 * cos(t * 0.013 + r)) * TIME_STEP;
+        left = run[t].Aleft_enc * TRUE_WHEEL_RADIUS * (1.0 + SLIP * gaussian());
+        right = run[t].Aright_enc * TRUE_WHEEL_RADIUS * (1.0 + SLIP * gaussian());
+        distance = (left + right) / 2.0;
+        rotation = (right - left) / WHEEL_AXIS;
+        x += distance * cos(heading + rotation / 2.0);
+        y += distance * sin(heading + rotation / 2.0);
+        heading += rotation;
+        run[t].truth.x = x;
+        run[t].truth.y = y;
+        run[t].truth.heading = heading;
+
+        run[t].gps_updated = t * TIME_STEP - last_gps > GPS_PERIOD;
+        if (run[t].gps_updated)
+        {
+            last_gps = t * TIME_STEP;
+            run[t].gps.x = x + GPS_NOISE * gaussian();
+            run[t].gps.y = y + GPS_NOISE * gaussian();
+            run[t].gps.heading = 0.0;
+        }
+    }
+}
+
+// Adds the squared errors of the estimates of a run
+static void add_errors(double *position, double *heading)
+{
+    int t;
+
+    for (t = 0; t < STEPS; t++)
+    {
+        *position += pow(estimate[t].x - run[t].truth.x, 2) + pow(estimate[t].y - run[t].truth.y, 2);
+        *heading += pow(remainder(estimate[t].heading - run[t].truth.heading, 2.0 * M_PI), 2);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int runs = argc > 1 ? atoi(argv[1]) : 50;
+    double position[2] = {0.0, 0.0}, heading[2] = {0.0, 0.0};
+    clock_t elapsed[2] = {0, 0}, start;
+    pose_t origin = {-2.9, 0.0, 0.0};
+    kalman_filter_t *kf = kalman_filter_create();
+    long count = (long)runs * STEPS;
+    int r, t;
+
+    if (kf == NULL || runs <= 0)
+        return 1;
+    srand(3);
+    for (r = 0; r < runs; r++)
+    {
+        make_run(r, &origin);
+        // Both filters live in the same context and are reset together
+        kalman_filter_reset(kf, (int)(TIME_STEP * 1000), &origin, 0);
+
+        start = clock();
+        for (t = 0; t < STEPS; t++)
+            kalman_filter_compute_pose(kf, &estimate[t], &run[t].gps, run[t].gps_updated, run[t].Aleft_enc, run[t].Aright_enc);
+        elapsed[0] += clock() - start;
+        add_errors(&position[0], &heading[0]);
+
+        start = clock();
+        for (t = 0; t < STEPS; t++)
+            kalman_filter_ekf_compute_pose(kf, &estimate[t], &run[t].gps, run[t].gps_updated, run[t].Aleft_enc, run[t].Aright_enc);
+        elapsed[1] += clock() - start;
+        add_errors(&position[1], &heading[1]);
+    }
+    kalman_filter_destroy(kf);
+
+    printf("%d runs of %.0f s, %.0f%% slip, true wheel radius %.4f m, gps every %.0f s\n", runs, STEPS * TIME_STEP, SLIP * 100.0, TRUE_WHEEL_RADIUS, GPS_PERIOD);
+    for (r = 0; r < 2; r++)
+        printf("method %d: position RMSE %.4f m, heading RMSE %.4f rad, %.0f ns/step\n", r + 3, sqrt(position[r] / count), sqrt(heading[r] / count),
+               (double)elapsed[r] / CLOCKS_PER_SEC * 1e9 / count);
+    return 0;
+}
@@ -0,0 +1,84 @@
+// Check that the Kalman filter steps do not touch the heap once the filter is reset
+//
+// usage: kalman_alloc_check [steps]
+// Counts the calls to malloc, calloc and realloc (wrapped at link time, see the Makefile)
+// while both filters of kalman_filter.c run steps 64 ms steps (default 100000) on a wavy
+// path, with a gps fix every 16 steps and a neighbour position fix every 4 steps.
+// Exits with 1 if any allocation happened during the steps.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "kalman_filter.h"
+
+static long allocations = 0;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+    allocations++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size)
+{
+    allocations++;
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    allocations++;
+    return __real_realloc(ptr, size);
+}
+
+int main(int argc, char **argv)
+{
+    int steps = argc > 1 ? atoi(argv[1]) : 100000;
+    pose_t origin = {-2.9, 0.1, 0.0};
+    pose_t gps = origin, kalman, ekf, fix;
+    const float fix_cov[3] = {0.0004f, 0.0f, 0.0004f};
+    double x = origin.x, y = origin.y, heading = origin.heading;
+    long before_reset, before_steps;
+    kalman_filter_t *kf;
+    int t;
+
+    before_reset = allocations;
+    kf = kalman_filter_create();
+    if (kf == NULL)
+        return 1;
+    kalman_filter_reset(kf, 64, &origin, 0);
+    before_steps = allocations;
+
+    for (t = 0; t < steps; t++)
+    {
+        // Encoder increments in rad, the true pose follows them
+        double left = 0.2 + 0.05 * sin(t * 0.01), right = 0.2 + 0.05 * cos(t * 0.013);
+        double distance = (left + right) * 0.02 / 2.0;
+
+        heading += (right - left) * 0.02 / 0.057;
+        x += distance * cos(heading);
+        y += distance * sin(heading);
+        gps.x = x;
+        gps.y = y;
+        kalman_filter_compute_pose(kf, &kalman, &gps, t % 16 == 0, left, right);
+        kalman_filter_ekf_compute_pose(kf, &ekf, &gps, t % 16 == 0, left, right);
+        if (t % 4 == 0)
+        {
+            fix.x = x;
+            fix.y = y;
+            fix.heading = 0.0;
+            kalman_filter_fuse_position(kf, &kalman, &fix, fix_cov);
+            kalman_filter_ekf_fuse_position(kf, &ekf, &fix, fix_cov);
+        }
+    }
+
+    printf("allocations: %ld at create and reset, %ld during %d steps\n", before_steps - before_reset, allocations - before_steps, steps);
+    printf("final kalman pose %.4f %.4f, ekf pose %.4f %.4f, true %.4f %.4f\n", kalman.x, kalman.y, ekf.x, ekf.y, x, y);
+    kalman_filter_destroy(kf);
+    return allocations == before_steps ? 0 : 1;
+}
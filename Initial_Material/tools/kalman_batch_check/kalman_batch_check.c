@@ -0,0 +1,145 @@
+// Check the batched Kalman filter against one kalman_filter_t per robot and time both
+//
+// usage: kalman_batch_check [steps]
+// Steps flocks of 1, 13, 100, 1000 and 10000 robots on random encoder increments, with each
+// robot on its own gps schedule: a period of 8, 16 or 23 steps at its own phase, a quarter of
+// the robots changing period half way and one robot in seven never getting a fix. Every step
+// the poses of the batch must equal those of the per robot filters byte for byte (memcmp).
+// The throughput is the number of robot steps per second of each, over steps steps
+// (default 2000000 / robots, at least 200).
+// Exits with 1 if a pose differs.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#include "kalman_filter.h"
+#include "kalman_filter_batch.h"
+
+#define TIME_STEP 64
+#define ROBOT_STEPS 2000000
+#define CHUNK 32 // Steps generated, then run by each filter, then compared
+
+// Whether robot n gets a gps fix at step t
+static bool gps_due(int n, int t, int steps)
+{
+    static const int periods[] = {8, 16, 23};
+    int period = periods[n % 3];
+
+    if (n % 7 == 6)
+        return false;
+    if (n % 4 == 1 && t >= steps / 2)
+        period = periods[(n + 1) % 3];
+    return (t + n) % period == 0;
+}
+
+// Runs both filters on count robots, returns the number of poses that differ
+// The inputs and poses of CHUNK steps are kept, so each filter is timed over a whole chunk
+static long run(int count, int steps, double *batch_rate, double *scalar_rate)
+{
+    pose_t *origin = malloc(count * sizeof(pose_t));
+    pose_t *gps = malloc(CHUNK * count * sizeof(pose_t));
+    pose_t *batch_pose = malloc(CHUNK * count * sizeof(pose_t));
+    pose_t *scalar_pose = malloc(CHUNK * count * sizeof(pose_t));
+    bool *gps_updated = malloc(CHUNK * count * sizeof(bool));
+    double *Aleft = malloc(CHUNK * count * sizeof(double));
+    double *Aright = malloc(CHUNK * count * sizeof(double));
+    kalman_filter_t **filters = malloc(count * sizeof(kalman_filter_t *));
+    kalman_filter_batch_t *batch = kalman_filter_batch_create(count);
+    clock_t batch_time = 0, scalar_time = 0, start;
+    long mismatches = 0;
+    int n, t, first, last, i;
+
+    srand(1);
+    for (n = 0; n < count; n++)
+    {
+        origin[n].x = -2.9 + 0.1 * (n % 50);
+        origin[n].y = 0.1 * (n / 50 % 50);
+        origin[n].heading = 0.3 * n;
+        filters[n] = kalman_filter_create();
+        kalman_filter_reset(filters[n], TIME_STEP, &origin[n], n);
+    }
+    kalman_filter_batch_reset(batch, TIME_STEP, origin);
+
+    for (first = 0; first < steps; first += CHUNK)
+    {
+        last = first + CHUNK < steps ? first + CHUNK : steps;
+        for (t = first; t < last; t++)
+        {
+            for (n = 0; n < count; n++)
+            {
+                i = (t - first) * count + n;
+                Aleft[i] = (rand() % 1000) / 1000.0;
+                Aright[i] = (rand() % 1000) / 900.0;
+                gps_updated[i] = gps_due(n, t, steps);
+                gps[i].x = origin[n].x + 0.001 * t + (rand() % 100) / 1000.0;
+                gps[i].y = origin[n].y + (rand() % 100) / 1000.0;
+                gps[i].heading = 0.0;
+            }
+        }
+
+        start = clock();
+        for (t = first; t < last; t++)
+        {
+            i = (t - first) * count;
+            kalman_filter_batch_compute_pose(batch, &batch_pose[i], &gps[i], &gps_updated[i], &Aleft[i], &Aright[i]);
+        }
+        batch_time += clock() - start;
+
+        start = clock();
+        for (t = first; t < last; t++)
+        {
+            for (n = 0; n < count; n++)
+            {
+                i = (t - first) * count + n;
+                kalman_filter_compute_pose(filters[n], &scalar_pose[i], &gps[i], gps_updated[i], Aleft[i], Aright[i]);
+            }
+        }
+        scalar_time += clock() - start;
+
+        for (i = 0; i < (last - first) * count; i++)
+        {
+            if (memcmp(&batch_pose[i], &scalar_pose[i], sizeof(pose_t)) != 0)
+                mismatches++;
+        }
+    }
+    *batch_rate = (double)count * steps * CLOCKS_PER_SEC / (batch_time > 0 ? batch_time : 1);
+    *scalar_rate = (double)count * steps * CLOCKS_PER_SEC / (scalar_time > 0 ? scalar_time : 1);
+
+    for (n = 0; n < count; n++)
+        kalman_filter_destroy(filters[n]);
+    kalman_filter_batch_destroy(batch);
+    free(origin);
+    free(gps);
+    free(batch_pose);
+    free(scalar_pose);
+    free(gps_updated);
+    free(Aleft);
+    free(Aright);
+    free(filters);
+    return mismatches;
+}
+
+int main(int argc, char **argv)
+{
+    static const int counts[] = {1, 13, 100, 1000, 10000};
+    int fixed_steps = argc > 1 ? atoi(argv[1]) : 0;
+    double batch_rate, scalar_rate;
+    long mismatches, total = 0;
+    int i, steps;
+
+    printf("%d lanes\n", kalman_filter_batch_lanes());
+    printf("robots  steps  batch robots/s  scalar robots/s  differing poses\n");
+    for (i = 0; i < (int)(sizeof(counts) / sizeof(counts[0])); i++)
+    {
+        steps = fixed_steps > 0 ? fixed_steps : ROBOT_STEPS / counts[i];
+        if (steps < 200)
+            steps = 200;
+        mismatches = run(counts[i], steps, &batch_rate, &scalar_rate);
+        printf("%6d %6d %15.3g %16.3g %16ld\n", counts[i], steps, batch_rate, scalar_rate, mismatches);
+        total += mismatches;
+    }
+    return total > 0;
+}
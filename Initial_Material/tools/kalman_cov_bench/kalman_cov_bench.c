@@ -0,0 +1,143 @@
+// Time of a step of the Kalman filter of method 3, for the two covariance propagations
+//
+// usage: kalman_cov_bench [-w poses | -r poses] [steps]
+// Runs steps 64 ms steps (default 100000) of wavy wheel speeds with a gps fix with 1 cm noise
+// every 16 steps, REPEATS times, and prints the best time of a step. With -w, writes the
+// estimated pose of every step. With -r, reads the poses written by the other build and
+// reports the largest difference, exit status 1 above TOLERANCE. The Makefile builds the
+// filter with KALMAN_FUSED_COV_PROPAGATION on and off.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "kalman_filter.h"
+
+#define REPEATS 5
+#define TOLERANCE 1e-5 // Largest difference of a coordinate (m) or of the heading (rad)
+
+// A step of the run: encoder increments and the gps fix if any
+typedef struct
+{
+    double Aleft_enc;
+    double Aright_enc;
+    bool gps_updated;
+    pose_t gps;
+} run_step_t;
+
+static double gaussian(void)
+{
+    double u = (rand() + 1.0) / (RAND_MAX + 2.0), v = (rand() + 1.0) / (RAND_MAX + 2.0);
+
+    return sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * v);
+}
+
+// The synthetic run of tools/kalman_update_check, with a constant gps period
+static void make_run(run_step_t *run, int steps)
+{
+    double x = -2.9, y = 0.1, heading = 0.0, distance;
+    int t;
+
+    srand(1);
+    for (t = 0; t < steps; t++)
+    {
+        run[t].Aleft_enc = 0.2 + 0.05 * sin(t * 0.01);
+        run[t].Aright_enc = 0.2 + 0.05 * cos(t * 0.013);
+        distance = (run[t].Aleft_enc + run[t].Aright_enc) * 0.02 / 2.0;
+        heading += (run[t].Aright_enc - run[t].Aleft_enc) * 0.02 / 0.057;
+        x += distance * cos(heading);
+        y += distance * sin(heading);
+        run[t].gps_updated = t % 16 == 0;
+        run[t].gps.x = x + 0.01 * gaussian();
+        run[t].gps.y = y + 0.01 * gaussian();
+        run[t].gps.heading = 0.0;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const char *write_name = NULL, *read_name = NULL;
+    pose_t origin = {-2.9, 0.1, 0.0}, expected;
+    double best = 0.0, seconds, difference, worst = 0.0;
+    int steps = 100000, arg = 1, repeat, t, ref_t, worst_step = 0;
+    run_step_t *run;
+    pose_t *poses;
+    kalman_filter_t *kf;
+    clock_t start;
+    FILE *file;
+
+    if (arg + 1 < argc && strcmp(argv[arg], "-w") == 0)
+        write_name = argv[arg + 1], arg += 2;
+    else if (arg + 1 < argc && strcmp(argv[arg], "-r") == 0)
+        read_name = argv[arg + 1], arg += 2;
+    if (arg < argc)
+        steps = atoi(argv[arg]);
+
+    run = malloc(steps * sizeof(run_step_t));
+    poses = malloc(steps * sizeof(pose_t));
+    kf = kalman_filter_create();
+    if (run == NULL || poses == NULL || kf == NULL)
+        return 1;
+    make_run(run, steps);
+
+    for (repeat = 0; repeat < REPEATS; repeat++)
+    {
+        kalman_filter_reset(kf, 64, &origin, 0);
+        start = clock();
+        for (t = 0; t < steps; t++)
+            kalman_filter_compute_pose(kf, &poses[t], &run[t].gps, run[t].gps_updated, run[t].Aleft_enc, run[t].Aright_enc);
+        seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+        if (repeat == 0 || seconds < best)
+            best = seconds;
+    }
+    kalman_filter_destroy(kf);
+    printf("%s: %d steps, %.0f ns per step\n", argv[0], steps, best * 1e9 / steps);
+
+    if (write_name != NULL)
+    {
+        file = fopen(write_name, "w");
+        if (file == NULL)
+        {
+            printf("cannot open %s\n", write_name);
+            return 1;
+        }
+        for (t = 0; t < steps; t++)
+            fprintf(file, "%d %.9f %.9f %.9f\n", t, poses[t].x, poses[t].y, poses[t].heading);
+        fclose(file);
+    }
+    if (read_name != NULL)
+    {
+        file = fopen(read_name, "r");
+        if (file == NULL)
+        {
+            printf("cannot open %s\n", read_name);
+            return 1;
+        }
+        for (t = 0; t < steps; t++)
+        {
+            if (fscanf(file, "%d %lf %lf %lf", &ref_t, &expected.x, &expected.y, &expected.heading) != 4 || ref_t != t)
+            {
+                printf("%s ends before step %d\n", read_name, t);
+                return 1;
+            }
+            difference = fmax(fmax(fabs(poses[t].x - expected.x), fabs(poses[t].y - expected.y)), fabs(poses[t].heading - expected.heading));
+            if (difference > worst)
+            {
+                worst = difference;
+                worst_step = t;
+            }
+        }
+        fclose(file);
+        printf("largest difference to %s %.3g at step %d\n", read_name, worst, worst_step);
+        if (worst > TOLERANCE)
+        {
+            printf("difference above %g!\n", TOLERANCE);
+            return 1;
+        }
+    }
+    free(run);
+    free(poses);
+    return 0;
+}
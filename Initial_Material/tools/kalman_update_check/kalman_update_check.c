@@ -0,0 +1,147 @@
+// Replay of a run through the Kalman filter of method 3, to compare its gps update modes
+//
+// usage: kalman_update_check [-r reference] [log]
+//   log is a run recorded by test_localization_controller (RECORD_LOG). Without it, a synthetic
+//   run of 100000 steps: wavy wheel speeds, gps fixes with 1 cm noise every 16 steps, then
+//   every 23 steps from the middle of the run so a frozen gain has to be dropped.
+// Prints the estimated pose of every step. With -r, reads the poses printed by another build
+// instead and reports the largest difference, exit status 1 above TOLERANCE. The Makefile builds
+// the filter with the matrix update, the sequential update and the steady-state gain.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "kalman_filter.h"
+
+#define SYNTHETIC_STEPS 100000
+#define TOLERANCE 1e-4 // Largest difference of a coordinate (m) or of the heading (rad)
+
+// A step of the run: encoder increments and the gps fix if any
+typedef struct
+{
+    double Aleft_enc;
+    double Aright_enc;
+    bool gps_updated;
+    pose_t gps;
+} run_step_t;
+
+static double gaussian(void)
+{
+    double u = (rand() + 1.0) / (RAND_MAX + 2.0), v = (rand() + 1.0) / (RAND_MAX + 2.0);
+
+    return sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * v);
+}
+
+/**
+ * @brief      Read the next step of the run
+ *
+ * @param      log   The recorded log, NULL for the synthetic run
+ * @param[in]  t     The step number
+ * @param      step  The step
+ *
+ * @return     false at the end of the run
+ */
+static bool next_step(FILE *log, int t, run_step_t *step)
+{
+    static double x, y, heading;
+    double time, distance;
+    int gps;
+
+    if (log != NULL)
+    {
+        if (fscanf(log, "%lf %lf %lf %d %lf %lf", &time, &step->Aleft_enc, &step->Aright_enc, &gps, &step->gps.x, &step->gps.y) != 6)
+            return false;
+        step->gps_updated = gps != 0;
+        return true;
+    }
+    if (t == SYNTHETIC_STEPS)
+        return false;
+    if (t == 0)
+        x = -2.9, y = 0.1, heading = 0.0;
+    step->Aleft_enc = 0.2 + 0.05 * sin(t * 0.01);
+    step->Aright_enc = 0.2 + 0.05 * cos(t * 0.013);
+    distance = (step->Aleft_enc + step->Aright_enc) * 0.02 / 2.0;
+    heading += (step->Aright_enc - step->Aleft_enc) * 0.02 / 0.057;
+    x += distance * cos(heading);
+    y += distance * sin(heading);
+    step->gps_updated = t % (t < SYNTHETIC_STEPS / 2 ? 16 : 23) == 0;
+    step->gps.x = x + 0.01 * gaussian();
+    step->gps.y = y + 0.01 * gaussian();
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    FILE *log = NULL, *reference = NULL;
+    pose_t origin = {-2.9, 0.1, 0.0}, pose, expected;
+    int time_step = 64, t, ref_t, worst_step = 0;
+    double difference, worst = 0.0;
+    kalman_filter_t *kf;
+    run_step_t step;
+    int arg = 1;
+
+    if (arg + 1 < argc && strcmp(argv[arg], "-r") == 0)
+    {
+        reference = fopen(argv[arg + 1], "r");
+        if (reference == NULL)
+        {
+            printf("cannot open %s\n", argv[arg + 1]);
+            return 1;
+        }
+        arg += 2;
+    }
+    if (arg < argc)
+    {
+        log = fopen(argv[arg], "r");
+        if (log == NULL)
+        {
+            printf("cannot open %s\n", argv[arg]);
+            return 1;
+        }
+        if (fscanf(log, "# %d %lf %lf %lf", &time_step, &origin.x, &origin.y, &origin.heading) != 4)
+        {
+            printf("%s is not a localization log\n", argv[arg]);
+            return 1;
+        }
+    }
+
+    srand(1);
+    kf = kalman_filter_create();
+    if (kf == NULL)
+        return 1;
+    kalman_filter_reset(kf, time_step, &origin, 0);
+    for (t = 0; next_step(log, t, &step); t++)
+    {
+        kalman_filter_compute_pose(kf, &pose, &step.gps, step.gps_updated, step.Aleft_enc, step.Aright_enc);
+        if (reference == NULL)
+        {
+            printf("%d %.9f %.9f %.9f\n", t, pose.x, pose.y, pose.heading);
+            continue;
+        }
+        if (fscanf(reference, "%d %lf %lf %lf", &ref_t, &expected.x, &expected.y, &expected.heading) != 4 || ref_t != t)
+        {
+            printf("reference ends before step %d\n", t);
+            return 1;
+        }
+        difference = fmax(fmax(fabs(pose.x - expected.x), fabs(pose.y - expected.y)), fabs(pose.heading - expected.heading));
+        if (difference > worst)
+        {
+            worst = difference;
+            worst_step = t;
+        }
+    }
+    kalman_filter_destroy(kf);
+
+    if (reference != NULL)
+    {
+        printf("%s: %d steps, largest difference %.3g at step %d\n", argv[0], t, worst, worst_step);
+        if (worst > TOLERANCE)
+        {
+            printf("difference above %g!\n", TOLERANCE);
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,120 @@
+// Offline Rauch-Tung-Striebel smoothing of a run recorded by test_localization_controller (RECORD_LOG)
+//
+// usage: loc_smoother <log> [lag]
+//   lag 0 (default) smooths the whole run, lag > 0 runs the fixed-lag smoother with lag steps.
+// Writes "time x_filtered y_filtered heading_filtered x_smoothed y_smoothed heading_smoothed" per step.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "kalman_filter.h"
+#include "kalman_smoother.h"
+
+typedef struct
+{
+    double time;
+    pose_t filtered;
+} log_step_t;
+
+int main(int argc, char **argv)
+{
+    FILE *log;
+    int time_step, gps, lag = 0;
+    int count = 0, capacity = 1024, out = 0, i;
+    double time, Aleft_enc, Aright_enc;
+    pose_t origin, gps_pose = {0.0, 0.0, 0.0};
+    log_step_t *steps;
+    kalman_filter_ekf_step_t *ekf_steps;
+    pose_t *smoothed;
+    clock_t start;
+
+    if (argc < 2)
+    {
+        printf("usage: %s <log> [lag]\n", argv[0]);
+        return 1;
+    }
+    if (argc > 2)
+        lag = atoi(argv[2]);
+    log = fopen(argv[1], "r");
+    if (log == NULL)
+    {
+        printf("cannot open %s\n", argv[1]);
+        return 1;
+    }
+    if (fscanf(log, "# %d %lf %lf %lf", &time_step, &origin.x, &origin.y, &origin.heading) != 4)
+    {
+        printf("%s is not a localization log\n", argv[1]);
+        fclose(log);
+        return 1;
+    }
+
+    steps = (log_step_t *)malloc(capacity * sizeof(log_step_t));
+    ekf_steps = (kalman_filter_ekf_step_t *)malloc(capacity * sizeof(kalman_filter_ekf_step_t));
+    kalman_filter_t *kf = kalman_filter_create();
+    kalman_smoother_t *ks = lag > 0 ? kalman_smoother_create(lag) : NULL;
+    smoothed = (pose_t *)malloc((lag > 0 ? lag + 1 : capacity) * sizeof(pose_t));
+    if (steps == NULL || ekf_steps == NULL || kf == NULL || smoothed == NULL || (lag > 0 && ks == NULL))
+    {
+        printf("loc_smoother: out of memory\n");
+        return 1;
+    }
+    kalman_filter_reset(kf, time_step, &origin, -1);
+
+    // Forward pass, the filter of localization method 4
+    start = clock();
+    while (fscanf(log, "%lf %lf %lf %d %lf %lf", &time, &Aleft_enc, &Aright_enc, &gps, &gps_pose.x, &gps_pose.y) == 6)
+    {
+        if (count == capacity)
+        {
+            capacity *= 2;
+            steps = (log_step_t *)realloc(steps, capacity * sizeof(log_step_t));
+            if (lag == 0)
+            {
+                ekf_steps = (kalman_filter_ekf_step_t *)realloc(ekf_steps, capacity * sizeof(kalman_filter_ekf_step_t));
+                smoothed = (pose_t *)realloc(smoothed, capacity * sizeof(pose_t));
+            }
+            if (steps == NULL || ekf_steps == NULL || smoothed == NULL)
+            {
+                printf("loc_smoother: out of memory\n");
+                return 1;
+            }
+        }
+        steps[count].time = time;
+        kalman_filter_ekf_compute_pose(kf, &steps[count].filtered, &gps_pose, gps != 0, Aleft_enc, Aright_enc);
+        if (lag > 0)
+        {
+            kalman_filter_ekf_record(kf, &ekf_steps[0]);
+            if (kalman_smoother_push(ks, &ekf_steps[0], &smoothed[0]))
+            {
+                printf("%f %f %f %f %f %f %f\n", steps[out].time, steps[out].filtered.x, steps[out].filtered.y, steps[out].filtered.heading, smoothed[0].x, smoothed[0].y, smoothed[0].heading);
+                out++;
+            }
+        }
+        else
+        {
+            kalman_filter_ekf_record(kf, &ekf_steps[count]);
+        }
+        count++;
+    }
+    fclose(log);
+
+    // Backward pass
+    if (lag > 0)
+        kalman_smoother_flush(ks, smoothed);
+    else
+        kalman_smoother_batch(ekf_steps, count, smoothed);
+    for (i = 0; out < count; i++, out++)
+        printf("%f %f %f %f %f %f %f\n", steps[out].time, steps[out].filtered.x, steps[out].filtered.y, steps[out].filtered.heading, smoothed[i].x, smoothed[i].y, smoothed[i].heading);
+
+    double elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
+    if (count > 0 && elapsed > 0.0)
+        fprintf(stderr, "%d steps (%.1f s of run) smoothed in %.3f s, %.0fx real time\n", count, count * time_step / 1000.0, elapsed, count * time_step / 1000.0 / elapsed);
+
+    kalman_smoother_destroy(ks);
+    kalman_filter_destroy(kf);
+    free(smoothed);
+    free(ekf_steps);
+    free(steps);
+    return 0;
+}
@@ -0,0 +1,197 @@
+// Cost of solving a linear system with light_matrix for n = 2 to MAT_MAX_DIM
+//
+// usage: mat_solve_bench [seed]
+// For random diagonally dominant matrices A and their products A * A' (symmetric positive
+// definite), times the previous inverse, the adjugate divided by the determinant with every
+// determinant a permutation expansion (O(n!), kept here as the reference), against MatInvInto,
+// MatSolve (LU with partial pivoting) and MatCholesky + MatCholSolve. The results are checked
+// against the reference and by their residuals.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <math.h>
+#include <time.h>
+
+#include "light_matrix.h"
+
+#define N_MAX MAT_MAX_DIM
+
+typedef float square_t[N_MAX][N_MAX];
+
+static square_t a, spd, reference_inverse;
+static MatFixed A, SPD, B, X, L, INV;
+
+// The time of one call of a pass, averaged over enough repetitions to last 0.2 s. Reading the
+// clock costs more than a small solve, so it is read after batches of calls growing to 1024.
+static double time_pass(void (*pass)(int), int n)
+{
+    clock_t start = clock();
+    long repeat = 0;
+    int batch = 1, i;
+
+    do
+    {
+        for (i = 0; i < batch; i++)
+            pass(n);
+        repeat += batch;
+        if (batch < 1024)
+            batch *= 2;
+    } while (clock() - start < CLOCKS_PER_SEC / 5);
+    return (double)(clock() - start) / CLOCKS_PER_SEC / repeat;
+}
+
+// Determinant by expansion over every permutation of the columns, as MatDet did
+static void permutation_det(const square_t m, int n, int list[], int k, int parity, float *det)
+{
+    int i, swap;
+
+    if (k == n)
+    {
+        float product = m[0][list[0]];
+
+        for (i = 1; i < n; i++)
+            product *= m[i][list[i]];
+        *det += parity % 2 ? -product : product;
+        return;
+    }
+    for (i = k; i < n; i++)
+    {
+        if (m[k][list[i]] == 0.0f)
+            continue;
+        swap = list[k], list[k] = list[i], list[i] = swap;
+        permutation_det(m, n, list, k + 1, parity + (i != k), det);
+        swap = list[k], list[k] = list[i], list[i] = swap;
+    }
+}
+
+static float reference_det(const square_t m, int n)
+{
+    int list[N_MAX], i;
+    float det = 0.0f;
+
+    for (i = 0; i < n; i++)
+        list[i] = i;
+    permutation_det(m, n, list, 0, 0, &det);
+    return det;
+}
+
+// Inverse as the adjugate over the determinant, n^2 + 1 permutation determinants, as MatInv did
+static void reference_inverse_of(const square_t m, int n, square_t inverse)
+{
+    square_t minor;
+    float det = reference_det(m, n), cofactor;
+    int row, col, i, j, r, c;
+
+    for (row = 0; row < n; row++)
+    {
+        for (col = 0; col < n; col++)
+        {
+            for (i = 0, r = 0; i < n; i++)
+            {
+                if (i == row)
+                    continue;
+                for (j = 0, c = 0; j < n; j++)
+                {
+                    if (j != col)
+                        minor[r][c++] = m[i][j];
+                }
+                r++;
+            }
+            cofactor = n == 1 ? 1.0f : reference_det((const float(*)[N_MAX])minor, n - 1);
+            inverse[col][row] = ((row + col) % 2 ? -cofactor : cofactor) / det;
+        }
+    }
+}
+
+static void pass_reference(int n)
+{
+    reference_inverse_of((const float(*)[N_MAX])a, n, reference_inverse);
+}
+
+static void pass_inverse(int n)
+{
+    MatInvInto(&INV.mat, &A.mat);
+}
+
+static void pass_solve(int n)
+{
+    MatSolve(&X.mat, &A.mat, &B.mat);
+}
+
+static void pass_cholesky(int n)
+{
+    MatCholesky(&L.mat, &SPD.mat);
+    MatCholSolve(&X.mat, &L.mat, &B.mat);
+}
+
+// Largest |m * x - b|
+static float residual(const Mat *m, const Mat *x, const Mat *b)
+{
+    float worst = 0.0f, sum;
+    int i, j;
+
+    for (i = 0; i < m->row; i++)
+    {
+        for (sum = -b->data[i], j = 0; j < m->col; j++)
+            sum += m->data[i * m->col + j] * x->data[j];
+        worst = fmaxf(worst, fabsf(sum));
+    }
+    return worst;
+}
+
+int main(int argc, char **argv)
+{
+    double t_reference, t_inverse, t_solve, t_cholesky;
+    float det_error, inverse_error, solve_residual, cholesky_residual, det;
+    int n, i, j, k;
+    bool ok = true;
+
+    srand(argc > 1 ? atoi(argv[1]) : 3);
+    printf(" n   adjugate inv   MatInvInto     MatSolve  Cholesky   |det err|  |inv err|  solve res  chol res\n");
+    for (n = 2; n <= N_MAX; n++)
+    {
+        MatInitFixed(&A, n, n);
+        MatInitFixed(&SPD, n, n);
+        MatInitFixed(&B, n, 1);
+        MatInitFixed(&X, n, 1);
+        MatInitFixed(&L, n, n);
+        MatInitFixed(&INV, n, n);
+        for (i = 0; i < n; i++)
+        {
+            for (j = 0; j < n; j++)
+                a[i][j] = rand() / (float)RAND_MAX - 0.5f + (i == j ? n : 0.0f);
+            B.mat.data[i] = rand() / (float)RAND_MAX;
+        }
+        for (i = 0; i < n; i++)
+        {
+            for (j = 0; j < n; j++)
+            {
+                A.mat.data[i * n + j] = a[i][j];
+                for (spd[i][j] = 0.0f, k = 0; k < n; k++)
+                    spd[i][j] += a[i][k] * a[j][k];
+                SPD.mat.data[i * n + j] = spd[i][j];
+            }
+        }
+
+        t_reference = time_pass(pass_reference, n);
+        t_inverse = time_pass(pass_inverse, n);
+        t_solve = time_pass(pass_solve, n);
+        solve_residual = residual(&A.mat, &X.mat, &B.mat);
+        t_cholesky = time_pass(pass_cholesky, n);
+        cholesky_residual = residual(&SPD.mat, &X.mat, &B.mat);
+
+        det = reference_det((const float(*)[N_MAX])a, n);
+        det_error = fabsf(MatDet(&A.mat) - det) / fabsf(det);
+        for (inverse_error = 0.0f, i = 0; i < n; i++)
+        {
+            for (j = 0; j < n; j++)
+                inverse_error = fmaxf(inverse_error, fabsf(INV.mat.data[i * n + j] - reference_inverse[i][j]));
+        }
+        ok = ok && det_error < 1e-4f && inverse_error < 1e-4f && solve_residual < 1e-4f && cholesky_residual < 1e-3f;
+        printf("%2d %12.0f ns %9.0f ns %9.0f ns %6.0f ns %10.1e %10.1e %10.1e %9.1e\n", n, t_reference * 1e9, t_inverse * 1e9, t_solve * 1e9, t_cholesky * 1e9, det_error, inverse_error, solve_residual, cholesky_residual);
+    }
+    if (!ok)
+        printf("results differ from the reference!\n");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,313 @@
+// Check the neighbour table against a brute force model of the flock
+//
+// usage: neighbour_table_test [operations] [tables]
+// Runs operations (default 2000000) random observe, find, predict and expire calls on a table
+// and on a plain array indexed by robot, which holds the same alpha-beta trackers. The ids are
+// drawn from ID_POOL random robot ids, so the index sees long probe runs and many removals,
+// and every PHASE_LENGTH operations the timeout becomes long enough to fill the table and drop
+// pings. Each call is checked against the model, and every 64 calls the whole table: the count,
+// the index and the tracked state of every live neighbour.
+// Then fills NEAREST_TABLES random tables (default 200000) of up to NEIGHBOUR_TABLE_SIZE
+// neighbours on a coarse grid, so many are at the same distance, and checks the k nearest of
+// neighbour_table_nearest against the sorted distances for a random k.
+// The summary goes to stderr, the table prints every dropped ping on stdout.
+// Exits with 1 on the first disagreement.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <math.h>
+
+#include "neighbour_table.h"
+
+#define ID_POOL 4096
+#define PHASE_LENGTH 200000
+#define SHORT_TIMEOUT 0.5 // s, about 250 live neighbours
+#define LONG_TIMEOUT 1.0  // s, a few more robots heard than the table holds
+#define ALPHA 0.5f
+#define BETA 0.2f
+#define TOLERANCE 1e-4f
+#define NEAREST_TABLES 200000
+#define NEAREST_GRID 0.1 // m, positions on a grid of 21 x 21 points
+
+// The model of one robot, the tracker of neighbour_table_observe without the table
+typedef struct
+{
+    bool live;
+    double last_seen;
+    double time;
+    float relative_pos[2];
+    float relative_speed[2];
+} model_t;
+
+static int ids[ID_POOL];
+static model_t model[ID_POOL];
+static int model_count;
+static neighbour_table_t table;
+
+static int compare_ids(const void *a, const void *b)
+{
+    return *(const int *)a - *(const int *)b;
+}
+
+static int compare_dist2(const void *a, const void *b)
+{
+    float d = *(const float *)a - *(const float *)b;
+
+    return (d > 0.0f) - (d < 0.0f);
+}
+
+static double uniform(double min, double max)
+{
+    return min + (max - min) * rand() / RAND_MAX;
+}
+
+static void model_advance(model_t *m, double time)
+{
+    float dt = time - m->time;
+    int j;
+
+    if (dt <= 0.0f)
+        return;
+    for (j = 0; j < 2; j++)
+        m->relative_pos[j] += m->relative_speed[j] * dt;
+    m->time = time;
+}
+
+// Returns false if the table is full and the ping is dropped
+static bool model_observe(model_t *m, double time, const float relative_pos[2])
+{
+    float dt, innovation;
+    int j;
+
+    if (!m->live)
+    {
+        if (model_count == NEIGHBOUR_TABLE_SIZE)
+            return false;
+        m->live = true;
+        model_count++;
+        m->last_seen = time;
+        m->time = time;
+        for (j = 0; j < 2; j++)
+        {
+            m->relative_pos[j] = relative_pos[j];
+            m->relative_speed[j] = 0.0f;
+        }
+        return true;
+    }
+    dt = time - m->last_seen;
+    model_advance(m, time);
+    for (j = 0; j < 2; j++)
+    {
+        innovation = relative_pos[j] - m->relative_pos[j];
+        m->relative_pos[j] += ALPHA * innovation;
+        if (dt > 0.0f)
+            m->relative_speed[j] += BETA / dt * innovation;
+    }
+    m->last_seen = time;
+    return true;
+}
+
+static bool close_to(float value, float expected)
+{
+    return fabsf(value - expected) <= TOLERANCE * (1.0f + fabsf(expected));
+}
+
+// The state of a neighbour against its model
+static bool same_state(const neighbour_t *neighbour, const model_t *m)
+{
+    int j;
+
+    if (neighbour->last_seen != m->last_seen || neighbour->time != m->time)
+        return false;
+    for (j = 0; j < 2; j++)
+    {
+        if (!close_to(neighbour->relative_pos[j], m->relative_pos[j]) || !close_to(neighbour->relative_speed[j], m->relative_speed[j]))
+            return false;
+    }
+    return true;
+}
+
+// Every item is found at its own place and matches a live model, one item per live model
+static bool same_table(void)
+{
+    const int *id;
+    int i;
+
+    if (table.count != model_count)
+        return false;
+    for (i = 0; i < table.count; i++)
+    {
+        if (neighbour_table_find(&table, table.items[i].id) != &table.items[i])
+            return false;
+        id = bsearch(&table.items[i].id, ids, ID_POOL, sizeof(int), compare_ids);
+        if (id == NULL || !model[id - ids].live || !same_state(&table.items[i], &model[id - ids]))
+            return false;
+    }
+    return true;
+}
+
+static float dist2(const neighbour_t *neighbour)
+{
+    return neighbour->relative_pos[0] * neighbour->relative_pos[0] + neighbour->relative_pos[1] * neighbour->relative_pos[1];
+}
+
+// The k nearest of a random table: distinct items, none of the others nearer than the k-th
+// nearest of the sorted distances, whichever of the tied ones was picked
+static bool check_nearest(long *ties)
+{
+    static int nearest[NEIGHBOUR_TABLE_SIZE];
+    static float sorted[NEIGHBOUR_TABLE_SIZE];
+    static bool selected[NEIGHBOUR_TABLE_SIZE];
+    float relative_pos[2], kth;
+    int count = rand() % (rand() % NEIGHBOUR_TABLE_SIZE + 1) + 1;
+    int k = rand() % (count + 3) - 1;
+    int expected = k <= 0 ? 0 : (k < count ? k : count);
+    int i, n;
+
+    neighbour_table_reset(&table);
+    for (i = 0; i < count; i++)
+    {
+        relative_pos[0] = NEAREST_GRID * (rand() % 21 - 10);
+        relative_pos[1] = NEAREST_GRID * (rand() % 21 - 10);
+        neighbour_table_observe(&table, i, 0.0, relative_pos, ALPHA, BETA);
+        sorted[i] = dist2(&table.items[i]);
+        selected[i] = false;
+    }
+    qsort(sorted, count, sizeof(float), compare_dist2);
+
+    n = neighbour_table_nearest(&table, k, nearest);
+    if (n != expected)
+        return false;
+    if (n == 0)
+        return true;
+    kth = sorted[n - 1];
+    if (n < count && sorted[n] == kth)
+        (*ties)++;
+    for (i = 0; i < n; i++)
+    {
+        if (nearest[i] < 0 || nearest[i] >= count || selected[nearest[i]] || dist2(&table.items[nearest[i]]) > kth)
+            return false;
+        selected[nearest[i]] = true;
+    }
+    for (i = 0; i < count; i++)
+    {
+        if (!selected[i] && dist2(&table.items[i]) < kth)
+            return false;
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    long operations = argc > 1 ? atol(argv[1]) : 2000000;
+    long tables = argc > 2 ? atol(argv[2]) : NEAREST_TABLES;
+    long op, drops = 0, expired = 0, finds = 0, full_checks = 0, ties = 0;
+    double time = 0.0, timeout;
+    float relative_pos[2];
+    neighbour_t *neighbour;
+    bool accepted;
+    int i, r, n, draw;
+
+    srand(1);
+    // Distinct ids in [0, 1000000), sorted for the lookups of same_table
+    for (r = 0; r < ID_POOL; r++)
+    {
+        do
+        {
+            ids[r] = rand() % 1000000;
+            for (i = 0; i < r && ids[i] != ids[r]; i++)
+                ;
+        } while (i < r);
+    }
+    qsort(ids, ID_POOL, sizeof(int), compare_ids);
+    neighbour_table_reset(&table);
+
+    for (op = 0; op < operations; op++)
+    {
+        timeout = (op / PHASE_LENGTH) % 2 ? LONG_TIMEOUT : SHORT_TIMEOUT;
+        // Half of the calls come within the same step, a second ping then only corrects the position
+        if (rand() % 2)
+            time += 0.002;
+        r = rand() % ID_POOL;
+
+        draw = rand() % 16;
+        if (draw < 9)
+        {
+            relative_pos[0] = uniform(-1.0, 1.0);
+            relative_pos[1] = uniform(-1.0, 1.0);
+            accepted = model_observe(&model[r], time, relative_pos);
+            neighbour = neighbour_table_observe(&table, ids[r], time, relative_pos, ALPHA, BETA);
+            if (!accepted)
+                drops++;
+            if ((neighbour != NULL) != accepted || (neighbour != NULL && (neighbour->id != ids[r] || !same_state(neighbour, &model[r]))))
+            {
+                fprintf(stderr, "operation %ld: observe of robot %d disagrees\n", op, ids[r]);
+                return 1;
+            }
+        }
+        else if (draw < 14)
+        {
+            neighbour = neighbour_table_find(&table, ids[r]);
+            finds++;
+            if ((neighbour != NULL) != model[r].live || (neighbour != NULL && (neighbour->id != ids[r] || !same_state(neighbour, &model[r]))))
+            {
+                fprintf(stderr, "operation %ld: find of robot %d disagrees\n", op, ids[r]);
+                return 1;
+            }
+        }
+        else if (draw == 14)
+        {
+            neighbour_table_predict(&table, time);
+            for (i = 0; i < ID_POOL; i++)
+            {
+                if (model[i].live)
+                    model_advance(&model[i], time);
+            }
+        }
+        else
+        {
+            n = 0;
+            for (i = 0; i < ID_POOL; i++)
+            {
+                if (model[i].live && time - model[i].last_seen > timeout)
+                {
+                    model[i].live = false;
+                    model_count--;
+                    n++;
+                }
+            }
+            expired += n;
+            if (neighbour_table_expire(&table, time, timeout) != n)
+            {
+                fprintf(stderr, "operation %ld: expire removed another number of neighbours than %d\n", op, n);
+                return 1;
+            }
+        }
+
+        // The whole table, every 64 operations
+        if (op % 64 == 0)
+        {
+            full_checks++;
+            if (!same_table())
+            {
+                fprintf(stderr, "operation %ld: the table and the model disagree\n", op);
+                return 1;
+            }
+        }
+    }
+
+    fprintf(stderr, "%ld operations: %ld finds, %ld expired, %ld pings dropped on a full table, %ld whole table checks passed\n",
+            operations, finds, expired, drops, full_checks);
+
+    for (op = 0; op < tables; op++)
+    {
+        if (!check_nearest(&ties))
+        {
+            fprintf(stderr, "table %ld: the k nearest are not the nearest\n", op);
+            return 1;
+        }
+    }
+    fprintf(stderr, "%ld random tables: k nearest as brute force, %ld with ties at the k-th distance\n", tables, ties);
+    return 0;
+}
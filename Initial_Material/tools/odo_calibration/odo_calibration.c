@@ -0,0 +1,356 @@
+// Offline calibration of the odometry from a run recorded by test_localization_controller (RECORD_LOG)
+// and the true positions recorded by loc_fitness_super (RECORD_TRUTH)
+//
+// usage: odo_calibration <log> <truth> <robot> [param_file]
+//   robot is the number in the robot name (epuck<robot>), as in the truth file.
+// Fits the wheel radii, the axle length and the start pose by nonlinear least squares on the
+// position error of the encoder odometry. The odometry drifts far from the truth over a whole
+// run with wrong constants, so the fit starts on the first steps and each fit starts the next one
+// over twice as many steps. Then writes the parameter file loaded by the controllers
+// (odo_calibration_<robot name>.txt in the controller directory).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "odometry.h"
+
+#define NB_PARAMS 6         // wheel_radius_left, wheel_radius_right, wheel_axis, x0, y0, heading0
+#define MAX_ITERATIONS 100  // Levenberg-Marquardt iterations
+#define TIME_TOLERANCE 1e-4 // Largest time difference between a log step and its true position (s)
+#define FIRST_HORIZON 32    // Steps of the first fit, the horizon doubles up to the whole run
+
+typedef struct
+{
+    double Aleft_enc;
+    double Aright_enc;
+    bool has_truth;
+    double truth_x;
+    double truth_y;
+} calib_step_t;
+
+static const char *param_names[NB_PARAMS] = {"wheel_radius_left", "wheel_radius_right", "wheel_axis", "x0", "y0", "heading0"};
+
+/**
+ * @brief      Replay the run with the parameters p and compute the position residuals
+ *
+ * @param      ctx        The odometry context used for the replay
+ * @param[in]  time_step  The time step of the run in miliseconds
+ * @param[in]  steps      The steps of the run
+ * @param[in]  count      The number of steps
+ * @param[in]  p          The parameters
+ * @param      residuals  The odometry minus the true position, x and y of each step with a truth
+ *
+ * @return     The sum of the squared residuals
+ */
+static double compute_residuals(odometry_t *ctx, int time_step, const calib_step_t *steps, int count, const double p[NB_PARAMS], double *residuals)
+{
+    odo_calibration_t calibration = {p[0], p[1], p[2]};
+    pose_t origin = {p[3], p[4], p[5]};
+    pose_t odo;
+    double cost = 0.0;
+    int i, m = 0;
+
+    odo_set_calibration(ctx, &calibration);
+    odo_reset(ctx, time_step, &origin);
+    for (i = 0; i < count; i++)
+    {
+        odo_compute_encoders(ctx, &odo, steps[i].Aleft_enc, steps[i].Aright_enc);
+        if (!steps[i].has_truth)
+            continue;
+        residuals[m] = odo.x - steps[i].truth_x;
+        residuals[m + 1] = odo.y - steps[i].truth_y;
+        cost += residuals[m] * residuals[m] + residuals[m + 1] * residuals[m + 1];
+        m += 2;
+    }
+    return cost;
+}
+
+/**
+ * @brief      Solve A * x = b for a symmetric positive definite A by Cholesky decomposition
+ *
+ * @param      A     The matrix, overwritten by its factor
+ * @param      b     The right hand side, overwritten by the solution
+ *
+ * @return     false if A is not positive definite
+ */
+static bool solve_cholesky(double A[NB_PARAMS][NB_PARAMS], double b[NB_PARAMS])
+{
+    int i, j, k;
+
+    for (j = 0; j < NB_PARAMS; j++)
+    {
+        for (k = 0; k < j; k++)
+            A[j][j] -= A[j][k] * A[j][k];
+        if (A[j][j] <= 0.0)
+            return false;
+        A[j][j] = sqrt(A[j][j]);
+        for (i = j + 1; i < NB_PARAMS; i++)
+        {
+            for (k = 0; k < j; k++)
+                A[i][j] -= A[i][k] * A[j][k];
+            A[i][j] /= A[j][j];
+        }
+    }
+    for (i = 0; i < NB_PARAMS; i++)
+    {
+        for (k = 0; k < i; k++)
+            b[i] -= A[i][k] * b[k];
+        b[i] /= A[i][i];
+    }
+    for (i = NB_PARAMS - 1; i >= 0; i--)
+    {
+        for (k = i + 1; k < NB_PARAMS; k++)
+            b[i] -= A[k][i] * b[k];
+        b[i] /= A[i][i];
+    }
+    return true;
+}
+
+/**
+ * @brief      Jacobian of the residuals by central differences
+ *
+ * @param      J          The Jacobian, m rows of NB_PARAMS
+ * @param      work       Two buffers of m residuals
+ */
+static void compute_jacobian(odometry_t *ctx, int time_step, const calib_step_t *steps, int count, const double p[NB_PARAMS], int m, double *J, double *work)
+{
+    double q[NB_PARAMS];
+    double h;
+    int i, j;
+
+    for (j = 0; j < NB_PARAMS; j++)
+    {
+        memcpy(q, p, sizeof(q));
+        h = 1e-6 * (fabs(p[j]) > 1e-2 ? fabs(p[j]) : 1e-2);
+        q[j] = p[j] + h;
+        compute_residuals(ctx, time_step, steps, count, q, work);
+        q[j] = p[j] - h;
+        compute_residuals(ctx, time_step, steps, count, q, work + m);
+        for (i = 0; i < m; i++)
+            J[i * NB_PARAMS + j] = (work[i] - work[m + i]) / (2.0 * h);
+    }
+}
+
+/**
+ * @brief      Levenberg-Marquardt fit of the parameters on the first count steps
+ *
+ * @param      p           The parameters, initial guess then solution
+ * @param[in]  m           The number of residuals of the count steps
+ * @param      JtJ         J'J at the solution, for the covariance of the fit
+ * @param      J           Buffer of m x NB_PARAMS
+ * @param      residuals   Buffer of m
+ * @param      work        Buffer of 2 x m
+ * @param      iterations  The iterations done
+ *
+ * @return     The sum of the squared residuals at the solution
+ */
+static double fit_levenberg_marquardt(odometry_t *ctx, int time_step, const calib_step_t *steps, int count, int m, double p[NB_PARAMS], double JtJ[NB_PARAMS][NB_PARAMS], double *J, double *residuals, double *work, int *iterations)
+{
+    double A[NB_PARAMS][NB_PARAMS], g[NB_PARAMS], delta[NB_PARAMS], q[NB_PARAMS];
+    double cost, new_cost = 0.0, lambda = 1e-3;
+    int i, j, k;
+
+    cost = compute_residuals(ctx, time_step, steps, count, p, residuals);
+    for (*iterations = 0; *iterations < MAX_ITERATIONS; (*iterations)++)
+    {
+        compute_jacobian(ctx, time_step, steps, count, p, m, J, work);
+        memset(JtJ[0], 0, NB_PARAMS * NB_PARAMS * sizeof(double));
+        memset(g, 0, sizeof(g));
+        for (i = 0; i < m; i++)
+        {
+            for (j = 0; j < NB_PARAMS; j++)
+            {
+                g[j] -= J[i * NB_PARAMS + j] * residuals[i];
+                for (k = j; k < NB_PARAMS; k++)
+                    JtJ[j][k] += J[i * NB_PARAMS + j] * J[i * NB_PARAMS + k];
+            }
+        }
+        for (j = 0; j < NB_PARAMS; j++)
+            for (k = 0; k < j; k++)
+                JtJ[j][k] = JtJ[k][j];
+
+        // Raise the damping, scaled by the diagonal of J'J, until the step lowers the cost
+        for (;;)
+        {
+            memcpy(A, JtJ, sizeof(A));
+            memcpy(delta, g, sizeof(delta));
+            for (j = 0; j < NB_PARAMS; j++)
+                A[j][j] += lambda * JtJ[j][j];
+            if (solve_cholesky(A, delta))
+            {
+                for (j = 0; j < NB_PARAMS; j++)
+                    q[j] = p[j] + delta[j];
+                new_cost = compute_residuals(ctx, time_step, steps, count, q, work);
+                if (new_cost < cost)
+                    break;
+            }
+            lambda *= 10.0;
+            if (lambda > 1e12)
+                return cost;
+        }
+        memcpy(p, q, NB_PARAMS * sizeof(double));
+        memcpy(residuals, work, m * sizeof(double));
+        lambda = lambda / 10.0 > 1e-9 ? lambda / 10.0 : 1e-9;
+        if (cost - new_cost < 1e-12 * cost)
+            return new_cost;
+        cost = new_cost;
+    }
+    return cost;
+}
+
+int main(int argc, char **argv)
+{
+    FILE *file;
+    char line[256];
+    int time_step, robot, truth_robot, gps;
+    int count = 0, capacity = 1024, m = 0, horizon, horizon_m, iterations, total_iterations = 0, j, k;
+    double time, truth_time, x, y, gps_x, gps_y, cost, initial_cost;
+    double p[NB_PARAMS], JtJ[NB_PARAMS][NB_PARAMS], A[NB_PARAMS][NB_PARAMS], delta[NB_PARAMS];
+    pose_t origin;
+    odo_calibration_t calibration;
+    calib_step_t *steps;
+    double *times;
+
+    if (argc < 4)
+    {
+        printf("usage: %s <log> <truth> <robot> [param_file]\n", argv[0]);
+        return 1;
+    }
+    robot = atoi(argv[3]);
+
+    // Encoder deltas of the run
+    file = fopen(argv[1], "r");
+    if (file == NULL)
+    {
+        printf("cannot open %s\n", argv[1]);
+        return 1;
+    }
+    if (fscanf(file, "# %d %lf %lf %lf", &time_step, &origin.x, &origin.y, &origin.heading) != 4)
+    {
+        printf("%s is not a localization log\n", argv[1]);
+        fclose(file);
+        return 1;
+    }
+    steps = (calib_step_t *)malloc(capacity * sizeof(calib_step_t));
+    times = (double *)malloc(capacity * sizeof(double));
+    while (steps != NULL && times != NULL && fscanf(file, "%lf %lf %lf %d %lf %lf", &time, &steps[count].Aleft_enc, &steps[count].Aright_enc, &gps, &gps_x, &gps_y) == 6)
+    {
+        steps[count].has_truth = false;
+        times[count] = time;
+        count++;
+        if (count == capacity)
+        {
+            capacity *= 2;
+            steps = (calib_step_t *)realloc(steps, capacity * sizeof(calib_step_t));
+            times = (double *)realloc(times, capacity * sizeof(double));
+        }
+    }
+    fclose(file);
+    if (steps == NULL || times == NULL)
+    {
+        printf("odo_calibration: out of memory\n");
+        return 1;
+    }
+
+    // True positions of the robot, matched to the log steps by time
+    file = fopen(argv[2], "r");
+    if (file == NULL)
+    {
+        printf("cannot open %s\n", argv[2]);
+        return 1;
+    }
+    k = 0;
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        if (line[0] == '#' || sscanf(line, "%lf %d %lf %lf", &truth_time, &truth_robot, &x, &y) != 4 || truth_robot != robot)
+            continue;
+        while (k < count && times[k] < truth_time - TIME_TOLERANCE)
+            k++;
+        if (k < count && fabs(times[k] - truth_time) <= TIME_TOLERANCE)
+        {
+            steps[k].has_truth = true;
+            steps[k].truth_x = x;
+            steps[k].truth_y = y;
+            m += 2;
+        }
+    }
+    fclose(file);
+    if (m < 2 * NB_PARAMS)
+    {
+        printf("only %d true positions of epuck%d match the log\n", m / 2, robot);
+        return 1;
+    }
+
+    odometry_t *ctx = odo_create();
+    double *residuals = (double *)malloc(m * sizeof(double));
+    double *work = (double *)malloc(2 * m * sizeof(double));
+    double *J = (double *)malloc(m * NB_PARAMS * sizeof(double));
+    if (ctx == NULL || residuals == NULL || work == NULL || J == NULL)
+    {
+        printf("odo_calibration: out of memory\n");
+        return 1;
+    }
+
+    // Start from the default constants and the origin of the log
+    odo_get_calibration(ctx, &calibration);
+    p[0] = calibration.wheel_radius_left;
+    p[1] = calibration.wheel_radius_right;
+    p[2] = calibration.wheel_axis;
+    p[3] = origin.x;
+    p[4] = origin.y;
+    p[5] = origin.heading;
+    initial_cost = compute_residuals(ctx, time_step, steps, count, p, residuals);
+
+    cost = initial_cost;
+    horizon_m = 0;
+    for (horizon = FIRST_HORIZON; horizon_m < m; horizon *= 2)
+    {
+        if (horizon > count)
+            horizon = count;
+        for (horizon_m = 0, k = 0; k < horizon; k++)
+            horizon_m += steps[k].has_truth ? 2 : 0;
+        if (horizon_m < 2 * NB_PARAMS)
+            continue;
+        cost = fit_levenberg_marquardt(ctx, time_step, steps, horizon, horizon_m, p, JtJ, J, residuals, work, &iterations);
+        total_iterations += iterations;
+    }
+
+    // Standard deviations from the covariance of the fit, sigma^2 * (J'J)^-1
+    double sigma2 = cost / (m - NB_PARAMS);
+    printf("epuck%d: %d steps, %d true positions, %d iterations\n", robot, count, m / 2, total_iterations);
+    printf("rms position error %.4f m with the defaults, %.4f m calibrated\n", sqrt(initial_cost / (m / 2)), sqrt(cost / (m / 2)));
+    for (j = 0; j < NB_PARAMS; j++)
+    {
+        memcpy(A, JtJ, sizeof(A));
+        memset(delta, 0, sizeof(delta));
+        delta[j] = 1.0;
+        bool solved = solve_cholesky(A, delta);
+        printf("%-18s %.6f +- %.6f\n", param_names[j], p[j], solved ? sqrt(sigma2 * delta[j]) : NAN);
+        if (j == 2 && (!solved || sqrt(sigma2 * delta[j]) > 0.1 * p[j]))
+            printf("the run does not turn enough to observe the wheel axis\n");
+    }
+
+    if (argc > 4)
+    {
+        file = fopen(argv[4], "w");
+        if (file == NULL)
+        {
+            printf("cannot write %s\n", argv[4]);
+            return 1;
+        }
+        fprintf(file, "# Odometry calibration of epuck%d from %s, rms position error %.4f m over %d true positions\n", robot, argv[1], sqrt(cost / (m / 2)), m / 2);
+        for (j = 0; j < 3; j++)
+            fprintf(file, "%s = %.9g\n", param_names[j], p[j]);
+        fclose(file);
+    }
+
+    odo_destroy(ctx);
+    free(J);
+    free(work);
+    free(residuals);
+    free(times);
+    free(steps);
+    return 0;
+}
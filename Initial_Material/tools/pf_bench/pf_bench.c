@@ -0,0 +1,46 @@
+// Throughput of particle_filter_compute_pose in particles per millisecond
+//
+// usage: pf_bench [steps]
+// Runs steps 64 ms steps for several particle counts, near the rock at (0.958, 0.128) of
+// obstacles.wbt with ps0 and ps7 seeing it, a gps fix every 16 steps.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "particle_filter.h"
+
+int main(int argc, char **argv)
+{
+    static const int counts[] = {500, 1000, 2000, 4000, 8000, 16000};
+    int steps = argc > 1 ? atoi(argv[1]) : 2000;
+    int proximity[PF_NB_SENSORS] = {400, 80, 70, 65, 70, 75, 80, 380};
+    pose_t origin = {0.82, 0.128, 0.0};
+    pose_t gps, pose;
+    int i, t;
+
+    printf("%d SIMD lanes, %d steps\n", particle_filter_lanes(), steps);
+    for (i = 0; i < (int)(sizeof(counts) / sizeof(counts[0])); i++)
+    {
+        particle_filter_t *pf = particle_filter_create(counts[i]);
+        clock_t start;
+        double elapsed;
+
+        if (pf == NULL)
+            return 1;
+        particle_filter_reset(pf, &origin);
+        gps = origin;
+        start = clock();
+        for (t = 0; t < steps; t++)
+        {
+            // Back and forth in front of the rock, the readings stay plausible
+            double wheel = (t / 8) % 2 == 0 ? 0.05 : -0.05;
+
+            particle_filter_compute_pose(pf, &pose, &gps, t % 16 == 0, proximity, wheel, wheel);
+        }
+        elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
+        printf("%6d particles: %8.1f us/step, %8.0f particles/ms (pose %.3f %.3f)\n", counts[i], elapsed / steps * 1e6, counts[i] * steps / (elapsed * 1e3), pose.x, pose.y);
+        particle_filter_destroy(pf);
+    }
+    return 0;
+}
@@ -0,0 +1,178 @@
+// Check the encoding of the infrared ping
+//
+// usage: ping_packet_test [pings]
+// Encodes pings (default 1000000) random poses, velocities and covariances and decodes them
+// again, the error must stay within half a unit of each field. Then checks the byte layout of
+// ping_packet_t, the saturation of the fields out of range, the wrapping of the heading and
+// the packets ping_packet_cast must reject.
+// Exits with 1 if a check fails.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+
+#include "ping_packet.h"
+
+#define TWO_PI 6.2831853f
+#define FLOCK_ID 3
+
+static int failures = 0;
+
+static void check(bool ok, const char *what)
+{
+    printf("%-60s %s\n", what, ok ? "ok" : "FAILED");
+    if (!ok)
+        failures++;
+}
+
+static float uniform(float min, float max)
+{
+    return min + (max - min) * rand() / RAND_MAX;
+}
+
+// The difference of two headings, in [0, pi]
+static float heading_error(float a, float b)
+{
+    float d = fmodf(fabsf(a - b), TWO_PI);
+
+    return fminf(d, TWO_PI - d);
+}
+
+// Largest decoding errors of random pings, in units of each field
+static void check_round_trip(long pings)
+{
+    float pose[3], velocity[2], cov[3], std[2], correlation;
+    float decoded_pose[3], decoded_velocity[2], decoded_cov[3];
+    float position_error = 0.0f, heading_err = 0.0f, velocity_error = 0.0f, std_error = 0.0f, correlation_error = 0.0f;
+    ping_packet_t packet;
+    bool flags_ok = true, ids_ok = true;
+    long i;
+    int j;
+
+    for (i = 0; i < pings; i++)
+    {
+        for (j = 0; j < 2; j++)
+        {
+            pose[j] = uniform(-32.0f, 32.0f);
+            velocity[j] = uniform(-32.0f, 32.0f);
+            std[j] = uniform(0.0f, 6.5f);
+        }
+        pose[2] = uniform(-4.0f * TWO_PI, 4.0f * TWO_PI);
+        correlation = uniform(-1.0f, 1.0f);
+        cov[0] = std[0] * std[0];
+        cov[1] = correlation * std[0] * std[1];
+        cov[2] = std[1] * std[1];
+
+        ping_packet_encode(&packet, FLOCK_ID, (int)(i % 70000), (int)i, pose, velocity, cov);
+        flags_ok = flags_ok && ping_packet_get_pose(&packet, decoded_pose) && ping_packet_get_velocity(&packet, decoded_velocity) && ping_packet_get_cov(&packet, decoded_cov);
+        ids_ok = ids_ok && packet.flock_id == FLOCK_ID && packet.robot_id == (i % 70000) % 65536 && packet.sequence == i % 65536;
+
+        for (j = 0; j < 2; j++)
+        {
+            position_error = fmaxf(position_error, fabsf(decoded_pose[j] - pose[j]) * PING_POSITION_SCALE);
+            velocity_error = fmaxf(velocity_error, fabsf(decoded_velocity[j] - velocity[j]) * PING_VELOCITY_SCALE);
+        }
+        heading_err = fmaxf(heading_err, heading_error(decoded_pose[2], pose[2]) * PING_HEADING_SCALE);
+        std_error = fmaxf(std_error, fabsf(sqrtf(decoded_cov[0]) - std[0]) * PING_STD_SCALE);
+        std_error = fmaxf(std_error, fabsf(sqrtf(decoded_cov[2]) - std[1]) * PING_STD_SCALE);
+        if (decoded_cov[0] > 0.0f && decoded_cov[2] > 0.0f)
+            correlation_error = fmaxf(correlation_error, fabsf(decoded_cov[1] / sqrtf(decoded_cov[0] * decoded_cov[2]) - correlation) * PING_CORRELATION_SCALE);
+    }
+    printf("%ld random pings, largest errors in units: position %.3f, heading %.3f, velocity %.3f, std %.3f, correlation %.3f\n",
+           pings, position_error, heading_err, velocity_error, std_error, correlation_error);
+    check(flags_ok, "round trip: every field set is decoded");
+    check(ids_ok, "round trip: ids and sequence modulo 65536");
+    // Half a unit from the rounding, a little more from the float arithmetic on 32 m
+    check(position_error < 0.51f && velocity_error < 0.51f, "round trip: position and velocity within half a unit");
+    // The float wrap of headings up to 4 turns adds a few hundredths of a unit
+    check(heading_err < 0.55f, "round trip: heading within half a unit");
+    check(std_error < 0.51f, "round trip: std within half a unit");
+    // The decoded std are rounded too, the correlation computed from them is off by a bit more
+    check(correlation_error < 2.0f, "round trip: correlation within two units");
+}
+
+static void check_layout(void)
+{
+    check(sizeof(ping_packet_t) == 24, "layout: 24 bytes");
+    check(offsetof(ping_packet_t, version) == 0 && offsetof(ping_packet_t, flags) == 1 && offsetof(ping_packet_t, flock_id) == 2 &&
+              offsetof(ping_packet_t, robot_id) == 4 && offsetof(ping_packet_t, sequence) == 6 && offsetof(ping_packet_t, position) == 8 &&
+              offsetof(ping_packet_t, heading) == 12 && offsetof(ping_packet_t, velocity) == 14 && offsetof(ping_packet_t, std) == 18 &&
+              offsetof(ping_packet_t, correlation) == 22,
+          "layout: fields in order without padding");
+}
+
+static void check_saturation(void)
+{
+    const float far[3] = {100.0f, -100.0f, 0.0f}, fast[2] = {-1000.0f, 1000.0f};
+    const float wide[3] = {1000.0f, -2000.0f, 1000.0f}, negative[3] = {-1.0f, 0.5f, 0.0f};
+    const float not_a_number[3] = {NAN, NAN, NAN};
+    ping_packet_t packet;
+
+    ping_packet_encode(&packet, FLOCK_ID, 1, 0, far, fast, wide);
+    check(packet.position[0] == 32767 && packet.position[1] == -32767, "saturation: position");
+    check(packet.velocity[0] == -32767 && packet.velocity[1] == 32767, "saturation: velocity");
+    check(packet.std[0] == 65535 && packet.std[1] == 65535 && packet.correlation == -32767, "saturation: std and correlation");
+    ping_packet_encode(&packet, FLOCK_ID, 1, 0, NULL, NULL, negative);
+    check(packet.std[0] == 0 && packet.std[1] == 0 && packet.correlation == 0, "saturation: negative variances give a zero std");
+    ping_packet_encode(&packet, FLOCK_ID, 1, 0, not_a_number, not_a_number, NULL);
+    check(packet.position[0] == -32767 && packet.velocity[1] == -32767, "saturation: not a number gives the lowest value");
+}
+
+static void check_heading(void)
+{
+    const float headings[] = {0.0f, -0.1f, TWO_PI - 1e-6f, TWO_PI, 3.0f * TWO_PI + 1.0f, -2.0f * TWO_PI - 1.0f};
+    const float expected[] = {0.0f, TWO_PI - 0.1f, 0.0f, 0.0f, 1.0f, TWO_PI - 1.0f};
+    float pose[3] = {0.0f, 0.0f, 0.0f}, decoded[3];
+    ping_packet_t packet;
+    bool ok = true;
+    int i;
+
+    for (i = 0; i < (int)(sizeof(headings) / sizeof(headings[0])); i++)
+    {
+        pose[2] = headings[i];
+        ping_packet_encode(&packet, FLOCK_ID, 1, 0, pose, NULL, NULL);
+        ping_packet_get_pose(&packet, decoded);
+        ok = ok && decoded[2] >= 0.0f && decoded[2] < TWO_PI && fabsf(decoded[2] - expected[i]) < 1.0f / PING_HEADING_SCALE;
+    }
+    check(ok, "heading: wrapped to [0, 2 pi), the last unit to 0");
+}
+
+static void check_rejection(void)
+{
+    const char name[] = "epuck3";
+    unsigned char buffer[sizeof(ping_packet_t) + 1];
+    ping_packet_t packet, other;
+    float values[3];
+
+    ping_packet_encode(&packet, FLOCK_ID, 7, 42, NULL, NULL, NULL);
+    check(ping_packet_cast(&packet, sizeof(packet), FLOCK_ID) == &packet, "cast: a ping of the flock is read in place");
+    check(!ping_packet_get_pose(&packet, values) && !ping_packet_get_velocity(&packet, values) && !ping_packet_get_cov(&packet, values),
+          "cast: the fields not set are not decoded");
+    check(ping_packet_cast(NULL, sizeof(packet), FLOCK_ID) == NULL, "cast: no data");
+    check(ping_packet_cast(&packet, sizeof(packet) - 1, FLOCK_ID) == NULL, "cast: a short packet");
+    memcpy(buffer, &packet, sizeof(packet));
+    buffer[sizeof(packet)] = 0;
+    check(ping_packet_cast(buffer, sizeof(buffer), FLOCK_ID) == NULL, "cast: a long packet");
+    check(ping_packet_cast(name, sizeof(name), FLOCK_ID) == NULL, "cast: the name string of the old pings");
+    other = packet;
+    other.version = PING_PACKET_VERSION + 1;
+    check(ping_packet_cast(&other, sizeof(other), FLOCK_ID) == NULL, "cast: another version");
+    check(ping_packet_cast(&packet, sizeof(packet), FLOCK_ID + 1) == NULL, "cast: another flock");
+}
+
+int main(int argc, char **argv)
+{
+    long pings = argc > 1 ? atol(argv[1]) : 1000000;
+
+    srand(1);
+    check_round_trip(pings);
+    check_layout();
+    check_saturation();
+    check_heading();
+    check_rejection();
+    printf("%d checks failed\n", failures);
+    return failures > 0;
+}
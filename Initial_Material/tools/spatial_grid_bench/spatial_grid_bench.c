@@ -0,0 +1,142 @@
+// Cost of the radius and k nearest queries of the spatial grid against the brute force loops
+//
+// usage: spatial_grid_bench [radius]
+// Flocks of 5 to 5000 robots spread uniformly at a constant density of one robot per
+// 0.1 m x 0.1 m, each robot queries the robots within radius (default 0.25 m, about the
+// separation distance and the infrared range) and its 6 nearest neighbours. The grid results
+// are checked against the brute force ones.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+
+#include "spatial_grid.h"
+
+#define K_NEAREST 6
+
+static float xy[SPATIAL_GRID_CAPACITY][2];
+static int found[SPATIAL_GRID_CAPACITY];
+static spatial_grid_t grid;
+
+// The time of one call of a pass, averaged over enough repetitions to last 0.2 s
+static double time_pass(int (*pass)(int, float), int count, float radius, int *result)
+{
+    clock_t start = clock();
+    int repeat = 0;
+
+    do
+    {
+        *result = pass(count, radius);
+        repeat++;
+    } while (clock() - start < CLOCKS_PER_SEC / 5);
+    return (double)(clock() - start) / CLOCKS_PER_SEC / repeat;
+}
+
+// Pairs closer than radius
+static int brute_radius(int count, float radius)
+{
+    int i, j, pairs = 0;
+
+    for (i = 0; i < count; i++)
+    {
+        for (j = i + 1; j < count; j++)
+        {
+            float dx = xy[i][0] - xy[j][0], dy = xy[i][1] - xy[j][1];
+            pairs += dx * dx + dy * dy <= radius * radius;
+        }
+    }
+    return pairs;
+}
+
+static int grid_radius(int count, float radius)
+{
+    int i, k, n, pairs = 0;
+
+    spatial_grid_build(&grid, &xy[0][0], 2, count, radius);
+    for (i = 0; i < count; i++)
+    {
+        n = spatial_grid_radius(&grid, xy[i][0], xy[i][1], radius, found, SPATIAL_GRID_CAPACITY);
+        for (k = 0; k < n; k++)
+            pairs += found[k] > i;
+    }
+    return pairs;
+}
+
+// Sum of the distances to the k nearest of every robot, in 0.1 mm^2
+static int brute_nearest(int count, float radius)
+{
+    float best[K_NEAREST];
+    int i, j, n, m, sum = 0;
+
+    for (i = 0; i < count; i++)
+    {
+        n = 0;
+        for (j = 0; j < count; j++)
+        {
+            float dx = xy[i][0] - xy[j][0], dy = xy[i][1] - xy[j][1];
+            float d2 = dx * dx + dy * dy;
+
+            if (j == i || (n == K_NEAREST && d2 >= best[K_NEAREST - 1]))
+                continue;
+            m = n < K_NEAREST ? n++ : K_NEAREST - 1;
+            for (; m > 0 && best[m - 1] > d2; m--)
+                best[m] = best[m - 1];
+            best[m] = d2;
+        }
+        for (m = 0; m < n; m++)
+            sum += (int)(1e4f * best[m]);
+    }
+    return sum;
+}
+
+static int grid_nearest(int count, float radius)
+{
+    float dist2[K_NEAREST];
+    int i, m, n, sum = 0;
+
+    spatial_grid_build(&grid, &xy[0][0], 2, count, radius);
+    for (i = 0; i < count; i++)
+    {
+        n = spatial_grid_nearest(&grid, xy[i][0], xy[i][1], K_NEAREST, i, found, dist2);
+        for (m = 0; m < n; m++)
+            sum += (int)(1e4f * dist2[m]);
+    }
+    return sum;
+}
+
+int main(int argc, char **argv)
+{
+    static const int counts[] = {5, 50, 500, 5000};
+    float radius = argc > 1 ? atof(argv[1]) : 0.25f;
+    int brute, fast;
+    double brute_time, fast_time;
+    int i, c, failed = 0;
+
+    srand(1);
+    printf("radius %.2f m, %d nearest\n", radius, K_NEAREST);
+    printf("robots | radius: brute us   grid us  speedup | nearest: brute us   grid us  speedup\n");
+    for (c = 0; c < (int)(sizeof(counts) / sizeof(counts[0])); c++)
+    {
+        int count = counts[c];
+        float side = 0.1f * sqrtf(count);
+
+        for (i = 0; i < count; i++)
+        {
+            xy[i][0] = side * rand() / RAND_MAX;
+            xy[i][1] = side * rand() / RAND_MAX;
+        }
+        printf("%6d |", count);
+        brute_time = time_pass(brute_radius, count, radius, &brute);
+        fast_time = time_pass(grid_radius, count, radius, &fast);
+        printf(" %16.1f %9.1f %7.1fx |", brute_time * 1e6, fast_time * 1e6, brute_time / fast_time);
+        failed |= brute != fast;
+        brute_time = time_pass(brute_nearest, count, radius, &brute);
+        fast_time = time_pass(grid_nearest, count, radius, &fast);
+        printf(" %17.1f %9.1f %7.1fx\n", brute_time * 1e6, fast_time * 1e6, brute_time / fast_time);
+        failed |= brute != fast;
+    }
+    if (failed)
+        printf("grid and brute force results differ!\n");
+    return failed;
+}